@@ -4,6 +4,7 @@
 #include <string.h>
 // #include "buffer.h"
 #include "kilo.h"
+#include "hllayer.h"
 
 /**
  * Create a new buffer.
@@ -24,6 +25,12 @@ editorBuffer *editorCreateBuffer(void) {
     buf->rowoff = 0;
     buf->coloff = 0;
     buf->syntax = NULL;
+    buf->hl_generation = 0;
+    buf->hl_stale_rows = 0;
+    buf->hl_stale_from = 0;
+    buf->hl_checkpoints = NULL;
+    buf->hl_checkpoint_capacity = 0;
+    buf->hl_layers = NULL;
     buf->next = NULL;
     buf->prev = NULL;
     buf->parent_dir_fd = -1;
@@ -90,10 +97,14 @@ void editorSwitchBuffer(editorBuffer *targetBuffer) {
     E.filename = targetBuffer->filename;
     // E.dirname = getEditingDirname(targetBuffer->filename);
     E.syntax = targetBuffer->syntax;
-    
-    // Update syntax highlighting if necessary
-    editorSelectSyntaxHighlight();
+
+    // The buffer keeps its highlighting while in the background; it is only
+    // redone if it was never done or the syntax definitions were reloaded
+    if (targetBuffer->hl_generation != E.syntax_generation) {
+        editorSelectSyntaxHighlight(targetBuffer);
+    }
     editorClearStatusMessage();
+    sceneTouch(SCENE_DEP_TEXT | SCENE_DEP_TREE); // The panel marks the current file
 }
 
 /**
@@ -167,6 +178,8 @@ void editorCloseBuffer(editorBuffer *bufferToClose) {
     free(bufferToClose->filename);
     free(bufferToClose->dirname);
     free(bufferToClose->row);
+    free(bufferToClose->hl_checkpoints);
+    highlightLayersFree(bufferToClose);
     free(bufferToClose);
     
     E.num_buffers--;
@@ -1,5 +1,8 @@
 #include "kilo.h"
 #include "components.h"
+#include "unicode.h"
+#include "luamemo.h"
+#include "statusline.h"
 
 /**
  * Improved Layout Implementation for Kilo Editor
@@ -9,6 +12,9 @@
  * - Lua defines content and styling for components
  * - Components can request size hints which C tries to accommodate
  * 
+ * Components are nodes of the scene graph (see scene.c), which also
+ * decides when they are redrawn.
+ * 
  * The implementation includes:
  * 1. Component registration system
  * 2. Layout calculation pipeline
@@ -20,20 +26,10 @@
 
 // Initialize the component system
 void initComponentSystem() {
-    // Allocate initial component array
-    component_system.component_capacity = 10;
-    component_system.components = malloc(sizeof(ComponentLayout) * component_system.component_capacity);
-    component_system.component_count = 0;
-    
-    // Initialize references to NULL
-    component_system.textarea = NULL;
-    component_system.statusbar = NULL;
-    component_system.tabline = NULL;
-    component_system.messagebar = NULL;
-    component_system.panel = NULL;
+    sceneInit();
     
     // Get initial screen dimensions
-    getWindowSize(&component_system.screen_height, &component_system.screen_width);
+    getWindowSize(&scene.screen_height, &scene.screen_width);
     
     // Register default components
     registerDefaultComponents();
@@ -41,120 +37,91 @@ void initComponentSystem() {
 
 // Clean up component system resources
 void freeComponentSystem() {
-    for (int i = 0; i < component_system.component_count; i++) {
-        free(component_system.components[i].name);
-    }
-    free(component_system.components);
+    sceneFree();
 }
 
-// Register a new component
-ComponentLayout* registerComponent(const char *name, ComponentType type, ComponentPosition position) {
-    // Ensure we have capacity
-    if (component_system.component_count >= component_system.component_capacity) {
-        component_system.component_capacity *= 2;
-        ComponentLayout *new_components = realloc(component_system.components, 
-            sizeof(ComponentLayout) * component_system.component_capacity);
-        if (!new_components) {
-            debug_printf("Failed to allocate memory for components");
-            return NULL;
-        }
-        component_system.components = new_components;
-    }
-    
-    // Create new component
-    ComponentLayout *component = &component_system.components[component_system.component_count++];
-    component->name = strdup(name);
-    component->type = type;
-    component->position = position;
-    component->visible = true;
-    component->lua_callback_ref = LUA_NOREF;
-    component->z_index = 0;
+// Register a new component. The scene graph is kept sorted by z-index
+// (components with equal z-index stay in registration order), so neither
+// layout nor drawing has to sort it. Pointers to components are invalidated.
+SceneNode* registerComponent(const char *name, ComponentType type, ComponentPosition position, int z_index) {
+    SceneNode *component = sceneInsertNode(name, type, position, z_index);
+    if (!component) return NULL;
     
     // Set default dimensions based on position
     switch (position) {
         case POSITION_TOP:
             component->x = 1;
             component->y = 1;
-            component->width = component_system.screen_width;
+            component->width = scene.screen_width;
             component->height = 1;
             break;
         case POSITION_BOTTOM:
             component->x = 1;
-            component->y = component_system.screen_height;
-            component->width = component_system.screen_width;
+            component->y = scene.screen_height;
+            component->width = scene.screen_width;
             component->height = 1;
             break;
         case POSITION_LEFT:
             component->x = 1;
             component->y = 2; // Assume below tabline
             component->width = 20;
-            component->height = component_system.screen_height - 2;
+            component->height = scene.screen_height - 2;
             break;
         case POSITION_RIGHT:
-            component->x = component_system.screen_width - 20 + 1;
+            component->x = scene.screen_width - 20 + 1;
             component->y = 2; // Assume below tabline
             component->width = 20;
-            component->height = component_system.screen_height - 2;
+            component->height = scene.screen_height - 2;
             break;
         case POSITION_CENTER:
             component->x = 1;
             component->y = 2; // Assume below tabline
-            component->width = component_system.screen_width;
-            component->height = component_system.screen_height - 3; // Leave space for status and message
+            component->width = scene.screen_width;
+            component->height = scene.screen_height - 3; // Leave space for status and message
             break;
         case POSITION_FLOATING:
             // Floating windows will be positioned by their callbacks
-            component->x = (component_system.screen_width - 40) / 2 + 1;
-            component->y = (component_system.screen_height - 10) / 2 + 1;
+            component->x = (scene.screen_width - 40) / 2 + 1;
+            component->y = (scene.screen_height - 10) / 2 + 1;
             component->width = 40;
             component->height = 10;
-            component->z_index = 10; // Floating windows on top by default
             break;
     }
     
-    // Store quick references to standard components
-    if (strcmp(name, "textarea") == 0) {
-        component_system.textarea = component;
-    } else if (strcmp(name, "statusbar") == 0) {
-        component_system.statusbar = component;
-    } else if (strcmp(name, "tabline") == 0) {
-        component_system.tabline = component;
-    } else if (strcmp(name, "messagebar") == 0) {
-        component_system.messagebar = component;
-    } else if (strcmp(name, "panel") == 0) {
-        component_system.panel = component;
-    }
+    invalidateLayout();
     
     return component;
 }
 
 // Register default components
 void registerDefaultComponents() {
-    // Register standard components with default positions and dimensions
-    registerComponent("tabline", COMPONENT_TABLINE, POSITION_TOP);
-    registerComponent("statusbar", COMPONENT_STATUSBAR, POSITION_BOTTOM);
-    registerComponent("messagebar", COMPONENT_MESSAGEBAR, POSITION_BOTTOM);
-    registerComponent("textarea", COMPONENT_TEXTAREA, POSITION_CENTER);
-    registerComponent("panel", COMPONENT_PANEL, POSITION_LEFT);
+    // Register standard components with default positions, dimensions and
+    // z-indices for proper layering
+    registerComponent("tabline", COMPONENT_TABLINE, POSITION_TOP, 1);
+    registerComponent("statusbar", COMPONENT_STATUSBAR, POSITION_BOTTOM, 1);
+    registerComponent("messagebar", COMPONENT_MESSAGEBAR, POSITION_BOTTOM, 2); // Above statusbar
+    registerComponent("textarea", COMPONENT_TEXTAREA, POSITION_CENTER, 0);
+    registerComponent("panel", COMPONENT_PANEL, POSITION_LEFT, 0);
     
     // Hide panel by default
-    if (component_system.panel) {
-        component_system.panel->visible = false;
+    if (scene.panel) {
+        scene.panel->visible = false;
     }
     
-    // Set z-indices for proper layering
-    if (component_system.tabline) component_system.tabline->z_index = 1;
-    if (component_system.statusbar) component_system.statusbar->z_index = 1;
-    if (component_system.messagebar) component_system.messagebar->z_index = 2; // Above statusbar
-    if (component_system.textarea) component_system.textarea->z_index = 0;
-    if (component_system.panel) component_system.panel->z_index = 0;
+    // What each built-in component's output depends on (anything not
+    // listed keeps SCENE_DEP_ALWAYS). The status bar shows a clock and the
+    // message bar expires messages, so they are redrawn every frame; the
+    // text area has its own row cache.
+    if (scene.tabline) scene.tabline->depends = SCENE_DEP_TEXT | SCENE_DEP_STYLE;
+    if (scene.panel) scene.panel->depends = SCENE_DEP_TREE | SCENE_DEP_STYLE;
 }
 
-// Find a component by name
-ComponentLayout* findComponent(const char *name) {
-    for (int i = 0; i < component_system.component_count; i++) {
-        if (strcmp(component_system.components[i].name, name) == 0) {
-            return &component_system.components[i];
+// Find a component by name (overlays are not components)
+SceneNode* findComponent(const char *name) {
+    for (int i = 0; i < scene.node_count; i++) {
+        if (scene.nodes[i].type == COMPONENT_OVERLAY) continue;
+        if (strcmp(scene.nodes[i].name, name) == 0) {
+            return &scene.nodes[i];
         }
     }
     return NULL;
@@ -162,41 +129,90 @@ ComponentLayout* findComponent(const char *name) {
 
 // --- Layout Calculation ---
 
-// Calculate the layout of all components
+// Force the next calculateLayout() to recompute component positions
+void invalidateLayout(void) {
+    scene.layout_dirty = true;
+}
+
+// Show or hide a component, invalidating the layout if that changes anything
+void setComponentVisible(SceneNode *component, bool visible) {
+    if (component->visible == visible) return;
+    component->visible = visible;
+    component->dirty = true; // Its retained output may be stale
+    invalidateLayout();
+}
+
+/*
+ * Evaluates a component's Lua callback, at most once per layout frame, into
+ * its memo (see luamemo.c): the callback itself only runs again once the
+ * state it read has changed. Layout and drawing share the parsed result.
+ * Size hints from the options are stored on the component; a changed hint
+ * invalidates the layout.
+ * Returns false if there is no callback or it failed.
+ */
+static bool evaluateComponent(SceneNode *component) {
+    if (component->lua_callback_ref == LUA_NOREF) return false;
+    if (component->result_frame == scene.frame) return component->result_ok;
+
+    if (!component->memo) {
+        component->memo = calloc(1, sizeof(LuaMemo));
+        if (!component->memo) return false;
+        component->memo->name = component->name;
+    }
+
+    component->result_frame = scene.frame;
+    component->result_ok = luaMemoEvaluate(component->memo, component->lua_callback_ref);
+    if (!component->result_ok) return false;
+
+    // Check options for height/width hints
+    const LuaMemoOptions *options = &component->memo->options;
+    int lua_height = options->height != MEMO_UNSET ? options->height : -1;
+    int lua_width = options->width != MEMO_UNSET ? options->width : -1;
+    if (lua_height != component->hint_height || lua_width != component->hint_width) {
+        component->hint_height = lua_height;
+        component->hint_width = lua_width;
+        invalidateLayout();
+    }
+    return true;
+}
+
+/*
+ * Calculate the layout of all components. Positions are retained between
+ * frames and only recomputed after a resize, a registration or visibility
+ * change, or when a callback's size hints change.
+ */
 void calculateLayout() {
-    // Get current screen dimensions
-    int old_width = component_system.screen_width;
-    int old_height = component_system.screen_height;
-    getWindowSize(&component_system.screen_height, &component_system.screen_width);
-    
-    // Check if screen dimensions have changed
-    bool dimensions_changed = (old_width != component_system.screen_width || 
-                              old_height != component_system.screen_height);
-    
-    // Sort components by z-index for layout calculation
-    // (This is a simple bubble sort - could be quicksort for larger lists)
-    for (int i = 0; i < component_system.component_count - 1; i++) {
-        for (int j = 0; j < component_system.component_count - i - 1; j++) {
-            if (component_system.components[j].z_index > component_system.components[j + 1].z_index) {
-                // Swap components
-                ComponentLayout temp = component_system.components[j];
-                component_system.components[j] = component_system.components[j + 1];
-                component_system.components[j + 1] = temp;
-                
-                // Update quick references if needed
-                if (component_system.textarea == &component_system.components[j]) {
-                    component_system.textarea = &component_system.components[j + 1];
-                } else if (component_system.textarea == &component_system.components[j + 1]) {
-                    component_system.textarea = &component_system.components[j];
-                }
-                // Similar updates for other quick references...
-            }
+    scene.frame++;
+
+    // Only re-query the window size after SIGWINCH
+    if (editorConsumeResize()) {
+        int rows, cols;
+        if (getWindowSize(&rows, &cols) == 0) { // Else keep the previous size
+            scene.screen_height = rows;
+            scene.screen_width = cols;
         }
+        E.screencols = scene.screen_width;
+        E.total_rows = scene.screen_height;
+        invalidateLayout();
+        sceneTouch(SCENE_DEP_STYLE); // The terminal may have reflowed what was on screen
     }
+
+    // Callbacks of fixed components are evaluated up front for their size
+    // hints; drawing reuses the results
+    for (int i = 0; i < scene.node_count; i++) {
+        SceneNode *component = &scene.nodes[i];
+        if (!component->visible || component->type == COMPONENT_TEXTAREA ||
+            component->type == COMPONENT_OVERLAY || component->position == POSITION_FLOATING) continue;
+        evaluateComponent(component);
+    }
+
+    if (!scene.layout_dirty) return;
+    scene.layout_dirty = false;
+    scene.layout_generation++;
     
     // Process fixed components first
-    for (int i = 0; i < component_system.component_count; i++) {
-        ComponentLayout *component = &component_system.components[i];
+    for (int i = 0; i < scene.node_count; i++) {
+        SceneNode *component = &scene.nodes[i];
         
         // Skip invisible components
         if (!component->visible) continue;
@@ -207,87 +223,60 @@ void calculateLayout() {
         // Skip floating components (managed by their callbacks)
         if (component->position == POSITION_FLOATING) continue;
         
-        // Call Lua callback to get size hints if available
-        int lua_height = -1, lua_width = -1;
-        if (component->lua_callback_ref != LUA_NOREF) {
-            lua_State *L = getLuaState();
-            if (L) {
-                lua_rawgeti(L, LUA_REGISTRYINDEX, component->lua_callback_ref);
-                if (lua_pcall(L, 0, 2, 0) == LUA_OK) {
-                    // Check options table for height/width hints
-                    if (lua_istable(L, -1)) {
-                        lua_getfield(L, -1, "height");
-                        if (lua_isnumber(L, -1)) {
-                            lua_height = lua_tointeger(L, -1);
-                        }
-                        lua_pop(L, 1);
-                        
-                        lua_getfield(L, -1, "width");
-                        if (lua_isnumber(L, -1)) {
-                            lua_width = lua_tointeger(L, -1);
-                        }
-                        lua_pop(L, 1);
-                    }
-                    lua_pop(L, 2); // Pop segments and options
-                } else {
-                    // Handle error
-                    debug_printf("Error calling component Lua callback: %s", lua_tostring(L, -1));
-                    lua_pop(L, 1); // Pop error message
-                }
-            }
-        }
+        int lua_height = component->hint_height;
+        int lua_width = component->hint_width;
         
         // Update component dimensions based on screen size and hints
         switch (component->position) {
             case POSITION_TOP:
                 component->x = 1;
-                component->width = component_system.screen_width;
+                component->width = scene.screen_width;
                 // Apply height hint if provided
                 if (lua_height > 0) component->height = lua_height;
                 break;
                 
             case POSITION_BOTTOM:
                 component->x = 1;
-                component->width = component_system.screen_width;
+                component->width = scene.screen_width;
                 // Apply height hint if provided
                 if (lua_height > 0) component->height = lua_height;
                 // Adjust y position based on height
-                component->y = component_system.screen_height - component->height + 1;
+                component->y = scene.screen_height - component->height + 1;
                 break;
                 
             case POSITION_LEFT:
                 component->y = 1;
-                if (component_system.tabline && component_system.tabline->visible) {
-                    component->y += component_system.tabline->height;
+                if (scene.tabline && scene.tabline->visible) {
+                    component->y += scene.tabline->height;
                 }
                 // Apply width hint if provided
                 if (lua_width > 0) component->width = lua_width;
                 // Calculate height based on available space
-                component->height = component_system.screen_height - component->y + 1;
-                if (component_system.statusbar && component_system.statusbar->visible) {
-                    component->height -= component_system.statusbar->height;
+                component->height = scene.screen_height - component->y + 1;
+                if (scene.statusbar && scene.statusbar->visible) {
+                    component->height -= scene.statusbar->height;
                 }
-                if (component_system.messagebar && component_system.messagebar->visible) {
-                    component->height -= component_system.messagebar->height;
+                if (scene.messagebar && scene.messagebar->visible) {
+                    component->height -= scene.messagebar->height;
                 }
                 break;
                 
             case POSITION_RIGHT:
                 component->y = 1;
-                if (component_system.tabline && component_system.tabline->visible) {
-                    component->y += component_system.tabline->height;
+                if (scene.tabline && scene.tabline->visible) {
+                    component->y += scene.tabline->height;
                 }
                 // Apply width hint if provided
                 if (lua_width > 0) component->width = lua_width;
                 // Adjust x position based on width
-                component->x = component_system.screen_width - component->width + 1;
+                component->x = scene.screen_width - component->width + 1;
                 // Calculate height based on available space
-                component->height = component_system.screen_height - component->y + 1;
-                if (component_system.statusbar && component_system.statusbar->visible) {
-                    component->height -= component_system.statusbar->height;
+                component->height = scene.screen_height - component->y + 1;
+                if (scene.statusbar && scene.statusbar->visible) {
+                    component->height -= scene.statusbar->height;
                 }
-                if (component_system.messagebar && component_system.messagebar->visible) {
-                    component->height -= component_system.messagebar->height;
+                if (scene.messagebar && scene.messagebar->visible) {
+                    component->height -= scene.messagebar->height;
                 }
                 break;
                 
@@ -302,292 +291,147 @@ void calculateLayout() {
     }
     
     // Finally calculate textarea dimensions based on other components
-    if (component_system.textarea && component_system.textarea->visible) {
+    if (scene.textarea && scene.textarea->visible) {
         // Start with full screen
-        component_system.textarea->x = 1;
-        component_system.textarea->y = 1;
-        component_system.textarea->width = component_system.screen_width;
-        component_system.textarea->height = component_system.screen_height;
+        scene.textarea->x = 1;
+        scene.textarea->y = 1;
+        scene.textarea->width = scene.screen_width;
+        scene.textarea->height = scene.screen_height;
         
         // Adjust for tabline
-        if (component_system.tabline && component_system.tabline->visible) {
-            component_system.textarea->y += component_system.tabline->height;
-            component_system.textarea->height -= component_system.tabline->height;
+        if (scene.tabline && scene.tabline->visible) {
+            scene.textarea->y += scene.tabline->height;
+            scene.textarea->height -= scene.tabline->height;
         }
         
         // Adjust for statusbar and messagebar
-        if (component_system.statusbar && component_system.statusbar->visible) {
-            component_system.textarea->height -= component_system.statusbar->height;
+        if (scene.statusbar && scene.statusbar->visible) {
+            scene.textarea->height -= scene.statusbar->height;
         }
-        if (component_system.messagebar && component_system.messagebar->visible) {
-            component_system.textarea->height -= component_system.messagebar->height;
+        if (scene.messagebar && scene.messagebar->visible) {
+            scene.textarea->height -= scene.messagebar->height;
         }
         
         // Adjust for left panel
-        if (component_system.panel && component_system.panel->visible && 
-            component_system.panel->position == POSITION_LEFT) {
-            component_system.textarea->x += component_system.panel->width;
-            component_system.textarea->width -= component_system.panel->width;
+        if (scene.panel && scene.panel->visible && 
+            scene.panel->position == POSITION_LEFT) {
+            scene.textarea->x += scene.panel->width;
+            scene.textarea->width -= scene.panel->width;
         }
         
         // Adjust for right panel
-        if (component_system.panel && component_system.panel->visible && 
-            component_system.panel->position == POSITION_RIGHT) {
-            component_system.textarea->width -= component_system.panel->width;
+        if (scene.panel && scene.panel->visible && 
+            scene.panel->position == POSITION_RIGHT) {
+            scene.textarea->width -= scene.panel->width;
         }
         
         // Ensure dimensions are valid
-        if (component_system.textarea->height < 1) component_system.textarea->height = 1;
-        if (component_system.textarea->width < 1) component_system.textarea->width = 1;
+        if (scene.textarea->height < 1) scene.textarea->height = 1;
+        if (scene.textarea->width < 1) scene.textarea->width = 1;
         
         // Update editor global dimensions for text area
-        E.content_start_row = component_system.textarea->y;
-        E.content_start_col = component_system.textarea->x;
-        E.screenrows = component_system.textarea->height;
-        E.content_width = component_system.textarea->width;
+        E.content_start_row = scene.textarea->y;
+        E.content_start_col = scene.textarea->x;
+        E.screenrows = scene.textarea->height;
+        E.content_width = scene.textarea->width;
     }
 }
 
 // --- Drawing Functions ---
 
-// Draw all components
-void drawComponents(struct abuf *ab) {
-    // Sort components by z-index for drawing order
-    // (This is a simple bubble sort - could be quicksort for larger lists)
-    for (int i = 0; i < component_system.component_count - 1; i++) {
-        for (int j = 0; j < component_system.component_count - i - 1; j++) {
-            if (component_system.components[j].z_index > component_system.components[j + 1].z_index) {
-                // Swap components
-                ComponentLayout temp = component_system.components[j];
-                component_system.components[j] = component_system.components[j + 1];
-                component_system.components[j + 1] = temp;
-                
-                // Update quick references if needed
-                if (component_system.textarea == &component_system.components[j]) {
-                    component_system.textarea = &component_system.components[j + 1];
-                } else if (component_system.textarea == &component_system.components[j + 1]) {
-                    component_system.textarea = &component_system.components[j];
-                }
-                // Similar updates for other quick references...
-            }
-        }
-    }
-    
-    // Draw components in order of z-index (lowest first)
-    for (int i = 0; i < component_system.component_count; i++) {
-        ComponentLayout *component = &component_system.components[i];
-        if (!component->visible) continue;
-        
-        // Draw the component based on its type
-        switch (component->type) {
-            case COMPONENT_TEXTAREA:
-                drawTextareaComponent(ab, component);
-                break;
-            case COMPONENT_STATUSBAR:
-                drawStatusbarComponent(ab, component);
-                break;
-            case COMPONENT_TABLINE:
-                drawTablineComponent(ab, component);
-                break;
-            case COMPONENT_MESSAGEBAR:
-                drawMessagebarComponent(ab, component);
-                break;
-            case COMPONENT_PANEL:
-                drawPanelComponent(ab, component);
-                break;
-            case COMPONENT_FLOATING:
-            case COMPONENT_CUSTOM:
-                drawCustomComponent(ab, component);
-                break;
-        }
-    }
-    
-    // Draw overlays (these are managed separately)
-    for (int i = 0; i < E.num_active_overlays; i++) {
-        OverlayInstance *overlay = &E.active_overlays[i];
-        if (overlay->draw_func) {
-            overlay->draw_func(ab, overlay->state);
-        }
-    }
-    
-    // Draw debug overlay if active
-    if (debug_overlay_active) {
-        editorDrawDebugOverlay(ab);
+// Draw a component into buffer (called by sceneRender for dirty nodes)
+void drawComponent(struct abuf *ab, SceneNode *component) {
+    // Draw the component based on its type
+    switch (component->type) {
+        case COMPONENT_TEXTAREA:
+            drawTextareaComponent(ab, component);
+            break;
+        case COMPONENT_STATUSBAR:
+            drawStatusbarComponent(ab, component);
+            break;
+        case COMPONENT_TABLINE:
+            drawTablineComponent(ab, component);
+            break;
+        case COMPONENT_MESSAGEBAR:
+            drawMessagebarComponent(ab, component);
+            break;
+        case COMPONENT_PANEL:
+            drawPanelComponent(ab, component);
+            break;
+        case COMPONENT_FLOATING:
+        case COMPONENT_CUSTOM:
+            drawCustomComponent(ab, component);
+            break;
+        case COMPONENT_OVERLAY:
+            break; // Drawn through their draw_func (see scene.c)
     }
 }
 
 // Draw textarea component
-void drawTextareaComponent(struct abuf *ab, ComponentLayout *component) {
+void drawTextareaComponent(struct abuf *ab, SceneNode *component) {
     // Draw the text area using its calculated dimensions
-    editorDrawRows(ab, component->x, component->y, component->width, component->height);
+    editorDrawRows(ab, component->y, component->x, component->height, component->width);
+}
+
+// Draws a run of status segments with the given alignment, starting at x.
+// Returns the column after the last one.
+static int drawStatusSegments(struct abuf *ab, const LuaMemo *memo, int align, int x, int y,
+                              const char *status_fg, const char *status_bg) {
+    for (int i = 0; i < memo->segment_count; i++) {
+        const LuaMemoSegment *seg = &memo->segments[i];
+        if (seg->align != align) continue;
+
+        // Position cursor and draw segment
+        char pos_buf[32];
+        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", y, x);
+        abAppend(ab, pos_buf, strlen(pos_buf));
+
+        applyTrueColor(ab, luaMemoColor(seg->fg, seg->fg_hex, status_fg),
+                       luaMemoColor(seg->bg, seg->bg_hex, status_bg));
+        abAppend(ab, seg->text, seg->len);
+        x += seg->width;
+    }
+    return x;
 }
 
 // Draw statusbar component
-void drawStatusbarComponent(struct abuf *ab, ComponentLayout *component) {
-    if (component->lua_callback_ref != LUA_NOREF) {
+void drawStatusbarComponent(struct abuf *ab, SceneNode *component) {
+    if (statusline_template.op_count > 0) {
+        // Native template; the component's callback only feeds %lua
+        char pos_buf[32];
+        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, component->x);
+        abAppend(ab, pos_buf, strlen(pos_buf));
+        bool dynamic = statusline_template.uses_lua && evaluateComponent(component);
+        drawStatusTemplate(ab, &statusline_template, component->width, dynamic ? component->memo : NULL);
+    } else if (component->lua_callback_ref != LUA_NOREF) {
         // Position cursor at component start
         char pos_buf[32];
         snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, component->x);
         abAppend(ab, pos_buf, strlen(pos_buf));
         
-        // Call Lua callback to get content
-        lua_State *L = getLuaState();
-        if (!L) {
+        // Segments and options from this frame's evaluation
+        if (!evaluateComponent(component)) {
             editorDrawDefaultStatusBar(ab);
             return;
         }
+        const LuaMemo *memo = component->memo;
         
-        lua_rawgeti(L, LUA_REGISTRYINDEX, component->lua_callback_ref);
-        if (lua_pcall(L, 0, 2, 0) != LUA_OK) {
-            const char *error_msg = lua_tostring(L, -1);
-            debug_printf("Error calling statusbar Lua func: %s", error_msg);
-            lua_pop(L, 1);
-            editorDrawDefaultStatusBar(ab);
-            return;
-        }
-        
-        // Process segments and options
-        if (!lua_istable(L, -2)) {
-            debug_printf("Statusbar Lua function didn't return segments table");
-            lua_pop(L, 2);
-            editorDrawDefaultStatusBar(ab);
-            return;
-        }
-        
-        // Get default colors
-        char *status_fg = E.theme.ui_status_fg;
-        char *status_bg = E.theme.ui_status_bg;
-        
-        // Check options table for colors
-        if (lua_istable(L, -1)) {
-            lua_getfield(L, -1, "fg");
-            if (lua_isstring(L, -1)) {
-                const char *n = lua_tostring(L, -1);
-                char* t = getThemeColorByName(n);
-                if(t) status_fg = t; else if(n[0] == '#') status_fg = (char*)n;
-            }
-            lua_pop(L, 1);
-            
-            lua_getfield(L, -1, "bg");
-            if (lua_isstring(L, -1)) {
-                const char *n = lua_tostring(L, -1);
-                char* t = getThemeColorByName(n);
-                if(t) status_bg = t; else if(n[0] == '#') status_bg = (char*)n;
-            }
-            lua_pop(L, 1);
-        }
+        // Colors from the options, else the theme's
+        const char *status_fg = luaMemoColor(memo->options.fg, memo->options.fg_hex, E.theme.ui_status_fg);
+        const char *status_bg = luaMemoColor(memo->options.bg, memo->options.bg_hex, E.theme.ui_status_bg);
         
         // Clear background
         applyTrueColor(ab, status_fg, status_bg);
         abAppend(ab, "\x1b[K", 3);
         
-        // Process segments
-        lua_Integer segment_count = lua_rawlen(L, -2);
-        int left_width = 0;
+        // Widths of the right-aligned segments
         int right_width = 0;
-        
-        // First pass: calculate widths for left and right segments
-        for (int i = 1; i <= segment_count; i++) {
-            lua_rawgeti(L, -2, i);
-            if (!lua_istable(L, -1)) {
-                lua_pop(L, 1);
-                continue;
-            }
-            
-            // Get alignment
-            int alignment = 0; // Default left
-            lua_getfield(L, -1, "align");
-            if (lua_isstring(L, -1)) {
-                if (strcmp(lua_tostring(L, -1), "right") == 0) alignment = 2;
-            }
-            lua_pop(L, 1);
-            
-            // Get text and calculate width
-            lua_getfield(L, -1, "text");
-            if (lua_isstring(L, -1)) {
-                const char *text = lua_tostring(L, -1);
-                int width = calculate_visible_length_ansi(text);
-                
-                if (alignment == 0) {
-                    left_width += width;
-                } else if (alignment == 2) {
-                    right_width += width;
-                }
-            }
-            lua_pop(L, 1);
-            
-            lua_pop(L, 1); // Pop segment table
+        for (int i = 0; i < memo->segment_count; i++) {
+            if (memo->segments[i].align == 2) right_width += memo->segments[i].width;
         }
         
-        // Second pass: render segments
-        int current_x = component->x;
-        
         // Render left segments
-        for (int i = 1; i <= segment_count; i++) {
-            lua_rawgeti(L, -2, i);
-            if (!lua_istable(L, -1)) {
-                lua_pop(L, 1);
-                continue;
-            }
-            
-            // Get alignment
-            int alignment = 0; // Default left
-            lua_getfield(L, -1, "align");
-            if (lua_isstring(L, -1)) {
-                if (strcmp(lua_tostring(L, -1), "right") == 0) alignment = 2;
-            }
-            lua_pop(L, 1);
-            
-            // Skip right-aligned segments for now
-            if (alignment != 0) {
-                lua_pop(L, 1);
-                continue;
-            }
-            
-            // Get text
-            lua_getfield(L, -1, "text");
-            if (!lua_isstring(L, -1)) {
-                lua_pop(L, 2); // Pop text and segment table
-                continue;
-            }
-            const char *text = lua_tostring(L, -1);
-            int text_len = strlen(text);
-            lua_pop(L, 1);
-            
-            // Get colors
-            char *fg = status_fg;
-            char *bg = status_bg;
-            
-            lua_getfield(L, -1, "fg");
-            if (lua_isstring(L, -1)) {
-                const char *n = lua_tostring(L, -1);
-                char* t = getThemeColorByName(n);
-                if(t) fg = t; else if(n[0] == '#') fg = (char*)n;
-            }
-            lua_pop(L, 1);
-            
-            lua_getfield(L, -1, "bg");
-            if (lua_isstring(L, -1)) {
-                const char *n = lua_tostring(L, -1);
-                char* t = getThemeColorByName(n);
-                if(t) bg = t; else if(n[0] == '#') bg = (char*)n;
-            }
-            lua_pop(L, 1);
-            
-            // Position cursor and draw segment
-            char pos_buf[32];
-            snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, current_x);
-            abAppend(ab, pos_buf, strlen(pos_buf));
-            
-            // Apply colors and draw text
-            applyTrueColor(ab, fg, bg);
-            abAppend(ab, text, text_len);
-            
-            // Update current position
-            current_x += calculate_visible_length_ansi(text);
-            
-            lua_pop(L, 1); // Pop segment table
-        }
+        int current_x = drawStatusSegments(ab, memo, 0, component->x, component->y, status_fg, status_bg);
         
         // Calculate position for right-aligned segments
         if (right_width > 0) {
@@ -595,90 +439,14 @@ void drawStatusbarComponent(struct abuf *ab, ComponentLayout *component) {
             
             // Fill gap between left and right segments
             if (right_start > current_x) {
-                char pos_buf[32];
-                snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, current_x);
-                abAppend(ab, pos_buf, strlen(pos_buf));
-                applyTrueColor(ab, status_fg, status_bg);
-                
-                for (int i = 0; i < right_start - current_x; i++) {
-                    abAppend(ab, " ", 1);
-                }
+                fillRect(ab, current_x, component->y, right_start - current_x, 1, status_fg, status_bg);
             }
             
-            // Render right segments
-            current_x = right_start;
-            for (int i = 1; i <= segment_count; i++) {
-                lua_rawgeti(L, -2, i);
-                if (!lua_istable(L, -1)) {
-                    lua_pop(L, 1);
-                    continue;
-                }
-                
-                // Get alignment
-                int alignment = 0; // Default left
-                lua_getfield(L, -1, "align");
-                if (lua_isstring(L, -1)) {
-                    if (strcmp(lua_tostring(L, -1), "right") == 0) alignment = 2;
-                }
-                lua_pop(L, 1);
-                
-                // Skip left-aligned segments
-                if (alignment != 2) {
-                    lua_pop(L, 1);
-                    continue;
-                }
-                
-                // Get text
-                lua_getfield(L, -1, "text");
-                if (!lua_isstring(L, -1)) {
-                    lua_pop(L, 2); // Pop text and segment table
-                    continue;
-                }
-                const char *text = lua_tostring(L, -1);
-                int text_len = strlen(text);
-                lua_pop(L, 1);
-                
-                // Get colors
-                char *fg = status_fg;
-                char *bg = status_bg;
-                
-                lua_getfield(L, -1, "fg");
-                if (lua_isstring(L, -1)) {
-                    const char *n = lua_tostring(L, -1);
-                    char* t = getThemeColorByName(n);
-                    if(t) fg = t; else if(n[0] == '#') fg = (char*)n;
-                }
-                lua_pop(L, 1);
-                
-                lua_getfield(L, -1, "bg");
-                if (lua_isstring(L, -1)) {
-                    const char *n = lua_tostring(L, -1);
-                    char* t = getThemeColorByName(n);
-                    if(t) bg = t; else if(n[0] == '#') bg = (char*)n;
-                }
-                lua_pop(L, 1);
-                
-                // Position cursor and draw segment
-                char pos_buf[32];
-                snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, current_x);
-                abAppend(ab, pos_buf, strlen(pos_buf));
-                
-                // Apply colors and draw text
-                applyTrueColor(ab, fg, bg);
-                abAppend(ab, text, text_len);
-                
-                // Update current position
-                current_x += calculate_visible_length_ansi(text);
-                
-                lua_pop(L, 1); // Pop segment table
-            }
+            drawStatusSegments(ab, memo, 2, right_start, component->y, status_fg, status_bg);
         }
         
         // Reset colors
         applyThemeDefaultColor(ab);
-        
-        // Clean up Lua stack
-        lua_pop(L, 2); // Pop segments and options tables
     } else {
         // No Lua callback, use default implementation
         editorDrawDefaultStatusBar(ab);
@@ -687,8 +455,16 @@ void drawStatusbarComponent(struct abuf *ab, ComponentLayout *component) {
 
 // TODO: Implement
 // Draw tabline component
-void drawTablineComponent(struct abuf *ab, ComponentLayout *component) {
-    if (component->lua_callback_ref != LUA_NOREF) {
+void drawTablineComponent(struct abuf *ab, SceneNode *component) {
+    // Position cursor at component start (the output may be replayed on its own)
+    char pos_buf[32];
+    snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, component->x);
+    abAppend(ab, pos_buf, strlen(pos_buf));
+    
+    if (tabline_template.op_count > 0) {
+        bool dynamic = tabline_template.uses_lua && evaluateComponent(component);
+        drawStatusTemplate(ab, &tabline_template, component->width, dynamic ? component->memo : NULL);
+    } else if (component->lua_callback_ref != LUA_NOREF) {
         // Similar to statusbar, call Lua and process segments
         // ...
         // This would be similar to the statusbar implementation but for tabline
@@ -700,7 +476,7 @@ void drawTablineComponent(struct abuf *ab, ComponentLayout *component) {
 }
 
 // Draw messagebar component
-void drawMessagebarComponent(struct abuf *ab, ComponentLayout *component) {
+void drawMessagebarComponent(struct abuf *ab, SceneNode *component) {
     // Position cursor at component start
     char pos_buf[32];
     snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", component->y, component->x);
@@ -711,7 +487,7 @@ void drawMessagebarComponent(struct abuf *ab, ComponentLayout *component) {
 }
 
 // Draw panel component (e.g., directory tree)
-void drawPanelComponent(struct abuf *ab, ComponentLayout *component) {
+void drawPanelComponent(struct abuf *ab, SceneNode *component) {
     if (component->lua_callback_ref != LUA_NOREF) {
         // Call Lua to get panel content
         editorDrawDirTreeFixed(ab, component->x, component->y, component->width, component->height);
@@ -722,31 +498,12 @@ void drawPanelComponent(struct abuf *ab, ComponentLayout *component) {
 }
 
 // Draw custom component using Lua callback
-void drawCustomComponent(struct abuf *ab, ComponentLayout *component) {
-    if (component->lua_callback_ref == LUA_NOREF) return;
-    
-    // Call Lua callback to get content
-    lua_State *L = getLuaState();
-    if (!L) return;
+void drawCustomComponent(struct abuf *ab, SceneNode *component) {
+    (void)ab;
     
-    lua_rawgeti(L, LUA_REGISTRYINDEX, component->lua_callback_ref);
-    if (lua_pcall(L, 0, 2, 0) != LUA_OK) {
-        const char *error_msg = lua_tostring(L, -1);
-        debug_printf("Error calling custom component Lua func: %s", error_msg);
-        lua_pop(L, 1);
-        return;
-    }
-    
-    // Check for segments table
-    if (!lua_istable(L, -2)) {
-        debug_printf("Custom component Lua function didn't return segments table");
-        lua_pop(L, lua_gettop(L));
-        return;
-    }
+    // Evaluated at most once per frame (see evaluateComponent)
+    if (!evaluateComponent(component)) return;
     
     // Process segments similarly to statusbar
     // ...
-    
-    // Clean up Lua stack
-    lua_pop(L, 2); // Pop segments and options tables
 }
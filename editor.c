@@ -1,4 +1,5 @@
 #include "kilo.h"
+#include "render.h"
 
 
 void editorInsertChar(int c) {
@@ -24,7 +25,7 @@ void editorInsertNewline() {
     row = &E.row[E.cy];
     row->size = E.cx;
     row->chars[row->size] = '\0';
-    editorUpdateRow(row);
+    editorUpdateRow(E.current_buffer, row);
   }
   E.cy++;
   E.cx = 0;
@@ -40,9 +41,12 @@ void editorDelChar() {
   erow *row = &E.row[E.cy]; // Get current row pointer *once*
 
   if (E.cx > 0) {
-    // Delete character within the current line
-    editorRowDelChar(row, E.cx - 1);
-    E.cx--;
+    // Delete the whole (possibly multi-byte) character before the cursor
+    int start = editorRowPrevCx(row, E.cx);
+    while (E.cx > start) {
+      editorRowDelChar(row, start);
+      E.cx--;
+    }
   } else {
     // Delete newline: Join current line (row) with previous line (E.row[E.cy - 1])
     // Target cursor position is end of previous line
@@ -113,7 +117,7 @@ void editorMoveCursor(int key) {
         case H_KEY:
         case ARROW_LEFT:
             if (E.cx != 0) {
-                E.cx--; // Move left within the line
+                E.cx = row ? editorRowPrevCx(row, E.cx) : E.cx - 1; // Move left within the line
             } else if (E.cy > 0) {
                 // Move to the end of the previous line if at start of current line
                 E.cy--;
@@ -123,7 +127,7 @@ void editorMoveCursor(int key) {
         case L_KEY:
         case ARROW_RIGHT:
             if (row && E.cx < row->size) {
-                E.cx++; // Move right within the line
+                E.cx = editorRowNextCx(row, E.cx); // Move right within the line
             } else if (row && E.cx == row->size) {
                  // Move to the start of the next line if at end of current line
                 E.cy++;
@@ -156,9 +160,8 @@ void editorMoveCursor(int key) {
     // After moving, snap E.cx to the end of the line if it's past it
     row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
     if (row) {
-        if (E.cx > row->size) {
-            E.cx = row->size;
-        }
+        // Also keeps cx off UTF-8 continuation bytes after moving up/down
+        E.cx = editorRowSnapCx(row, E.cx);
     } else {
         E.cx = 0;
     }
@@ -173,6 +176,7 @@ void editorProcessKeypress() {
     static int quit_times = KILO_QUIT_TIMES;
 
     int c = editorReadKey();
+    sceneTouch(SCENE_DEP_TEXT); // Any key may edit, move or scroll
     
 if (c == CTRL_KEY('d')) {
     if (debug_overlay_active) {
@@ -211,6 +215,7 @@ if (c == CTRL_KEY('d')) {
       } else {
         E.navigator_active = false;
       }
+      sceneTouch(SCENE_DEP_TREE);
       return;
 
     case CTRL_KEY('q'):
@@ -220,6 +225,7 @@ if (c == CTRL_KEY('d')) {
         quit_times--;
         return; // Return early to avoid resetting quit_times
       }
+      renderShutdown(); // Let the render thread finish before clearing the screen
       write(STDOUT_FILENO, "\x1b[2J", 4);
       write(STDOUT_FILENO, "\x1b[H", 3);
       exit(0);
@@ -1,6 +1,7 @@
 #include "kilo.h"
 #include <fcntl.h>
 #include "dirtree.h"
+#include "hllayer.h"
 
 char *editorRowsToString(editorBuffer *buf, int *buflen) {
   int totlen = 0;
@@ -138,6 +139,7 @@ void editorInsertRowToBuffer(editorBuffer *buf, int at, char *s, size_t len) {
     // Move existing rows if inserting in the middle
     if (at < buf->numrows) {
        memmove(&buf->row[at + 1], &buf->row[at], sizeof(erow) * (buf->numrows - at));
+       for (int j = at + 1; j <= buf->numrows; j++) buf->row[j].idx++;
     }
 
     // Initialize the new row
@@ -152,20 +154,30 @@ void editorInsertRowToBuffer(editorBuffer *buf, int at, char *s, size_t len) {
     buf->row[at].rsize = 0;
     buf->row[at].render = NULL;
     buf->row[at].hl = NULL;
+    buf->row[at].hl_spans = NULL;
+    buf->row[at].hl_span_count = 0;
+    buf->row[at].cell_width = NULL;
+    buf->row[at].ascii = true;
     buf->row[at].hl_open_comment = 0;
+    buf->row[at].hl_stale = false;
+    buf->row[at].version = 0;
+    memset(&buf->row[at].render_cache, 0, sizeof(erowRenderCache));
 
     buf->numrows++;
     buf->dirty++;
 
-    // Update row rendering
-    editorUpdateRow(&buf->row[at]);
-    
-    // Update global dirty flag if this is the current buffer
+    // Update global dirty flag if this is the current buffer (the row array
+    // may have moved)
     if (buf == E.current_buffer) {
         E.dirty = buf->dirty;
         E.row = buf->row;  // Only update global row pointer if this is the current buffer
         E.numrows = buf->numrows;
     }
+    editorInvalidateSyntaxCheckpoints(buf, at - 1); // Rows below move down
+    highlightLayerShiftRows(buf, at, 1);
+
+    // Update row rendering
+    editorUpdateRow(buf, &buf->row[at]);
 }
 
 
@@ -215,10 +227,8 @@ editorBuffer *editorOpen(char *filename, DirTreeNode *node) {
     }
 
 
-    // Select syntax highlighting
+    // Syntax highlighting is selected once the rows are read
     buf->syntax = NULL; // Clear it first
-    // We'll need to modify editorSelectSyntaxHighlight to work with a buffer
-    // For now, we'll set syntax after switching to this buffer
     
     // Read the file
     // TODO: Use fdopen() instead; replace filename with filedescriptor from DirTreeNode->fd?
@@ -248,6 +258,10 @@ editorBuffer *editorOpen(char *filename, DirTreeNode *node) {
     free(line);
     fclose(fp);
     buf->dirty = 0;
+
+    // Select syntax highlighting now rather than on first switch, so the
+    // buffer can be highlighted in idle time while it's in the background
+    editorSelectSyntaxHighlight(buf);
     return buf;
 }
 
@@ -309,7 +323,7 @@ void editorSave() {
         // E.filename = E.current_buffer->filename;
 
         // 9. Update syntax highlighting etc. for the new name
-        editorSelectSyntaxHighlight();
+        editorSelectSyntaxHighlight(E.current_buffer);
     }
     
     // Get buffer content
@@ -1,4 +1,5 @@
 #include "kilo.h"
+#include "render.h"
 
 #include <string.h>
 #include <ctype.h>
@@ -6,6 +7,15 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <limits.h> // For PATH_MAX (might need sys/param.h on some systems)
+#include <pthread.h>
+
+#define HL_IDLE_SLICE_MS 4     // Longest stretch of idle highlighting between input checks
+#define HL_IDLE_CHUNK_ROWS 64  // Rows looked at between clock checks
+#define HL_IDLE_REDRAW_MS 100  // How often the debug overlay's pending count is redrawn
+#define HL_MAX_THREADS 8                // Upper bound on parallel highlighting workers
+#define HL_PARALLEL_CHUNK_ROWS 4096     // Rows per worker in one idle slice
+#define HL_PARALLEL_MIN_ROWS 16384      // Smaller backlogs are done on this thread
+#define HL_CHECKPOINT_INTERVAL 256      // Rows between lexer-state checkpoints (power of two)
 
 // Removes leading/trailing whitespace from a string in-place
 char *trimWhitespace(char *str) {
@@ -117,6 +127,134 @@ static void freeStringArray(char **arr) {
 }
 
 
+// --- Keyword Table ---
+
+static unsigned int hashKeyword(const char *s, int len) {
+    unsigned int h = 2166136261u; // FNV-1a
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void freeKeywordTable(syntaxKeywordTable *t) {
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+// Adds one list to the table. A word already present keeps its earlier,
+// higher-priority class, as the old list-by-list search did.
+static void addKeywords(syntaxKeywordTable *t, char **list, unsigned char hl, int *rank) {
+    if (!list) return;
+    for (int j = 0; list[j]; j++, (*rank)++) {
+        int len = strlen(list[j]);
+        if (len == 0 || len > 255) continue;
+
+        unsigned int slot = hashKeyword(list[j], len) & t->mask;
+        while (t->slots[slot].word &&
+               !(t->slots[slot].len == len && memcmp(t->slots[slot].word, list[j], len) == 0)) {
+            slot = (slot + 1) & t->mask;
+        }
+        if (t->slots[slot].word) continue; // Duplicate
+
+        t->slots[slot] = (syntaxKeyword){list[j], len, *rank, hl};
+        t->lengths[len >> 6] |= 1ULL << (len & 63);
+        if (t->min_len == 0 || len < t->min_len) t->min_len = len;
+        if (len > t->max_len) t->max_len = len;
+    }
+}
+
+// Builds the keyword table from the syntax's keyword lists
+static int buildKeywordTable(struct editorSyntax *s) {
+    syntaxKeywordTable *t = &s->keyword_table;
+    freeKeywordTable(t);
+
+    char **lists[] = {s->keywords1, s->keywords2, s->keywords3, s->types, s->builtins};
+    int count = 0;
+    for (int l = 0; l < 5; l++) {
+        for (int j = 0; lists[l] && lists[l][j]; j++) count++;
+    }
+
+    // Keep the load factor at or below one half
+    unsigned int size = 16;
+    while (size < (unsigned int)count * 2) size <<= 1;
+    t->slots = calloc(size, sizeof(syntaxKeyword));
+    if (!t->slots) return -1;
+    t->mask = size - 1;
+
+    int rank = 0;
+    addKeywords(t, s->keywords1, HL_KEYWORD1, &rank);
+    addKeywords(t, s->keywords2, HL_KEYWORD2, &rank);
+    addKeywords(t, s->keywords3, HL_KEYWORD3, &rank);
+    addKeywords(t, s->types, HL_TYPE, &rank);
+    addKeywords(t, s->builtins, HL_BUILTIN, &rank);
+    return 0;
+}
+
+static const syntaxKeyword *lookupKeyword(const syntaxKeywordTable *t, const char *s, int len) {
+    unsigned int slot = hashKeyword(s, len) & t->mask;
+    while (t->slots[slot].word) {
+        if (t->slots[slot].len == len && memcmp(t->slots[slot].word, s, len) == 0) {
+            return &t->slots[slot];
+        }
+        slot = (slot + 1) & t->mask;
+    }
+    return NULL;
+}
+
+// Whether a quote or comment start could begin at `tail`, the part of a
+// keyword after its first byte (a marker may run on past the keyword)
+static bool keywordHidesMarker(const struct editorSyntax *s, const char *tail, int len) {
+    if (s->byte_class[(unsigned char)tail[0]] & SYN_QUOTE) return true;
+    const char *markers[] = {s->singleline_comment_start, s->multiline_comment_start};
+    int lens[] = {s->scs_len, s->mcs_len};
+    for (int m = 0; m < 2; m++) {
+        int n = lens[m] < len ? lens[m] : len;
+        if (n > 0 && memcmp(tail, markers[m], n) == 0) return true;
+    }
+    return false;
+}
+
+// Compiles the syntax's comment markers, string and number rules and
+// keyword first bytes into byte classes. Must run after buildKeywordTable.
+static void buildByteClasses(struct editorSyntax *s) {
+    unsigned char *cls = s->byte_class;
+    for (int c = 0; c < 256; c++) {
+        // Same cast as the highlighter's char reads, so locale classes match
+        cls[c] = is_separator((char)c) ? SYN_SEPARATOR : 0;
+        if ((s->flags & HL_HIGHLIGHT_NUMBERS) && isdigit(c)) cls[c] |= SYN_DIGIT;
+    }
+    if (s->flags & HL_HIGHLIGHT_STRINGS) {
+        cls['"'] |= SYN_QUOTE;
+        cls['\''] |= SYN_QUOTE;
+    }
+
+    s->scs_len = s->singleline_comment_start ? strlen(s->singleline_comment_start) : 0;
+    s->mcs_len = s->multiline_comment_start ? strlen(s->multiline_comment_start) : 0;
+    s->mce_len = s->multiline_comment_end ? strlen(s->multiline_comment_end) : 0;
+    if (s->scs_len) cls[(unsigned char)s->singleline_comment_start[0]] |= SYN_SCS;
+    if (s->mcs_len) cls[(unsigned char)s->multiline_comment_start[0]] |= SYN_MCS;
+    if (s->mce_len) cls[(unsigned char)s->multiline_comment_end[0]] |= SYN_MCE;
+
+    const syntaxKeywordTable *t = &s->keyword_table;
+    for (unsigned int j = 0; t->slots && j <= t->mask; j++) {
+        if (t->slots[j].word) cls[(unsigned char)t->slots[j].word[0]] |= SYN_KEYWORD;
+    }
+
+    // A keyword is matched as a whole, so a quote or comment start inside
+    // one is not seen by the highlighter. scanRowState can only skip
+    // keywords if no keyword has one.
+    s->state_scan_exact = true;
+    for (unsigned int j = 0; t->slots && j <= t->mask; j++) {
+        for (int b = 1; t->slots[j].word && b < t->slots[j].len; b++) {
+            if (keywordHidesMarker(s, t->slots[j].word + b, t->slots[j].len - b)) {
+                s->state_scan_exact = false;
+            }
+        }
+    }
+}
+
 // --- Core Parsing and Loading ---
 
 // Parses a single .syntax file
@@ -209,6 +347,8 @@ static int parseSyntaxFile(const char *filepath, struct editorSyntax *s) {
         }
     } // End while getline
 
+    if (buildKeywordTable(s) != 0) goto parse_error;
+    buildByteClasses(s);
     goto parse_cleanup; // Jump to cleanup
 
 parse_error:
@@ -226,6 +366,7 @@ parse_error:
     free(s->multiline_comment_start); s->multiline_comment_start = NULL;
     free(s->multiline_comment_end); s->multiline_comment_end = NULL;
     free(s->status_icon); s->status_icon = NULL;
+    freeKeywordTable(&s->keyword_table);
     // s->flags is an int, no freeing needed
 
 parse_cleanup:
@@ -236,6 +377,9 @@ parse_cleanup:
 
 // Loads all .syntax files from the syntax/ directory
 void loadSyntaxFiles(void) {
+    // Buffers highlighted with earlier definitions (whose syntax pointers
+    // may be moved by the realloc below) are redone when next shown
+    E.syntax_generation++;
     const char *dirpath = "syntax"; // Consider making this configurable
     DIR *dir = opendir(dirpath);
     if (!dir) {
@@ -316,6 +460,7 @@ void freeSyntaxDefs(void) {
         free(s->multiline_comment_start);
         free(s->multiline_comment_end);
         free(s->status_icon);
+        freeKeywordTable(&s->keyword_table);
         // Note: flags is just an int, no free needed
     }
     free(E.syntax_defs);
@@ -330,194 +475,618 @@ int is_separator(int c) {
 }
 
 
-// Checks if word at row->render[i] matches any word in list.
+// Checks if a keyword starts at row->render[i] and is followed by a
+// separator or the end of the line. Every length some keyword has is
+// tried; if several match, the earliest in the syntax file wins.
 // Returns 1 if match found (and updates hl, i), 0 otherwise.
-static int match_and_highlight(erow *row, int *i, char **list, enum editorHighlight hl_type) {
-    if (!list) return 0; // List not loaded or defined for this syntax
+// The caller has checked that render[i] is SYN_KEYWORD.
+static int match_and_highlight(const erow *row, unsigned char *hl, int *i, const struct editorSyntax *syntax) {
+    const syntaxKeywordTable *t = &syntax->keyword_table;
+    const unsigned char *cls = syntax->byte_class;
+    const char *render = row->render;
+    int current_i = *i;
+
+    const syntaxKeyword *best = NULL;
+    int max_len = row->rsize - current_i;
+    if (max_len > t->max_len) max_len = t->max_len;
+    for (int len = t->min_len; len <= max_len; len++) {
+        if (!(t->lengths[len >> 6] & (1ULL << (len & 63)))) continue;
+        int end_char_pos = current_i + len;
+        if (end_char_pos < row->rsize && !(cls[(unsigned char)render[end_char_pos]] & SYN_SEPARATOR)) continue;
+
+        const syntaxKeyword *kw = lookupKeyword(t, &render[current_i], len);
+        if (kw && (!best || kw->rank < best->rank)) best = kw;
+    }
+    if (!best) return 0;
+
+    memset(&hl[current_i], best->hl, best->len); // Apply highlight
+    *i += best->len; // Advance main loop counter
+    return 1;
+}
+
+
+static void markRowStale(editorBuffer *buf, int at) {
+    if (buf->row[at].hl_stale) return;
+    buf->row[at].hl_stale = true;
+    buf->hl_stale_rows++;
+    if (at < buf->hl_stale_from) buf->hl_stale_from = at;
+}
 
-    char *render = row->render;
+// --- Checkpoints ---
+
+static void setCheckpoint(editorBuffer *buf, int row, int in_comment) {
+    int block = row / HL_CHECKPOINT_INTERVAL;
+    if (block >= buf->hl_checkpoint_capacity) {
+        int capacity = buf->hl_checkpoint_capacity ? buf->hl_checkpoint_capacity : 64;
+        while (capacity <= block) capacity *= 2;
+        signed char *grown = realloc(buf->hl_checkpoints, capacity);
+        if (!grown) return; // Checkpoints are only a shortcut
+        memset(grown + buf->hl_checkpoint_capacity, -1, capacity - buf->hl_checkpoint_capacity);
+        buf->hl_checkpoints = grown;
+        buf->hl_checkpoint_capacity = capacity;
+    }
+    buf->hl_checkpoints[block] = in_comment;
+}
+
+// Forgets the checkpoints of rows below `after_row`, whose incoming state
+// may have changed (a row's open-comment state changed, or rows moved)
+void editorInvalidateSyntaxCheckpoints(editorBuffer *buf, int after_row) {
+    int block = (after_row < 0 ? 0 : after_row / HL_CHECKPOINT_INTERVAL + 1);
+    if (block < buf->hl_checkpoint_capacity) memset(buf->hl_checkpoints + block, -1, buf->hl_checkpoint_capacity - block);
+}
+
+// Works out a row's open-comment state at its end without highlighting it:
+// only comment markers, quotes and escapes are looked at. Gives the same
+// state as highlightRowWith when the syntax is state_scan_exact.
+static int scanRowState(const erow *row, const struct editorSyntax *syntax, int in_comment) {
+    const unsigned char *cls = syntax->byte_class;
+    const char *render = row->render;
     int rsize = row->rsize;
-    int current_i = *i;
+    int ml_comments = syntax->mcs_len && syntax->mce_len;
+    int in_string = 0;
 
-    for (int j = 0; list[j]; j++) {
-        int klen = strlen(list[j]);
-        int end_char_pos = current_i + klen;
-
-        // Check if the keyword fits and is followed by a separator
-        // Also handle case where keyword is at the very end of the line
-        if (end_char_pos <= rsize &&
-            !strncmp(&render[current_i], list[j], klen) &&
-            (end_char_pos == rsize || is_separator(render[end_char_pos])) ) // Separator check is key
-        {
-            memset(&row->hl[current_i], hl_type, klen); // Apply highlight
-            *i += klen; // Advance main loop counter
-            return 1; // Match found
+    int i = 0;
+    while (i < rsize) {
+        char c = render[i];
+        unsigned char k = cls[(unsigned char)c];
+        if (in_comment && ml_comments && !in_string) {
+            if ((k & SYN_MCE) && i + syntax->mce_len <= rsize &&
+                !memcmp(&render[i], syntax->multiline_comment_end, syntax->mce_len)) {
+                i += syntax->mce_len;
+                in_comment = 0;
+            } else {
+                i++;
+            }
+            continue;
         }
+        if (in_string) {
+            if (c == '\\' && i + 1 < rsize) {
+                i += 2;
+                continue;
+            }
+            if (c == in_string) in_string = 0;
+            i++;
+            continue;
+        }
+        if ((k & SYN_SCS) && !in_comment && i + syntax->scs_len <= rsize &&
+            !memcmp(&render[i], syntax->singleline_comment_start, syntax->scs_len)) {
+            break;
+        }
+        if ((k & SYN_MCS) && ml_comments && i + syntax->mcs_len <= rsize &&
+            !memcmp(&render[i], syntax->multiline_comment_start, syntax->mcs_len)) {
+            i += syntax->mcs_len;
+            in_comment = 1;
+            continue;
+        }
+        if (k & SYN_QUOTE) in_string = c;
+        i++;
+    }
+    return in_comment;
+}
+
+// Open-comment state at the start of checkpoint `block`'s first row, or -1
+// if the syntax can't be scanned. A missing checkpoint is filled in by
+// scanning forward from the nearest known state: an earlier checkpoint,
+// or the first stale row (every row above that one is current).
+static int checkpointState(editorBuffer *buf, int block) {
+    if (!buf->syntax->state_scan_exact) return -1;
+    int target = block * HL_CHECKPOINT_INTERVAL;
+    if (block < buf->hl_checkpoint_capacity && buf->hl_checkpoints[block] >= 0) return buf->hl_checkpoints[block];
+
+    int b = block < buf->hl_checkpoint_capacity ? block : buf->hl_checkpoint_capacity - 1;
+    while (b > 0 && buf->hl_checkpoints[b] < 0) b--;
+    int at = b > 0 ? b * HL_CHECKPOINT_INTERVAL : 0;
+    int in_comment = b > 0 ? buf->hl_checkpoints[b] : 0;
+    if (buf->hl_stale_from > at && buf->hl_stale_from <= target) {
+        at = buf->hl_stale_from;
+        in_comment = at > 0 ? buf->row[at - 1].hl_open_comment : 0;
+    }
+
+    for (; at < target; at++) {
+        in_comment = scanRowState(&buf->row[at], buf->syntax, in_comment);
+        if (((at + 1) & (HL_CHECKPOINT_INTERVAL - 1)) == 0) setCheckpoint(buf, at + 1, in_comment);
+    }
+    return in_comment;
+}
+
+// Marks the rows from `from` on as stale and the rows above it as current
+static void setStaleFrom(editorBuffer *buf, int from) {
+    if (from < 0) from = 0;
+    if (from > buf->numrows) from = buf->numrows;
+    for (int j = 0; j < buf->numrows; j++) buf->row[j].hl_stale = (j >= from);
+    buf->hl_stale_rows = buf->numrows - from;
+    buf->hl_stale_from = from;
+    editorInvalidateSyntaxCheckpoints(buf, -1);
+}
+
+// Last row of `buf` on screen: the current buffer scrolls with E, the
+// others keep the offset they had when they were switched away from
+static int lastVisibleRow(const editorBuffer *buf) {
+    int rowoff = (buf == E.current_buffer) ? E.rowoff : buf->rowoff;
+    return rowoff + E.screenrows - 1;
+}
+
+// --- Highlight Storage ---
+
+// A row is highlighted into a byte per render byte, then stored as runs
+// (see storeRowHighlight). Each thread highlighting rows has its own.
+typedef struct HighlightScratch {
+    unsigned char *bytes;
+    int capacity;
+} HighlightScratch;
+
+static HighlightScratch main_scratch; // For the editor thread
+
+static unsigned char *scratchBytes(HighlightScratch *scratch, int size) {
+    if (size >= scratch->capacity) { // Room for one more, so an empty row gets a buffer too
+        unsigned char *grown = realloc(scratch->bytes, size + 1);
+        if (!grown) die("scratchBytes: realloc failed");
+        scratch->bytes = grown;
+        scratch->capacity = size + 1;
     }
-    return 0; // No match in this list
+    return scratch->bytes;
 }
 
+// Stores a row's highlighting, one HL_* byte per render byte, on the row.
+// Rows with few colour changes keep a span per run; rows where spans would
+// take more room than the bytes keep the bytes. All-normal rows keep neither.
+static void storeRowHighlight(erow *row, const unsigned char *hl) {
+    int count = 0;
+    bool plain = true;
+    for (int i = 0; i < row->rsize; ) {
+        int start = i;
+        while (i < row->rsize && hl[i] == hl[start] && i - start < USHRT_MAX) i++;
+        if (hl[start] != HL_NORMAL) plain = false;
+        count++;
+    }
+
+    if (plain || (size_t)count * sizeof(erowHlSpan) >= (size_t)row->rsize) {
+        free(row->hl_spans);
+        row->hl_spans = NULL;
+        row->hl_span_count = 0;
+        if (plain) {
+            free(row->hl);
+            row->hl = NULL;
+            return;
+        }
+        row->hl = realloc(row->hl, row->rsize);
+        if (!row->hl) die("storeRowHighlight: realloc hl failed");
+        memcpy(row->hl, hl, row->rsize);
+        return;
+    }
+
+    free(row->hl);
+    row->hl = NULL;
+    erowHlSpan *spans = realloc(row->hl_spans, count * sizeof(erowHlSpan));
+    if (!spans) die("storeRowHighlight: realloc spans failed");
+    int n = 0;
+    for (int i = 0; i < row->rsize; ) {
+        int start = i;
+        while (i < row->rsize && hl[i] == hl[start] && i - start < USHRT_MAX) i++;
+        spans[n++] = (erowHlSpan){(unsigned short)(i - start), hl[start]};
+    }
+    row->hl_spans = spans;
+    row->hl_span_count = count;
+}
 
-void editorUpdateSyntax(erow *row) {
-    row->hl = realloc(row->hl, row->rsize);
-    if (!row->hl && row->rsize > 0) die("editorUpdateSyntax: realloc hl failed"); // Check realloc! Handle 0 size case.
-    if (row->hl) { // Add a check before memset if realloc can return NULL for size 0
-        memset(row->hl, HL_NORMAL, row->rsize);
+// Finds the run of equal highlighting that render byte `at` of `row` is
+// in. `run` is zeroed before the first call for a row and passed back in
+// after, so walking a row left to right visits each span once.
+void editorHighlightRunAt(const erow *row, int at, erowHlRun *run) {
+    if (at >= run->start && at < run->end) return;
+
+    if (row->hl) {
+        run->start = at;
+        run->end = at + 1;
+        run->hl = row->hl[at];
+        while (run->end < row->rsize && row->hl[run->end] == run->hl) run->end++;
+        return;
+    }
+    if (!row->hl_spans) {
+        *run = (erowHlRun){0, 0, row->rsize, HL_NORMAL};
+        return;
     }
 
-    if (E.syntax == NULL) return; // No syntax definition selected for this file
+    int span = 0, start = 0;
+    if (run->end > 0 && at >= run->end) { // Carry on from the last run
+        span = run->span + 1;
+        start = run->end;
+    }
+    while (span < row->hl_span_count - 1 && at >= start + row->hl_spans[span].len) {
+        start += row->hl_spans[span].len;
+        span++;
+    }
+    *run = (erowHlRun){span, start, start + row->hl_spans[span].len, row->hl_spans[span].hl};
+}
 
-    // Get pointers to the lists from the current syntax definition
-    // These might be NULL if not defined in the .syntax file
-    char **keywords1 = E.syntax->keywords1;
-    char **keywords2 = E.syntax->keywords2;
-    char **keywords3 = E.syntax->keywords3;
-    char **types = E.syntax->types;
-    char **builtins = E.syntax->builtins;
+// Highlights one row with `syntax`, given whether a multi-line comment is
+// open where it starts. Touches nothing but the row and `scratch`, so
+// workers can run it. Returns 1 if the row's own open-comment state
+// changed, 0 otherwise.
+static int highlightRowWith(erow *row, const struct editorSyntax *syntax, int in_comment, HighlightScratch *scratch) {
+    row->version++; // hl is rewritten below; cached encodings are stale
+    unsigned char *hl = scratchBytes(scratch, row->rsize);
+    memset(hl, HL_NORMAL, row->rsize);
+
+    if (syntax == NULL) { // No syntax definition selected for this file
+        storeRowHighlight(row, hl);
+        return 0;
+    }
 
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
+    // Every rule is gated on the byte's class, so most bytes cost one
+    // table lookup; markers are only compared where their first byte is.
+    const unsigned char *cls = syntax->byte_class;
+    const char *render = row->render;
+    int rsize = row->rsize;
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+    const char *scs = syntax->singleline_comment_start;
+    const char *mcs = syntax->multiline_comment_start;
+    const char *mce = syntax->multiline_comment_end;
+    int scs_len = syntax->scs_len;
+    int mcs_len = syntax->mcs_len;
+    int mce_len = syntax->mce_len;
+    int ml_comments = mcs_len && mce_len;
 
     int prev_sep = 1;       // Is the previous character a separator? Start of line counts.
     int in_string = 0;      // Current string delimiter ('"' or '\''), or 0 if not in string.
-    // Multiline comment state persists from previous line
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
 
     int i = 0;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-        // Handle single line comments first (only if not in string or ML comment)
-        if (scs_len && !in_string && !in_comment) {
-            if (i + scs_len <= row->rsize && // Bounds check
-                !strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break; // Rest of the line is a comment
+    while (i < rsize) {
+        char c = render[i];
+        unsigned char k = cls[(unsigned char)c];
+
+        // Inside a multi-line comment only its end marker matters
+        if (in_comment && ml_comments && !in_string) {
+            hl[i] = HL_MLCOMMENT;
+            if ((k & SYN_MCE) && i + mce_len <= rsize && !memcmp(&render[i], mce, mce_len)) {
+                memset(&hl[i], HL_MLCOMMENT, mce_len); // Highlight the end marker too
+                i += mce_len;
+                in_comment = 0;
+                prev_sep = 1; // Treat as separator after comment ends
+            } else {
+                i++;
+                prev_sep = 0; // prev_sep stays 0 inside a comment
             }
+            continue;
         }
 
-        // Handle multi-line comments (only if not in string)
-        // Must be checked *before* keywords if comment start looks like a keyword (e.g., /*)
-        if (mcs_len && mce_len && !in_string) {
-            if (in_comment) {
-                row->hl[i] = HL_MLCOMMENT;
-                if (i + mce_len <= row->rsize && // Bounds check
-                    !strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len); // Highlight the end marker too
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1; // Treat as separator after comment ends
-                    continue;
-                } else {
-                    i++;
-                    // prev_sep should remain 0 while inside comment
-                    prev_sep = 0; // Explicitly set
-                    continue;
-                }
-            } else if (i + mcs_len <= row->rsize && // Bounds check
-                       !strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len); // Highlight start marker
-                i += mcs_len;
-                in_comment = 1;
-                prev_sep = 0; // Start of comment is not a separator for next char
+        // Inside a string only escapes and the closing quote matter
+        if (in_string) {
+            hl[i] = HL_STRING;
+            // Basic escape sequence handling (highlight \ and next char)
+            if (c == '\\' && i + 1 < rsize) {
+                hl[i + 1] = HL_STRING;
+                i += 2; // Skip escaped char
+                prev_sep = 0;
                 continue;
             }
+            if (c == in_string) {
+                in_string = 0; // End of string
+                prev_sep = 1; // Closing quote acts as a separator
+            } else {
+                prev_sep = 0; // Inside string is not a separator
+            }
+            i++;
+            continue;
         }
 
-        // Handle strings (if flag is set)
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            if (in_string) {
-                row->hl[i] = HL_STRING;
-                 // Basic escape sequence handling (highlight \ and next char)
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->hl[i + 1] = HL_STRING; // Or HL_STRING_ESCAPE if defined
-                    i += 2; // Skip escaped char
-                    prev_sep = 0; // Treat escape sequence as non-separator internally
-                    continue;
-                }
-                // Check for end of string *after* escape check
-                if (c == in_string) {
-                     in_string = 0; // End of string
-                     prev_sep = 1; // Closing quote acts as a separator
-                } else {
-                    prev_sep = 0; // Inside string is not a separator
-                }
-                i++;
-                continue; // Move to next character
-            } else if (c == '"' || c == '\'') { // Start of string
-                in_string = c;
-                row->hl[i] = HL_STRING;
-                i++;
-                prev_sep = 0; // Opening quote is not a separator for next char
-                continue;
-            }
+        // Single-line comment: rest of the line
+        if ((k & SYN_SCS) && !in_comment && i + scs_len <= rsize &&
+            !memcmp(&render[i], scs, scs_len)) {
+            memset(&hl[i], HL_COMMENT, rsize - i);
+            break;
         }
 
-        // Handle numbers (if flag is set and not in string or comment)
-        // Needs careful check to avoid highlighting things like `my.var` as numbers
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || // Starts with digit after sep/num
-                (c == '.' && prev_hl == HL_NUMBER)) // Includes '.' if part of a number
-            {
-                 // Avoid highlighting "..", "1..2", etc.
-                 if (c == '.' && i > 0 && row->render[i-1] == '.') {
-                      // Not a number continuation, let it fall through
-                 } else {
-                    row->hl[i] = HL_NUMBER;
-                    i++;
-                    prev_sep = 0; // Part of a number is not a separator
-                    continue;
-                 }
-            }
+        // Start of a multi-line comment (checked before keywords, e.g. /*)
+        if ((k & SYN_MCS) && ml_comments && i + mcs_len <= rsize &&
+            !memcmp(&render[i], mcs, mcs_len)) {
+            memset(&hl[i], HL_MLCOMMENT, mcs_len); // Highlight start marker
+            i += mcs_len;
+            in_comment = 1;
+            prev_sep = 0; // Start of comment is not a separator for next char
+            continue;
         }
 
-        // --- Check Keywords/Types/Builtins if preceded by a separator ---
-        // This needs to happen *after* comments/strings are handled
-        if (prev_sep) {
-            // Check lists in order of priority (adjust order if needed)
-            if (match_and_highlight(row, &i, keywords1, HL_KEYWORD1) ||
-                match_and_highlight(row, &i, keywords2, HL_KEYWORD2) ||
-                match_and_highlight(row, &i, keywords3, HL_KEYWORD3) || // Add if you define HL_KEYWORD3
-                match_and_highlight(row, &i, types, HL_TYPE)       || // Add if you define HL_TYPE
-                match_and_highlight(row, &i, builtins, HL_BUILTIN))    // Add if you define HL_BUILTIN
-            {
-                prev_sep = 0; // Keyword was matched, not a separator
-                continue;     // Continue main loop, `i` was advanced by match_and_highlight
+        // Start of a string (SYN_QUOTE is only set if strings are highlighted)
+        if (k & SYN_QUOTE) {
+            in_string = c;
+            hl[i] = HL_STRING;
+            i++;
+            prev_sep = 0; // Opening quote is not a separator for next char
+            continue;
+        }
+
+        // Numbers: a digit after a separator or number, or a '.' inside a
+        // number (but not "..", "1..2", etc.)
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
+            if (((k & SYN_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER && render[i - 1] != '.')) {
+                hl[i] = HL_NUMBER;
+                i++;
+                prev_sep = 0; // Part of a number is not a separator
+                continue;
             }
-            // If no keyword matched, prev_sep remains 1 for the is_separator check below
         }
 
-        // If none of the above specific highlight types matched, update separator status and advance
-        prev_sep = is_separator(c);
+        // Keywords/types/builtins, only at the start of a word
+        if (prev_sep && (k & SYN_KEYWORD) && match_and_highlight(row, hl, &i, syntax)) {
+            prev_sep = 0; // Keyword was matched, not a separator
+            continue;     // `i` was advanced by match_and_highlight
+        }
+
+        prev_sep = (k & SYN_SEPARATOR) != 0;
         i++;
     } // End while loop
+    storeRowHighlight(row, hl);
 
     // Update multi-line comment status for next line
-    // Propagate change downwards if the open comment status changed for this line
     int changed = (row->hl_open_comment != in_comment);
     row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < E.numrows) {
-        editorUpdateSyntax(&E.row[row->idx + 1]); // Recursively update next line
+    return changed;
+}
+
+// Highlights one row of `buf` from the given incoming state.
+// Returns 1 if the row's own open-comment state changed, 0 otherwise.
+static int highlightRowFrom(editorBuffer *buf, erow *row, int in_comment) {
+    if (row->hl_stale) {
+        row->hl_stale = false;
+        buf->hl_stale_rows--;
     }
+    return highlightRowWith(row, buf->syntax, in_comment, &main_scratch);
 }
 
+// Highlights one row, starting from the open-comment state of the row above.
+static int highlightRow(editorBuffer *buf, erow *row) {
+    // Multiline comment state persists from previous line
+    return highlightRowFrom(buf, row, row->idx > 0 && buf->row[row->idx - 1].hl_open_comment);
+}
 
-void editorSelectSyntaxHighlight() {
-    E.syntax = NULL;
-    if (E.filename == NULL) return; // No filename, no syntax
+// --- Parallel Highlighting ---
+
+typedef struct HighlightChunk {
+    erow *rows;         // Row array of the buffer being highlighted
+    int start, end;     // Rows [start, end)
+    int in_comment;     // Open-comment state assumed at start
+    const struct editorSyntax *syntax;
+} HighlightChunk;
+
+static void *highlightChunk(void *arg) {
+    const HighlightChunk *chunk = arg;
+    HighlightScratch scratch = {0};
+    int in_comment = chunk->in_comment;
+    for (int at = chunk->start; at < chunk->end; at++) {
+        highlightRowWith(&chunk->rows[at], chunk->syntax, in_comment, &scratch);
+        in_comment = chunk->rows[at].hl_open_comment;
+    }
+    free(scratch.bytes);
+    return NULL;
+}
 
-    char *ext = strrchr(E.filename, '.');
-    char *fname = strrchr(E.filename, '/'); // Find last '/' for filename part
+static int highlightThreadCount(void) {
+    static int threads = 0;
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 1 ? 1 : cpus > HL_MAX_THREADS ? HL_MAX_THREADS : (int)cpus;
+    }
+    return threads;
+}
+
+// Highlights the stale rows [start, start + count) with one chunk per
+// thread. The row above start must be current; every later chunk assumes
+// no comment is open where it starts. Chunks where that guess was wrong
+// are then redone in order, each only until its rows' open-comment state
+// matches what the guess produced.
+static void highlightRowsParallel(editorBuffer *buf, int start, int count, int threads) {
+    HighlightChunk chunks[HL_MAX_THREADS];
+    pthread_t workers[HL_MAX_THREADS];
+    bool started[HL_MAX_THREADS];
+    int per_chunk = (count + threads - 1) / threads;
+
+    for (int t = 0; t < threads; t++) {
+        int chunk_start = start + t * per_chunk;
+        int chunk_end = chunk_start + per_chunk;
+        if (chunk_end > start + count) chunk_end = start + count;
+        chunks[t] = (HighlightChunk){buf->row, chunk_start, chunk_end, 0, buf->syntax};
+        if (t == 0) chunks[t].in_comment = (start > 0 && buf->row[start - 1].hl_open_comment);
+
+        // Chunk 0 runs on this thread; so does any chunk whose worker won't start
+        started[t] = t > 0 && chunk_start < chunk_end &&
+                     pthread_create(&workers[t], NULL, highlightChunk, &chunks[t]) == 0;
+    }
+    for (int t = 0; t < threads; t++) {
+        if (!started[t] && chunks[t].start < chunks[t].end) highlightChunk(&chunks[t]);
+    }
+    for (int t = 1; t < threads; t++) {
+        if (started[t]) pthread_join(workers[t], NULL);
+    }
+
+    // Fix-up: redo chunks whose real incoming state differs from the guess
+    for (int t = 1; t < threads && chunks[t].start < chunks[t].end; t++) {
+        int in_comment = buf->row[chunks[t].start - 1].hl_open_comment;
+        if (in_comment == chunks[t].in_comment) continue;
+        for (int at = chunks[t].start; at < chunks[t].end; at++) {
+            if (!highlightRowWith(&buf->row[at], buf->syntax, in_comment, &main_scratch)) break;
+            in_comment = buf->row[at].hl_open_comment;
+        }
+    }
+
+    for (int at = start; at < start + count; at++) {
+        buf->row[at].hl_stale = false;
+        if ((at & (HL_CHECKPOINT_INTERVAL - 1)) == 0) {
+            setCheckpoint(buf, at, at > 0 && buf->row[at - 1].hl_open_comment);
+        }
+    }
+    buf->hl_stale_rows -= count;
+    buf->hl_stale_from = start + count;
+}
+
+// Highlights `row` of `buf` after its text changed. Reads and writes only
+// that buffer, so it works the same whether or not `buf` is current.
+void editorUpdateSyntax(editorBuffer *buf, erow *row) {
+    // Below a stale row the stored states can't tell whether the real
+    // state changed, so the checkpoints underneath go either way
+    bool unsure = buf->hl_stale_from <= row->idx;
+    if (!highlightRow(buf, row)) {
+        if (unsure) editorInvalidateSyntaxCheckpoints(buf, row->idx);
+        return;
+    }
+    editorInvalidateSyntaxCheckpoints(buf, row->idx);
+
+    // The open-comment state changed, so the rows below need redoing until
+    // it stops changing. Only rows down to the bottom of the screen are
+    // redone here; past that the next row is marked stale and the rest
+    // follow from editorHighlightStaleRows once they are needed.
+    int last_visible = lastVisibleRow(buf);
+    for (int at = row->idx + 1; at < buf->numrows; at++) {
+        if (at > last_visible) {
+            markRowStale(buf, at);
+            return;
+        }
+        if (!highlightRow(buf, &buf->row[at])) return;
+    }
+}
+
+// Redoes the stale rows down to and including `upto`, top to bottom, so each
+// one starts from a current row above it
+void editorHighlightStaleRows(editorBuffer *buf, int upto) {
+    if (upto >= buf->numrows) upto = buf->numrows - 1;
+    if (buf->hl_stale_rows == 0 || buf->hl_stale_from > upto) return;
+
+    for (int at = buf->hl_stale_from; at <= upto; at++) {
+        // Every row above is current here, so its state is worth keeping
+        if ((at & (HL_CHECKPOINT_INTERVAL - 1)) == 0) {
+            setCheckpoint(buf, at, at > 0 && buf->row[at - 1].hl_open_comment);
+        }
+        if (buf->row[at].hl_stale && highlightRow(buf, &buf->row[at]) && at + 1 < buf->numrows) {
+            markRowStale(buf, at + 1);
+        }
+    }
+    buf->hl_stale_from = upto + 1;
+}
+
+// Brings rows first..last up to date. If stale rows reach back above the
+// checkpoint before `first`, highlighting starts from that checkpoint and
+// the stale rows above it are left for later, so a jump deep into a large
+// file costs about one checkpoint interval plus the rows asked for.
+void editorHighlightRange(editorBuffer *buf, int first, int last) {
+    if (last >= buf->numrows) last = buf->numrows - 1;
+    if (buf->hl_stale_rows == 0 || buf->hl_stale_from > last) return;
+
+    int start = first & ~(HL_CHECKPOINT_INTERVAL - 1);
+    int in_comment = buf->hl_stale_from < start ? checkpointState(buf, start / HL_CHECKPOINT_INTERVAL) : -1;
+    if (in_comment < 0) {
+        editorHighlightStaleRows(buf, last); // Catch up in order
+        return;
+    }
+
+    // A current row was highlighted from the stored state of the row above
+    // it; the first row must also agree with the checkpoint
+    for (int at = start; at <= last; at++) {
+        erow *row = &buf->row[at];
+        bool redo = row->hl_stale || (at == start && buf->row[at - 1].hl_open_comment != in_comment);
+        if (redo && highlightRowFrom(buf, row, in_comment) && at + 1 < buf->numrows) {
+            markRowStale(buf, at + 1);
+        }
+        in_comment = row->hl_open_comment;
+    }
+}
+
+// Works through part of `buf`'s stale rows, down from its frontier.
+// Returns the number of rows brought up to date.
+static int highlightIdleChunk(editorBuffer *buf, int threads) {
+    if (buf->hl_stale_from >= buf->numrows) {
+        buf->hl_stale_rows = 0; // No row can be flagged past the end
+        return 0;
+    }
+    // Everything from the frontier down is stale (as after a syntax is
+    // selected): large backlogs like that are split across cores
+    int tail = buf->numrows - buf->hl_stale_from;
+    if (threads > 1 && buf->hl_stale_rows == tail && tail >= HL_PARALLEL_MIN_ROWS) {
+        int count = threads * HL_PARALLEL_CHUNK_ROWS;
+        if (count > tail) count = tail;
+        highlightRowsParallel(buf, buf->hl_stale_from, count, threads);
+        return count;
+    }
+
+    int pending = buf->hl_stale_rows;
+    editorHighlightStaleRows(buf, buf->hl_stale_from + HL_IDLE_CHUNK_ROWS - 1);
+    return pending - buf->hl_stale_rows;
+}
+
+// The buffer idle highlighting should work on next: the current one first,
+// then any other whose syntax was selected under the loaded definitions
+static editorBuffer *nextIdleBuffer(void) {
+    if (E.current_buffer && E.current_buffer->hl_stale_rows > 0) return E.current_buffer;
+    for (editorBuffer *buf = E.buffer_list_head; buf; buf = buf->next) {
+        if (buf->hl_stale_rows > 0 && buf->hl_generation == E.syntax_generation) return buf;
+    }
+    return NULL;
+}
+
+// Brings stale rows up to date while no key is waiting, HL_IDLE_SLICE_MS at
+// a time: those below the screen first, then those of background buffers.
+// Called from the editorReadKey wait loop; returns as soon as input arrives
+// or nothing is left. While the debug overlay is up, the screen is redrawn
+// every HL_IDLE_REDRAW_MS and once at the end so its pending count moves.
+void editorHighlightIdle(void) {
+    int threads = highlightThreadCount();
+    editorBuffer *buf;
+    unsigned long idle_rows = E.hl_idle_rows;
+    double last_redraw = getMonotonicMs();
+    while ((buf = nextIdleBuffer()) != NULL && !editorInputPending()) {
+        double slice_end = getMonotonicMs() + HL_IDLE_SLICE_MS;
+        do {
+            E.hl_idle_rows += highlightIdleChunk(buf, threads);
+        } while (buf->hl_stale_rows > 0 && getMonotonicMs() < slice_end);
+
+        if (debug_overlay_active && E.hl_idle_rows != idle_rows &&
+            getMonotonicMs() - last_redraw >= HL_IDLE_REDRAW_MS) {
+            editorRefreshScreen();
+            idle_rows = E.hl_idle_rows;
+            last_redraw = getMonotonicMs();
+        }
+    }
+    if (debug_overlay_active && E.hl_idle_rows != idle_rows) editorRefreshScreen();
+}
+
+
+// Picks `buf`'s syntax from its file name and highlights the rows of it
+// that are on screen. E.syntax follows when `buf` is the current buffer.
+void editorSelectSyntaxHighlight(editorBuffer *buf) {
+    if (!buf) return;
+    buf->syntax = NULL;
+    buf->hl_generation = E.syntax_generation;
+    if (buf == E.current_buffer) E.syntax = NULL;
+    setStaleFrom(buf, buf->numrows); // Nothing is pending for the rows of this buffer yet
+    if (buf->filename == NULL) return; // No filename, no syntax
+
+    char *ext = strrchr(buf->filename, '.');
+    char *fname = strrchr(buf->filename, '/'); // Find last '/' for filename part
     if (fname) {
         fname++; // Point to character after '/'
     } else {
-        fname = E.filename; // No '/', filename is the whole string
+        fname = buf->filename; // No '/', filename is the whole string
     }
 
     for (int j = 0; j < E.num_syntax_defs; j++) {
@@ -540,16 +1109,20 @@ void editorSelectSyntaxHighlight() {
             }
 
             if (match) {
-                E.syntax = s; // Found match
-
-                // Re-highlight entire file as syntax context might change ML comments etc.
-                for (int filerow = 0; filerow < E.numrows; filerow++) {
+                buf->syntax = s; // Found match
+                if (buf == E.current_buffer) E.syntax = s;
+
+                // Re-highlight the rows on screen now; the rest of the file
+                // is marked stale and redone as it comes into view
+                int last_visible = lastVisibleRow(buf);
+                setStaleFrom(buf, last_visible + 1);
+                for (int filerow = 0; filerow < buf->numrows && filerow <= last_visible; filerow++) {
                     // Need to check if row->hl exists before updating - safety check
-                    if (E.row[filerow].hl || E.row[filerow].rsize == 0) { // Update if hl exists or row is empty
-                       editorUpdateSyntax(&E.row[filerow]);
+                    if (buf->row[filerow].render) { // Update if the row has been rendered
+                       editorUpdateSyntax(buf, &buf->row[filerow]);
                     } else {
-                       // If hl doesn't exist but row isn't empty, need full update
-                       editorUpdateRow(&E.row[filerow]); // This will call editorUpdateSyntax
+                       // If render doesn't exist yet, need full update
+                       editorUpdateRow(buf, &buf->row[filerow]); // This will call editorUpdateSyntax
                     }
                 }
                 return; // Exit after finding first match
@@ -557,5 +1130,5 @@ void editorSelectSyntaxHighlight() {
             i++;
         }
     }
-    // If no match found, E.syntax remains NULL, no highlighting applied.
+    // If no match found, buf->syntax remains NULL, no highlighting applied.
 }
\ No newline at end of file
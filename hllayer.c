@@ -0,0 +1,167 @@
+#include "kilo.h"
+#include "hllayer.h"
+#include "scene.h"
+
+/**
+ * Highlight layers
+ *
+ * Search matches and other highlighting that isn't syntax (selection,
+ * diagnostics, bracket matches) live in per-buffer layers instead of being
+ * written into row->hl. Each layer is a sorted set of intervals, plus an
+ * optional pattern whose occurrences are found row by row while drawing.
+ * editorDrawRowContent collects the intervals over the visible part of each
+ * row with highlightLayersForRow and draws them over the row's syntax runs,
+ * so a row's syntax highlighting is never touched and text off screen
+ * costs nothing.
+ *
+ * Cached row encodings are keyed on E.hl_layer_generation, which every
+ * change here bumps.
+ */
+
+static void layersChanged(void) {
+    E.hl_layer_generation++;
+    sceneTouch(SCENE_DEP_TEXT);
+}
+
+static HighlightLayer *getLayer(editorBuffer *buf, HighlightLayerId id) {
+    if (!buf || id < 0 || id >= HL_LAYER_COUNT) return NULL;
+    if (!buf->hl_layers) {
+        buf->hl_layers = calloc(1, sizeof(HighlightLayers));
+        if (!buf->hl_layers) die("getLayer: calloc failed");
+    }
+    return &buf->hl_layers->layers[id];
+}
+
+// Removes every interval and the pattern from a layer
+void highlightLayerClear(editorBuffer *buf, HighlightLayerId id) {
+    if (!buf || !buf->hl_layers || id < 0 || id >= HL_LAYER_COUNT) return;
+    HighlightLayer *layer = &buf->hl_layers->layers[id];
+    if (layer->count == 0 && !layer->pattern) return;
+    layer->count = 0;
+    free(layer->pattern);
+    layer->pattern = NULL;
+    layersChanged();
+}
+
+// Adds render bytes [start, end) of `row` to a layer, drawn as `hl`.
+// Intervals added in row order are appended without moving any others.
+void highlightLayerAdd(editorBuffer *buf, HighlightLayerId id, int row, int start, int end, unsigned char hl) {
+    if (row < 0 || start < 0 || end <= start) return;
+    HighlightLayer *layer = getLayer(buf, id);
+    if (!layer) return;
+
+    if (layer->count == layer->capacity) {
+        int capacity = layer->capacity ? layer->capacity * 2 : 16;
+        HighlightInterval *grown = realloc(layer->items, capacity * sizeof(HighlightInterval));
+        if (!grown) die("highlightLayerAdd: realloc failed");
+        layer->items = grown;
+        layer->capacity = capacity;
+    }
+
+    int at = layer->count;
+    while (at > 0 && (layer->items[at - 1].row > row ||
+                      (layer->items[at - 1].row == row && layer->items[at - 1].start > start))) {
+        at--;
+    }
+    memmove(&layer->items[at + 1], &layer->items[at], (layer->count - at) * sizeof(HighlightInterval));
+    layer->items[at] = (HighlightInterval){row, start, end, hl};
+    layer->count++;
+    layersChanged();
+}
+
+// Draws every occurrence of `pattern` in the buffer as `hl` (NULL or ""
+// removes the pattern). Occurrences aren't searched for until drawn.
+void highlightLayerSetPattern(editorBuffer *buf, HighlightLayerId id, const char *pattern, unsigned char hl) {
+    if (pattern && !*pattern) pattern = NULL;
+    if (!pattern && (!buf || !buf->hl_layers)) return;
+    HighlightLayer *layer = getLayer(buf, id);
+    if (!layer) return;
+    if (layer->pattern_hl == hl &&
+        (pattern ? layer->pattern && strcmp(layer->pattern, pattern) == 0 : !layer->pattern)) {
+        return;
+    }
+
+    free(layer->pattern);
+    layer->pattern = pattern ? strdup(pattern) : NULL;
+    if (pattern && !layer->pattern) die("highlightLayerSetPattern: strdup failed");
+    layer->pattern_hl = hl;
+    layersChanged();
+}
+
+// Keeps intervals on their rows when rows are inserted (delta 1) or
+// deleted (delta -1) at `at`. Intervals on a deleted row are dropped.
+void highlightLayerShiftRows(editorBuffer *buf, int at, int delta) {
+    if (!buf || !buf->hl_layers) return;
+    bool changed = false;
+    for (int id = 0; id < HL_LAYER_COUNT; id++) {
+        HighlightLayer *layer = &buf->hl_layers->layers[id];
+        int kept = 0;
+        for (int i = 0; i < layer->count; i++) {
+            HighlightInterval item = layer->items[i];
+            if (item.row >= at) {
+                if (delta < 0 && item.row < at - delta) {
+                    changed = true;
+                    continue;
+                }
+                item.row += delta;
+                changed = true;
+            }
+            layer->items[kept++] = item;
+        }
+        layer->count = kept;
+    }
+    if (changed) layersChanged();
+}
+
+// Collects the intervals over render bytes [from, to) of `row` from every
+// layer into `out`, bottom layer first, and returns how many there are (at
+// most `max`). Only that range is searched for pattern matches, so a long
+// row's matches left of the screen can't use up `max`.
+int highlightLayersForRow(const editorBuffer *buf, const erow *row, int from, int to,
+                          HighlightInterval *out, int max) {
+    if (!buf || !buf->hl_layers) return 0;
+    int n = 0;
+    for (int id = 0; id < HL_LAYER_COUNT && n < max; id++) {
+        const HighlightLayer *layer = &buf->hl_layers->layers[id];
+
+        // First interval on the row (binary search; items are sorted)
+        int lo = 0, hi = layer->count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (layer->items[mid].row < row->idx) lo = mid + 1;
+            else hi = mid;
+        }
+        for (int i = lo; i < layer->count && layer->items[i].row == row->idx && n < max; i++) {
+            HighlightInterval item = layer->items[i];
+            if (item.start >= row->rsize) continue; // The row got shorter
+            if (item.end > row->rsize) item.end = row->rsize;
+            if (item.end <= from || item.start >= to) continue; // Off screen
+            out[n++] = item;
+        }
+
+        if (layer->pattern && row->render) {
+            // Matches that start left of `from` but reach into the range count too
+            int len = strlen(layer->pattern);
+            int at = from - len + 1 > 0 ? from - len + 1 : 0;
+            int limit = to + len - 1 < row->rsize ? to + len - 1 : row->rsize;
+            const char *match;
+            while (n < max && at < limit &&
+                   (match = memmem(row->render + at, limit - at, layer->pattern, len)) != NULL) {
+                int start = match - row->render;
+                out[n++] = (HighlightInterval){row->idx, start, start + len, layer->pattern_hl};
+                at = start + len;
+            }
+        }
+    }
+    return n;
+}
+
+void highlightLayersFree(editorBuffer *buf) {
+    if (!buf || !buf->hl_layers) return;
+    for (int id = 0; id < HL_LAYER_COUNT; id++) {
+        free(buf->hl_layers->layers[id].items);
+        free(buf->hl_layers->layers[id].pattern);
+    }
+    free(buf->hl_layers);
+    buf->hl_layers = NULL;
+}
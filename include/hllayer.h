@@ -0,0 +1,50 @@
+#ifndef KILO_HLLAYER_H_
+#define KILO_HLLAYER_H_
+
+#include <stdbool.h>
+
+struct editorBuffer;
+struct erow;
+
+// Highlighting kept apart from a buffer's syntax highlighting and merged
+// over it as rows are drawn. Later layers are drawn over earlier ones.
+typedef enum HighlightLayerId {
+    HL_LAYER_SELECTION,
+    HL_LAYER_DIAGNOSTICS,
+    HL_LAYER_BRACKET,
+    HL_LAYER_SEARCH,
+    HL_LAYER_COUNT
+} HighlightLayerId;
+
+#define HL_LAYER_ROW_MAX 256 // Intervals merged into the visible part of one row, at most
+
+// Render bytes [start, end) of a row, drawn as an HL_* class
+typedef struct HighlightInterval {
+    int row;
+    int start, end;
+    unsigned char hl;
+} HighlightInterval;
+
+typedef struct HighlightLayer {
+    HighlightInterval *items; // Sorted by row, then start
+    int count;
+    int capacity;
+    char *pattern;            // Every occurrence is drawn as pattern_hl (NULL = none);
+    unsigned char pattern_hl; // found per row while drawing, so off-screen rows cost nothing
+} HighlightLayer;
+
+// A buffer's layers (editorBuffer.hl_layers, allocated on first use)
+typedef struct HighlightLayers {
+    HighlightLayer layers[HL_LAYER_COUNT];
+} HighlightLayers;
+
+// Prototypes
+void highlightLayerClear(struct editorBuffer *buf, HighlightLayerId id);
+void highlightLayerAdd(struct editorBuffer *buf, HighlightLayerId id, int row, int start, int end, unsigned char hl);
+void highlightLayerSetPattern(struct editorBuffer *buf, HighlightLayerId id, const char *pattern, unsigned char hl);
+void highlightLayerShiftRows(struct editorBuffer *buf, int at, int delta);
+int highlightLayersForRow(const struct editorBuffer *buf, const struct erow *row, int from, int to,
+                          HighlightInterval *out, int max);
+void highlightLayersFree(struct editorBuffer *buf);
+
+#endif // KILO_HLLAYER_H_
@@ -11,6 +11,9 @@ int initLua();
 // Get the current Lua state
 lua_State* getLuaState(void);
 
+// Wrap the library table's functions so draw callbacks record what they read (luamemo.c)
+void luaMemoInstrument(lua_State *L, int index);
+
 // Reference to the status bar callback function
 extern int statusbar_callback_ref;
 extern int tabline_callback_ref;
@@ -13,8 +13,8 @@
 #include <sys/ioctl.h>  // For ioctl, TIOCGWINSZ, struct winsize
 #include <errno.h>      // For errno, EAGAIN
 #include <dirent.h> // For directory handling
+#include <stdint.h>     // For uint64_t
 #include "debug.h"
-#include "ui.h"
 #include "dirtree.h"
 #include "components.h"
 
@@ -35,7 +35,11 @@
 
 #define KILO_LINE_NUMBER_WIDTH 6
 
-#define MAX_ACTIVE_OVERLAYS 3
+
+// Optional control sequences the terminal understands (E.term_caps)
+#define TERM_CAP_ECH (1<<0) // CSI n X: erase n cells without moving the cursor
+#define TERM_CAP_REP (1<<1) // CSI n b: repeat the previous character n times
+#define TERM_CAP_SYNC (1<<2) // CSI ?2026 h/l: synchronized output (DEC mode 2026)
 
 typedef struct {
     char *name;
@@ -111,6 +115,20 @@ enum editorKey {
 
 enum editorMode { MODE_NORMAL, MODE_INSERT };
 
+// How theme colours are written to the terminal
+enum editorColorMode {
+  COLOR_MODE_TRUECOLOR, // 24-bit "38;2;r;g;b"
+  COLOR_MODE_256,       // xterm-256 palette "38;5;n"
+  COLOR_MODE_16,        // ANSI 30-37/90-97
+};
+
+// Adaptive render quality, lowered while the terminal can't keep up (render.c)
+enum editorRenderQuality {
+  RENDER_QUALITY_FULL,    // Everything as configured
+  RENDER_QUALITY_REDUCED, // Truecolor output quantised to the 256-colour palette
+  RENDER_QUALITY_MINIMAL, // Also no syntax colours and no side panel redraws
+};
+
 
 enum editorHighlight {
   HL_NORMAL = 0,
@@ -129,8 +147,35 @@ enum editorHighlight {
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
+// Byte classes in editorSyntax.byte_class. A byte's bits say which lexer
+// rules can start at it, so the highlighter only probes those.
+#define SYN_SEPARATOR (1<<0)
+#define SYN_DIGIT     (1<<1) // Only if numbers are highlighted
+#define SYN_QUOTE     (1<<2) // Opens a string; only if strings are highlighted
+#define SYN_SCS       (1<<3) // First byte of the single-line comment marker
+#define SYN_MCS       (1<<4) // First byte of the multi-line comment start
+#define SYN_MCE       (1<<5) // First byte of the multi-line comment end
+#define SYN_KEYWORD   (1<<6) // First byte of some keyword
+
 
 /*** data ***/
+// One keyword in a syntax's keyword table
+typedef struct syntaxKeyword {
+    const char *word;   // Points into the syntax's keyword lists (NULL = empty slot)
+    int len;
+    int rank;           // Position across keywords1..builtins; the lowest rank wins
+    unsigned char hl;   // Highlight class (HL_KEYWORD1...)
+} syntaxKeyword;
+
+// Every keyword of a syntax in one hash table, built by parseSyntaxFile.
+// The length bitmap (and SYN_KEYWORD) reject most positions without hashing.
+typedef struct syntaxKeywordTable {
+    syntaxKeyword *slots;      // Open addressing, power-of-two size
+    unsigned int mask;         // Number of slots - 1
+    uint64_t lengths[4];       // Bit per keyword length (1..255)
+    int min_len, max_len;
+} syntaxKeywordTable;
+
 struct editorSyntax {
     char *filetype;
     char **filematch;
@@ -147,9 +192,41 @@ struct editorSyntax {
     int flags;
     // Language icon to be used in status bar (UTF)
     char *status_icon;
+    syntaxKeywordTable keyword_table; // All keyword lists, for lookup while highlighting
+    unsigned char byte_class[256];    // SYN_* bits per byte, built by parseSyntaxFile
+    int scs_len, mcs_len, mce_len;    // Comment marker lengths (0 = not defined)
+    bool state_scan_exact;            // No keyword can hide a quote or comment start
 };
 
 
+// Encoded terminal output for the visible part of a row (see editorDrawRows).
+// Valid while every key field still matches the current draw.
+typedef struct erowRenderCache {
+  char *bytes;                   // Colour escapes + text, no cursor movement
+  int len;
+  int cells;                     // Screen cells the bytes cover
+  unsigned int version;          // erow.version the bytes were built from (0 = empty)
+  unsigned int theme_generation; // E.theme_generation at build time
+  unsigned int layer_generation; // E.hl_layer_generation at build time
+  bool layered;                  // Highlight layers were drawn over the row
+  int coloff;                    // Horizontal scroll offset used
+  int width;                     // Available content width used
+} erowRenderCache;
+
+// One run of equally highlighted render bytes. A row's spans cover its
+// render bytes in order; runs longer than USHRT_MAX are split.
+typedef struct erowHlSpan {
+  unsigned short len;
+  unsigned char hl;  // HL_* class
+} erowHlSpan;
+
+// A run of equal highlighting found by editorHighlightRunAt
+typedef struct erowHlRun {
+  int span;          // Span the run was read from (rows kept as spans)
+  int start, end;    // Render bytes [start, end)
+  unsigned char hl;
+} erowHlRun;
+
 // Structure to hold a single row of text in the editor
 typedef struct erow {
 	int idx;
@@ -157,8 +234,15 @@ typedef struct erow {
   int rsize;
   char *chars;    // Pointer to the character data for the row
   char *render;
-  unsigned char *hl;
+  unsigned char *hl;            // HL_* per render byte, for rows with many runs; else NULL
+  erowHlSpan *hl_spans;         // Highlighting as runs, for rows with few; else NULL
+  int hl_span_count;            // (Neither set: the whole row is HL_NORMAL)
+  unsigned char *cell_width;    // Screen cells per render byte (0 = continuation); NULL if ascii
+  bool ascii;                   // No bytes >= 0x80: one cell per render byte
 	int hl_open_comment;
+  bool hl_stale;                // hl is out of date; redone when next needed (see highlighting.c)
+  unsigned int version;         // Bumped whenever render or hl change
+  erowRenderCache render_cache; // Last encoded output for this row
 } erow;
 
 
@@ -178,18 +262,31 @@ typedef struct editorBuffer {
     int cx, cy, rx;  // Cursor position specific to this buffer
     int rowoff, coloff; // Scroll offset specific to this buffer
     struct editorSyntax *syntax; // Syntax highlighting specific to this buffer
+    // Highlighting state, kept per buffer so any buffer can be highlighted
+    unsigned int hl_generation;  // E.syntax_generation its syntax was selected under (0 = redo)
+    int hl_stale_rows;           // Rows with hl_stale set
+    int hl_stale_from;           // No row above this one has hl_stale set
+    signed char *hl_checkpoints; // Open-comment state at the start of every 256th row (-1 = unknown)
+    int hl_checkpoint_capacity;
+    struct HighlightLayers *hl_layers; // Search matches etc. drawn over syntax (hllayer.c)
 
     struct editorBuffer *next; // Pointer for linked list implementation
     struct editorBuffer *prev;
 } editorBuffer;
 
 
-typedef struct OverlayInstance {
-  bool is_active; // (Maybe redundant if only active ones are in the list);
-  void *state; // (Pointer to the specific state struct, e.g., NavigatorState*, CommandPaletteState*)
-  void (*draw_func)(struct abuf *ab, void *state); //(Pointer to the C function that draws this specific type of overlay)
-  // Maybe other common fields like z-index?
-} OverlayInstance;
+// Counters shown in the debug overlay
+typedef struct editorRenderStats {
+  unsigned long row_cache_hits;
+  unsigned long row_cache_misses;
+  unsigned long rows_culled;  // Text rows skipped entirely under opaque overlays
+  unsigned long rows_clipped; // Text rows drawn only around opaque overlays
+} editorRenderStats;
+
+struct abuf {
+    char *b;    // Pointer to the buffer memory
+    int len;    // Current length of the string in the buffer
+};
 
 
 typedef enum PanelDisplayMode { PANEL_MODE_NONE, PANEL_MODE_LEFT, PANEL_MODE_RIGHT, PANEL_MODE_FLOAT } PanelDisplayMode;
@@ -215,6 +312,7 @@ struct editorConfig {
   int content_width;
   int content_start_col;
   int total_rows;         // Store total terminal height
+  int term_caps;          // TERM_CAP_* flags detected at startup
   erow *row;              // Pointer to an array of erow structures (the file content)
   int dirty;              // Whether the file has been modified externally since opening/saving
   char *filename;         // Pointer to the filename
@@ -224,17 +322,20 @@ struct editorConfig {
   struct editorSyntax *syntax; // Pointer to the syntax highlighting struct
   struct editorSyntax *syntax_defs; // Dynamic array of syntax definitions
   int num_syntax_defs;             // Number of loaded definitions
+  unsigned int syntax_generation;  // Bumped whenever the definitions are (re)loaded
   struct termios orig_termios; // Original terminal settings to restore on exit
   editorTheme theme; // Holds current theme colors as strings
+  enum editorColorMode color_mode; // Output palette theme colours are quantised to
+  unsigned int theme_generation; // Bumped when theme colours or their encoding change
+  enum editorRenderQuality render_quality; // Lowered by render.c under output pressure
+  editorRenderStats render_stats;
   enum editorMode mode; // Holds current editor mode (INSERT or NORMAL)
+  unsigned long hl_idle_rows; // Rows brought up to date in idle time (all buffers)
+  unsigned int hl_layer_generation; // Bumped whenever a highlight layer changes
     // --- New fields for multi-buffer support ---
   editorBuffer *buffer_list_head; // Head of the linked list of all open buffers
   editorBuffer *current_buffer;  // Pointer to the currently active buffer
   int num_buffers;              // Count of open buffers
-    // UI Component Registry fields
-  UIComponent *ui_components;
-  int ui_component_count;
-  int ui_component_capacity;
   // --- State for Static Directory Panel ---
   DirTreeState panel_state;
   bool panel_visible;           // Is the panel configured to be shown?
@@ -252,19 +353,11 @@ struct editorConfig {
   char *navigator_search_query; // If doing text filtering later
   int navigator_selected_index;    // Index in the list shown by the navigator
   int navigator_view_offset;       // Scroll offset in the list shown by the navigator
-  OverlayInstance active_overlays[MAX_ACTIVE_OVERLAYS];
-  int num_active_overlays;
 };
 
 extern struct editorConfig E;
 
 
-struct abuf {
-    char *b;    // Pointer to the buffer memory
-    int len;    // Current length of the string in the buffer
-};
-
-
 /*** prototypes ***/
 
 // --- Terminal ---
@@ -272,13 +365,24 @@ void die(const char* s);
 void disableRawMode();
 void enableRawMode();
 int editorReadKey();
+bool editorInputPending(void);
+bool editorWaitForInput(int timeout_ms);
 int getCursorPosition(int *rows, int *cols);
 int getWindowSize(int *rows, int *cols);
+void editorInstallResizeHandler(void);
+bool editorResizePending(void);
+bool editorConsumeResize(void);
+void detectTerminalCapabilities(void);
 
 // --- Syntax Highlighting ---
-void editorUpdateSyntax(erow *row);
+void editorUpdateSyntax(editorBuffer *buf, erow *row);
+void editorHighlightStaleRows(editorBuffer *buf, int upto);
+void editorHighlightRange(editorBuffer *buf, int first, int last);
+void editorHighlightIdle(void);
+void editorInvalidateSyntaxCheckpoints(editorBuffer *buf, int after_row);
+void editorHighlightRunAt(const erow *row, int at, erowHlRun *run);
 int editorSyntaxToColour(int hl);
-void editorSelectSyntaxHighlight();
+void editorSelectSyntaxHighlight(editorBuffer *buf);
 int is_separator(int c); // Might be static if only used in syntax.c
 void loadSyntaxFiles(void);
 void freeSyntaxDefs(void);
@@ -287,7 +391,11 @@ void freeSyntaxDefs(void);
 // --- Row Operations ---
 int editorRowCxToRx(erow *row, int cx);
 int editorRowRxToCx(erow *row, int rx);
-void editorUpdateRow(erow *row);
+int editorRowRenderToCx(erow *row, int render_idx);
+int editorRowPrevCx(erow *row, int cx);
+int editorRowNextCx(erow *row, int cx);
+int editorRowSnapCx(erow *row, int cx);
+void editorUpdateRow(editorBuffer *buf, erow *row);
 void editorInsertRow(int at, char *s, size_t len);
 void editorFreeRow(erow *row);
 void editorDelRow(int at);
@@ -318,6 +426,9 @@ void editorFindCallback(char *query, int key);
 // --- Output ---
 void editorScroll();
 void editorDrawRows(struct abuf *ab, int start_row, int start_col, int height, int width);
+char* getThemeColorByName(const char* name);
+int getThemeColorId(const char* name);
+char* getThemeColorById(int id);
 void editorDrawStatusBar(struct abuf *ab);
 void editorDrawDefaultTabline(struct abuf *ab);
 void editorDrawTabline(struct abuf *ab);
@@ -327,14 +438,14 @@ void editorSetStatusMessage(const char *fmt, ...);
 void editorClearStatusMessage();
 void abAppend(struct abuf *ab, const char *s, int len);
 void abFree(struct abuf *ab);
+void abAppendSpaces(struct abuf *ab, int n);
+void fillRect(struct abuf *ab, int x, int y, int w, int h, const char *fg, const char *bg);
 void editorDrawDirTreeFloating(struct abuf *ab, void *state /* DirTreeState* */);
 void editorDrawNavigator(struct abuf *ab, void *state /* NavigatorState* */);
 void editorDrawDirTreeFixed(struct abuf *ab, int x, int y, int w, int h);
 int editorDrawUiElement(struct abuf *ab, int lua_callback_ref);
 // void editorApplyLuaLayout();
 void editorSetPanelMode(PanelDisplayMode new_mode);
-int activateOverlay(void (*draw_func)(struct abuf *, void *), void *state);
-int deactivateOverlay(void *state);
 
 
 // --- Themes -- 
@@ -342,6 +453,10 @@ void loadTheme(const char *theme_name);
 void freeThemeColors(void);
 void applyThemeDefaultColor(struct abuf *ab);
 void applyTrueColor(struct abuf *ab, const char *fg_rgb_str, const char *bg_rgb_str);
+enum editorColorMode detectColorMode(void);
+void setColorMode(enum editorColorMode mode);
+void rebuildThemeColors(void);
+const char *colorModeName(enum editorColorMode mode);
 
 // --- Input ---
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
@@ -0,0 +1,82 @@
+#ifndef KILO_LUAMEMO_H_
+#define KILO_LUAMEMO_H_
+
+#include <stdbool.h>
+#include <limits.h>
+
+// Editor state a Lua draw callback can read through the kilo.* getters.
+// Each getter records the kinds it reads into the memo being evaluated.
+typedef enum LuaMemoDep {
+    MEMO_DEP_CURSOR,  // Cursor position
+    MEMO_DEP_SCROLL,  // Scroll offsets, line count, text area height
+    MEMO_DEP_TEXT,    // Buffer contents and modified flag
+    MEMO_DEP_FILE,    // Current file name, directory, file type
+    MEMO_DEP_BUFFERS, // Open buffers (tabs)
+    MEMO_DEP_MODE,    // Editor mode
+    MEMO_DEP_SCREEN,  // Screen size and render settings
+    MEMO_DEP_TREE,    // Directory panel and navigator state
+    MEMO_DEP_COUNT
+} LuaMemoDep;
+
+#define MEMO_UNSET INT_MIN // Option or segment field not given by the callback
+
+// One parsed segment of a callback's result
+typedef struct LuaMemoSegment {
+    char *text;       // Segment text in the memo's text pool (may contain ANSI sequences)
+    int text_offset;  // Offset of text in the pool (the pool moves while building)
+    int len;          // Byte length of text
+    int width;        // Visible width of text
+    const char *fg;   // Resolved theme colour, or NULL for the caller's default
+    const char *bg;
+    char fg_hex[8];   // Direct "#rrggbb" colours (take precedence over fg/bg)
+    char bg_hex[8];
+    int align;        // 0 = left, 2 = right
+    int line;         // 0-based line (status bar rows)
+    int x, y;         // Position relative to the element (panels, navigator)
+} LuaMemoSegment;
+
+// The options table of a callback's result
+typedef struct LuaMemoOptions {
+    int x, y, width, height; // MEMO_UNSET if not given
+    const char *fg, *bg;     // As in LuaMemoSegment
+    char fg_hex[8], bg_hex[8];
+} LuaMemoOptions;
+
+// Cached, parsed output of one Lua draw callback. The callback is only
+// called again once the editor state it read last time has changed.
+typedef struct LuaMemo {
+    const char *name;         // Shown in the stats
+    int callback_ref;         // Callback the cached output belongs to
+    bool valid;               // Output below is from a successful call
+    bool is_volatile;         // Read state that isn't tracked; never reused
+    unsigned int deps;        // Bit per LuaMemoDep read by the last call
+    unsigned long versions[MEMO_DEP_COUNT]; // Versions of those deps at that call
+    unsigned int theme_generation; // Colours below were resolved against this theme
+
+    LuaMemoSegment *segments; // Parsed segments, reused across evaluations
+    int segment_count;
+    int segment_capacity;
+    char *text_pool;          // Segment texts, NUL-separated
+    int pool_len;
+    int pool_capacity;
+    bool has_options;         // Callback returned an options table
+    LuaMemoOptions options;
+
+    unsigned long hits;       // Evaluations served from the cache
+    unsigned long misses;     // Evaluations that called the callback
+    bool linked;              // On the stats list
+    struct LuaMemo *next;
+} LuaMemo;
+
+#define LUA_MEMO_INIT(n) {.name = (n)}
+
+// Prototypes
+bool luaMemoEvaluate(LuaMemo *memo, int callback_ref);
+void luaMemoFree(LuaMemo *memo);
+void luaMemoForgetCallback(int callback_ref);
+void luaMemoMarkVolatile(void);
+const char *luaMemoColor(const char *resolved, const char *hex, const char *fallback);
+const LuaMemo *luaMemoFirst(void);
+void luaMemoTotals(unsigned long *hits, unsigned long *misses);
+
+#endif // KILO_LUAMEMO_H_
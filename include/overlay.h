@@ -0,0 +1,29 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdbool.h>
+#include "kilo.h" // struct abuf, scene graph
+
+// Stacking order of the built-in overlays (higher is drawn on top)
+#define OVERLAY_Z_PANEL 10     // Floating directory panel
+#define OVERLAY_Z_NAVIGATOR 20 // File navigator
+#define OVERLAY_Z_DEBUG 1000   // Debug log, always on top
+
+// Most visible spans overlayVisibleSpans reports for one screen row
+#define OVERLAY_MAX_SPANS 8
+
+// A visible run of columns [start, end) on one screen row (1-based)
+typedef struct OverlaySpan {
+    int start;
+    int end;
+} OverlaySpan;
+
+// Prototypes
+int activateOverlay(void (*draw_func)(struct abuf *, void *), void *state, int z_index, bool opaque, unsigned int depends);
+int deactivateOverlay(void *state);
+void editorOverlayReportRect(void *state, int x, int y, int width, int height);
+void overlaySyncBuiltins(void);
+int overlayVisibleSpans(int row, int x0, int x1, OverlaySpan *spans, int max_spans);
+bool overlayAnyVisible(void);
+
+#endif // OVERLAY_H
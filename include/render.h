@@ -0,0 +1,54 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include "kilo.h" // struct abuf, enum editorRenderQuality
+
+// If input keeps arriving, a frame is still drawn at least this often (ms)
+#define KILO_MAX_FRAME_SKIP_MS 100
+// Default redraw cap (frames per second), see renderSetFrameRate
+#define KILO_DEFAULT_FRAME_RATE 60
+
+// Counters kept by the render thread, read through renderGetStats()
+typedef struct RenderPipelineStats {
+    unsigned long frames_submitted; // Frames handed over by editorRefreshScreen
+    unsigned long frames_dropped;   // Superseded in the mailbox before being written
+    unsigned long frames_written;   // Fully written to the terminal
+    unsigned long frames_skipped;   // Not composed at all (input pending or frame pacing)
+    unsigned long write_errors;
+    unsigned long bytes_written;
+    double flush_ms_last;           // Submit-to-fully-written time of the last frame
+    double flush_ms_avg;            // Moving average of the above
+    double flush_ms_max;
+    double write_kbps_avg;          // Moving average of achieved write throughput (KB/s)
+} RenderPipelineStats;
+
+// Thresholds for adaptive render quality, set through kilo.set_render_quality
+typedef struct RenderQualityConfig {
+    bool enabled;
+    double latency_ms; // Lower quality while the average flush latency exceeds this
+    double min_kbps;   // ...or while write throughput is below this (0 = ignore)
+    double hold_ms;    // Minimum time between two quality drops
+    double idle_ms;    // Restore full quality after this long without input
+} RenderQualityConfig;
+
+// Prototypes
+void renderInit(void);
+void renderShutdown(void);
+bool renderOnRenderThread(void);
+bool renderThreadRunning(void);
+void renderSubmitFrame(struct abuf *frame);
+unsigned long renderNextFrameSeq(void);
+bool renderFrameTaken(unsigned long seq);
+bool renderShouldSkipFrame(void);
+void renderSetFrameRate(int fps);
+int renderGetFrameRate(void);
+void renderGetStats(RenderPipelineStats *out);
+double getMonotonicMs(void);
+void renderUpdateQuality(void);
+void renderIdleTick(void);
+void renderGetQualityConfig(RenderQualityConfig *out);
+void renderSetQualityConfig(const RenderQualityConfig *cfg);
+const char *renderQualityName(enum editorRenderQuality quality);
+
+#endif // RENDER_H
@@ -0,0 +1,109 @@
+#ifndef KILO_SCENE_H_
+#define KILO_SCENE_H_
+
+#include <stdbool.h>
+
+struct abuf;
+
+// Node types
+
+typedef enum ComponentType {
+    COMPONENT_TEXTAREA,   // Main text editing area
+    COMPONENT_STATUSBAR,  // Status bar at bottom
+    COMPONENT_TABLINE,    // Tab/buffer line at top
+    COMPONENT_PANEL,      // Side panel (like directory tree)
+    COMPONENT_MESSAGEBAR, // Message bar at bottom
+    COMPONENT_FLOATING,   // Floating window/dialog
+    COMPONENT_CUSTOM,     // Custom component
+    COMPONENT_OVERLAY     // Overlay drawn by a C function (see overlay.c)
+} ComponentType;
+
+// Component position (for fixed components)
+typedef enum ComponentPosition {
+    POSITION_TOP,
+    POSITION_BOTTOM,
+    POSITION_LEFT,
+    POSITION_RIGHT,
+    POSITION_CENTER,
+    POSITION_FLOATING
+} ComponentPosition;
+
+// What a node's output depends on. A node is redrawn when one of the
+// domains in its mask changed since its last draw (see sceneTouch).
+#define SCENE_DEP_TEXT   (1u << 0) // Buffer contents, cursor, scrolling
+#define SCENE_DEP_STATUS (1u << 1) // Status message
+#define SCENE_DEP_TREE   (1u << 2) // Directory panel and navigator state
+#define SCENE_DEP_STYLE  (1u << 3) // Theme, colour mode, render quality, screen size
+#define SCENE_DEP_DOMAINS 4
+#define SCENE_DEP_ALWAYS (1u << 31) // Redrawn every frame (clock, Lua, stats...)
+
+// One node of the scene graph: a component laid out by calculateLayout, or
+// an overlay that positions itself while drawing
+typedef struct SceneNode {
+    int x;                // X position (1-based)
+    int y;                // Y position (1-based)
+    int width;            // Width in columns
+    int height;           // Height in rows
+    bool visible;         // Whether component is visible
+    ComponentPosition position; // Where component is positioned
+    ComponentType type;   // Type of component
+    char *name;           // Component name (for lookup)
+    int z_index;          // Drawing order (higher = on top)
+    int lua_callback_ref; // Reference to Lua callback function
+    int hint_width;       // Size hints from the callback's options (-1 = none)
+    int hint_height;
+    struct LuaMemo *memo; // Parsed output of the callback (see luamemo.c)
+    unsigned long result_frame; // Layout frame the memo was last evaluated in (0 = none)
+    bool result_ok;       // Whether that evaluation succeeded
+
+    // Retained drawing
+    void (*draw_func)(struct abuf *ab, void *state); // Overlays: C draw function
+    void *state;          // Overlays: state passed to draw_func (also their key)
+    bool opaque;          // Hides the text area beneath its rectangle
+    unsigned int depends; // SCENE_DEP_* mask
+    bool dirty;           // Redraw on the next frame regardless of depends
+    unsigned long drawn_epoch; // sceneTouch epoch of the last draw
+    int drawn_x, drawn_y, drawn_width, drawn_height; // Layout at the last draw
+    char *output;         // Output of the last draw, replayed while clean
+    int output_len;
+} SceneNode;
+
+// The scene graph: every node, kept sorted by z-index
+typedef struct SceneGraph {
+    SceneNode *nodes;                 // Array of nodes, lowest z-index first
+    int node_count;                   // Number of nodes
+    int node_capacity;                // Capacity of nodes array
+    int screen_width;                 // Current screen width
+    int screen_height;                // Current screen height
+    SceneNode *textarea;              // Quick reference to textarea component
+    SceneNode *statusbar;             // Quick reference to statusbar component
+    SceneNode *tabline;               // Quick reference to tabline component
+    SceneNode *messagebar;            // Quick reference to messagebar component
+    SceneNode *panel;                 // Quick reference to panel component
+    bool layout_dirty;                // Positions must be recalculated
+    unsigned long layout_generation;  // Incremented whenever positions were recalculated
+    unsigned long frame;              // Incremented by every calculateLayout()
+    unsigned long epoch;              // Incremented by every sceneTouch()
+    unsigned long domain_epoch[SCENE_DEP_DOMAINS]; // When each domain last changed
+    unsigned int theme_generation;    // E.theme_generation last seen (SCENE_DEP_STYLE)
+    bool panel_on_screen;             // The panel's last output is still on screen, at:
+    int panel_shown_x, panel_shown_y, panel_shown_width, panel_shown_height;
+    unsigned long panel_shown_seq;    // ...sent in this frame (render.c sequence number)
+    unsigned long nodes_drawn;        // Stats: nodes redrawn
+    unsigned long nodes_replayed;     // Stats: nodes replayed from their retained output
+} SceneGraph;
+
+extern SceneGraph scene;
+
+// Prototypes
+void sceneInit(void);
+void sceneFree(void);
+SceneNode *sceneInsertNode(const char *name, ComponentType type, ComponentPosition position, int z_index);
+void sceneRemoveNode(SceneNode *node);
+SceneNode *sceneFindNodeByState(const void *state);
+void sceneTouch(unsigned int domains);
+unsigned long sceneDomainEpoch(unsigned int domain);
+void sceneMarkDirty(SceneNode *node);
+void sceneRender(struct abuf *ab);
+
+#endif // KILO_SCENE_H_
@@ -0,0 +1,37 @@
+#ifndef KILO_STATUSLINE_H_
+#define KILO_STATUSLINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct abuf;
+struct LuaMemo;
+
+// One instruction of a compiled template
+typedef struct TemplateOp {
+    unsigned char code;      // TPL_* (statusline.c)
+    unsigned char arg;       // Field or colour role
+    unsigned char next_role; // Separators: role of the part that follows
+    int offset;              // Literal text: offset into the template's source
+    int len;                 // Literal text: byte length
+    int width;               // Literal text: visible width
+} TemplateOp;
+
+// A statusline/tabline template compiled from its source string
+typedef struct StatusTemplate {
+    char *source;         // Copy of the source; literals point into it
+    TemplateOp *ops;      // Instructions, in order
+    int op_count;         // 0 = no template set
+    int right_start;      // First op after %= (op_count if none)
+    bool uses_lua;        // Contains %lua (needs the Lua callback's segments)
+} StatusTemplate;
+
+extern StatusTemplate statusline_template;
+extern StatusTemplate tabline_template;
+
+// Prototypes
+int compileStatusTemplate(StatusTemplate *tpl, const char *source, char *err, size_t errlen);
+void freeStatusTemplate(StatusTemplate *tpl);
+void drawStatusTemplate(struct abuf *ab, const StatusTemplate *tpl, int width, const struct LuaMemo *dynamic);
+
+#endif // KILO_STATUSLINE_H_
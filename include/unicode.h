@@ -0,0 +1,13 @@
+#ifndef UNICODE_H
+#define UNICODE_H
+
+// True for UTF-8 continuation bytes (10xxxxxx)
+#define IS_UTF8_CONT(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+// Prototypes
+int utf8Decode(const char *s, int len, unsigned int *cp);
+int unicodeWidth(unsigned int cp);
+int calculate_visible_length_ansi(const char *s);
+int calculate_visible_prefix_ansi(const char *s, int max_width, int *width_out);
+
+#endif // UNICODE_H
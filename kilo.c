@@ -1,6 +1,8 @@
 /*** includes ***/
 #include "kilo.h"
 #include "k_lua.h"
+#include "render.h"
+#include "overlay.h"
 #include <locale.h> // Needed for setlocale()
 
 struct editorConfig E; // Global editor state instance
@@ -15,7 +17,7 @@ struct editorConfig E; // Global editor state instance
 void initEditor() {
   E.cx = 0; // Initial cursor column
   E.cy = 0; // Initial cursor row
-  E.rx = 0; // Index into the render field
+  E.rx = 0; // Screen column of the cursor (cells, see editorRowCxToRx)
   E.rowoff = 0; // Initial vertical scroll
   E.coloff = 0; // Initial horizontal scroll
   E.numrows = 0; // No rows loaded initially
@@ -53,10 +55,6 @@ void initEditor() {
     E.navigator_selected_index = 0;
     E.navigator_view_offset = 0;
 
-    // Overlay state
-    E.num_active_overlays = 0;
-    memset(E.active_overlays, 0, sizeof(E.active_overlays));
-
     char initial_cwd[PATH_MAX];
     if (getcwd(initial_cwd, PATH_MAX) != NULL) {
         E.project_root = strdup(initial_cwd);
@@ -77,9 +75,7 @@ void initEditor() {
     E.navigator_base_node = E.panel_root_node;
 
 
-  uiInitialize();
-
-  initComponentSystem();
+  initComponentSystem(); // Scene graph of components and overlays
 
   setlocale(LC_CTYPE, "");
 
@@ -87,20 +83,11 @@ void initEditor() {
   E.syntax_defs = NULL;
   E.num_syntax_defs = 0;
   loadSyntaxFiles(); // Load definitions from files
+  detectTerminalCapabilities();
+  E.color_mode = detectColorMode(); // Must be known before the theme is quantised
   loadTheme("cat_frappe"); // Load theme colours from file
   editorClearStatusMessage();
 
-
-      // Register default components
-    // Lower order numbers are drawn first (higher up for TOP, lower down for BOTTOM)
-    uiRegisterComponent("tabline",    UI_POS_TOP,    1, editorDrawTabline,    true, 10);
-    uiRegisterComponent("statusbar",  UI_POS_BOTTOM, 1, editorDrawStatusBar,  true, 10);
-    uiRegisterComponent("messagebar", UI_POS_BOTTOM, 1, editorDrawMessageBar, true, 20); // Drawn below status bar
-    // Register with a placeholder/NULL draw function, or keep editorDrawDirTreeFixed
-    // but know it won't be called via the generic loop for drawing.
-    // Using NULL makes the intent clearer. The 'name' field is important now.
-    uiRegisterComponent("fixeddirtree", UI_POS_LEFT, 0, NULL, /* Initially disabled? */ true, 10);
-
     // Get total window size
     int total_terminal_rows;
     if (getWindowSize(&total_terminal_rows, &E.screencols) == -1) die("getWindowSize");
@@ -110,12 +97,12 @@ void initEditor() {
 
 // To cleanup resources - is passed to atexit()
 void cleanupEditor(void) {
+    renderShutdown(); // Finish writing the last frame before restoring the terminal
     disableRawMode();
     free(E.project_root);
     freeComponentSystem();
     freeSyntaxDefs();
     freeThemeColors();
-    uiFreeComponents();
     free(E); // ?
 }
 
@@ -138,6 +125,7 @@ int main(int argc, char *argv[]) {
     // }
 
     enableRawMode();
+    editorInstallResizeHandler();
     atexit(cleanupEditor);
 
     initEditor();
@@ -164,6 +152,8 @@ int main(int argc, char *argv[]) {
     initLua();
     // initDebug();
 
+    renderInit(); // Frames are written by the render thread from here on
+
     // Set initial status message
     if (debug_overlay_active) {
         editorSetStatusMessage("DEBUG OVERLAY - Press Ctrl-D to dismiss");
@@ -13,6 +13,9 @@
 #include "kilo.h"
 #include "debug.h"
 #include "dirtree.h"
+#include "render.h"
+#include "luamemo.h"
+#include "statusline.h"
 
 // Forward declaration
 static int c_lua_log_message(lua_State *L);
@@ -60,6 +63,19 @@ static int c_kilo_get_component_layout(lua_State *L);
 static int c_kilo_set_component_visible(lua_State *L);
 static int c_kilo_register_component(lua_State *L);
 
+static int c_kilo_set_color_mode(lua_State *L);
+static int c_kilo_get_color_mode(lua_State *L);
+static int c_kilo_set_render_quality(lua_State *L);
+static int c_kilo_get_render_quality(lua_State *L);
+static int c_kilo_set_frame_rate(lua_State *L);
+static int c_kilo_get_frame_rate(lua_State *L);
+static int c_kilo_mark_volatile(lua_State *L);
+static int c_kilo_get_callback_stats(lua_State *L);
+static int c_kilo_set_statusline_template(lua_State *L);
+static int c_kilo_set_tabline_template(lua_State *L);
+static int c_kilo_color_id(lua_State *L);
+static int c_kilo_get_highlight_progress(lua_State *L);
+
 
 // Lua module definition
 static const struct luaL_Reg kilo_lib[] = { // Renamed for clarity
@@ -106,6 +122,19 @@ static const struct luaL_Reg kilo_lib[] = { // Renamed for clarity
     {"set_component_visible", c_kilo_set_component_visible},
     {"register_component", c_kilo_register_component},
 
+    {"set_color_mode", c_kilo_set_color_mode},
+    {"get_color_mode", c_kilo_get_color_mode},
+    {"set_render_quality", c_kilo_set_render_quality},
+    {"get_render_quality", c_kilo_get_render_quality},
+    {"set_frame_rate", c_kilo_set_frame_rate},
+    {"get_frame_rate", c_kilo_get_frame_rate},
+    {"mark_volatile", c_kilo_mark_volatile},
+    {"get_callback_stats", c_kilo_get_callback_stats},
+    {"set_statusline_template", c_kilo_set_statusline_template},
+    {"set_tabline_template", c_kilo_set_tabline_template},
+    {"color_id", c_kilo_color_id},
+    {"get_highlight_progress", c_kilo_get_highlight_progress},
+
     {NULL, NULL} /* Sentinel */
 };
 
@@ -140,6 +169,7 @@ int initLua() {
 
     // Register C library module ("kilo")
     luaL_newlib(L, kilo_lib); // Create table, register functions from kilo_lib array
+    luaMemoInstrument(L, -1); // Draw callbacks record which getters they call
     lua_setglobal(L, "kilo"); // Make the table available globally as "kilo"
     printf("[Kilo C] 'kilo' module registered.\n");
 
@@ -545,6 +575,7 @@ static int c_kilo_set_statusbar_callback(lua_State *L) {
 
     // 2. If we already have a callback registered, unreference it first
     if (statusbar_callback_ref != LUA_NOREF) {
+        luaMemoForgetCallback(statusbar_callback_ref);
         luaL_unref(L, LUA_REGISTRYINDEX, statusbar_callback_ref);
     }
 
@@ -567,6 +598,7 @@ static int c_kilo_set_tabline_callback(lua_State *L) {
 
     // 2. If we already have a callback registered, unreference it first
     if (tabline_callback_ref != LUA_NOREF) {
+        luaMemoForgetCallback(tabline_callback_ref);
         luaL_unref(L, LUA_REGISTRYINDEX, tabline_callback_ref);
     }
 
@@ -577,6 +609,7 @@ static int c_kilo_set_tabline_callback(lua_State *L) {
     // 4. Create a reference to the function (now on top) in the registry
     //    This also pops the value from the stack.
     tabline_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    sceneMarkDirty(scene.tabline); // Only redrawn on TEXT|STYLE changes otherwise
 
     return 0; // No return values to Lua
 }
@@ -588,6 +621,7 @@ static int c_kilo_set_dirtree_callback(lua_State *L) {
 
     // 2. If we already have a callback registered, unreference it first
     if (dirtree_callback_ref != LUA_NOREF) {
+        luaMemoForgetCallback(dirtree_callback_ref);
         luaL_unref(L, LUA_REGISTRYINDEX, dirtree_callback_ref);
     }
 
@@ -598,6 +632,7 @@ static int c_kilo_set_dirtree_callback(lua_State *L) {
     // 4. Create a reference to the function (now on top) in the registry
     //    This also pops the value from the stack.
     dirtree_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    sceneTouch(SCENE_DEP_TREE); // Redraw the panel and navigator (see scene.c)
 
     return 0; // No return values to Lua
 }
@@ -608,6 +643,7 @@ static int c_kilo_set_navigator_callback(lua_State *L) {
 
     // 2. If we already have a callback registered, unreference it first
     if (navigator_callback_ref != LUA_NOREF) {
+        luaMemoForgetCallback(navigator_callback_ref);
         luaL_unref(L, LUA_REGISTRYINDEX, navigator_callback_ref);
     }
 
@@ -618,6 +654,7 @@ static int c_kilo_set_navigator_callback(lua_State *L) {
     // 4. Create a reference to the function (now on top) in the registry
     //    This also pops the value from the stack.
     navigator_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    sceneTouch(SCENE_DEP_TREE);
 
     return 0; // No return values to Lua
 }
@@ -684,6 +721,7 @@ static int c_kilo_get_filetype_name(lua_State *L) {
 // Lua: kilo.open_file_buffer(filepath_string)
 static int c_kilo_open_file_buffer(lua_State *L) {
     const char *path = luaL_checkstring(L, 1);
+    sceneTouch(SCENE_DEP_TREE);
     editorBuffer *buf = NULL;
 
     // --- Find existing buffer first ---
@@ -876,6 +914,7 @@ static int c_kilo_panel_scroll(lua_State *L) {
     const char *direction = luaL_checkstring(L, 1); // Get direction arg
     DirTreeNode *node = get_current_panel_node();
     if (!node || node->num_children == 0) return 0; // No scrolling possible
+    sceneTouch(SCENE_DEP_TREE);
 
     int scroll_amount = 1; // Or page amount for pageup/down
 
@@ -902,6 +941,7 @@ static int c_kilo_panel_scroll(lua_State *L) {
 // Lua: kilo.navigator_open()
 static int c_kilo_navigator_open(lua_State *L) {
     E.navigator_active = true;
+    sceneTouch(SCENE_DEP_TREE);
     // Set base node, e.g., to current buffer's dir or project root
     if (E.current_buffer && E.current_buffer->dirname) {
          // Find/create node for dirname. Handle errors.
@@ -925,6 +965,7 @@ static int c_kilo_navigator_open(lua_State *L) {
 // Lua: kilo.navigator_close()
 static int c_kilo_navigator_close(lua_State *L) {
     E.navigator_active = false;
+    sceneTouch(SCENE_DEP_TREE);
     // Optional: free search results if they are dynamically allocated
     return 0;
 }
@@ -1000,6 +1041,7 @@ static int c_kilo_navigator_navigate(lua_State *L) {
     const char *direction = luaL_checkstring(L, 1);
     int result_count = E.navigator_base_node->num_children; // Adjust if filtering
     if (result_count == 0) return 0;
+    sceneTouch(SCENE_DEP_TREE);
 
     int scroll_amount = 1; // Add pageup/down logic
 
@@ -1026,6 +1068,7 @@ static int c_kilo_navigator_select(lua_State *L) {
          E.navigator_selected_index >= (int)E.navigator_base_node->num_children) {
          return 0; // No valid selection
      }
+     sceneTouch(SCENE_DEP_TREE);
 
      DirTreeNode *selected_node = E.navigator_base_node->children[E.navigator_selected_index];
 
@@ -1072,7 +1115,7 @@ static int c_kilo_register_component(lua_State *L) {
     const char *name = luaL_checkstring(L, 1);
     luaL_checktype(L, 2, LUA_TFUNCTION);
     
-    ComponentLayout *component = findComponent(name);
+    SceneNode *component = findComponent(name);
     if (!component) {
         lua_pushboolean(L, 0);
         return 1;
@@ -1080,6 +1123,7 @@ static int c_kilo_register_component(lua_State *L) {
     
     // If we already have a callback registered, unreference it first
     if (component->lua_callback_ref != LUA_NOREF) {
+        luaMemoForgetCallback(component->lua_callback_ref);
         luaL_unref(L, LUA_REGISTRYINDEX, component->lua_callback_ref);
     }
     
@@ -1088,6 +1132,8 @@ static int c_kilo_register_component(lua_State *L) {
     
     // Create a reference to the function in the registry
     component->lua_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    component->result_frame = 0; // Don't reuse the old callback's results
+    invalidateLayout();
     
     lua_pushboolean(L, 1);
     return 1;
@@ -1099,13 +1145,13 @@ static int c_kilo_set_component_visible(lua_State *L) {
     luaL_checktype(L, 2, LUA_TBOOLEAN);
     bool visible = lua_toboolean(L, 2);
     
-    ComponentLayout *component = findComponent(name);
+    SceneNode *component = findComponent(name);
     if (!component) {
         lua_pushboolean(L, 0);
         return 1;
     }
     
-    component->visible = visible;
+    setComponentVisible(component, visible);
     
     lua_pushboolean(L, 1);
     return 1;
@@ -1115,7 +1161,7 @@ static int c_kilo_set_component_visible(lua_State *L) {
 static int c_kilo_get_component_layout(lua_State *L) {
     const char *name = luaL_checkstring(L, 1);
     
-    ComponentLayout *component = findComponent(name);
+    SceneNode *component = findComponent(name);
     if (!component) {
         lua_pushnil(L);
         return 1;
@@ -1158,7 +1204,7 @@ static int c_kilo_get_component_layout(lua_State *L) {
 static int c_kilo_set_panel_position(lua_State *L) {
     const char *position_str = luaL_checkstring(L, 1);
     
-    ComponentLayout *panel = component_system.panel;
+    SceneNode *panel = scene.panel;
     if (!panel) {
         lua_pushboolean(L, 0);
         return 1;
@@ -1178,6 +1224,8 @@ static int c_kilo_set_panel_position(lua_State *L) {
     
     // Make panel visible
     panel->visible = true;
+    panel->dirty = true;
+    invalidateLayout();
     
     lua_pushboolean(L, 1);
     return 1;
@@ -1212,8 +1260,15 @@ static int c_kilo_create_component(lua_State *L) {
         position = POSITION_CENTER;
     }
     
+    // Get z-index if provided (floating windows go on top by default). It is
+    // needed up front because the component list is kept sorted by it.
+    int z_index = position == POSITION_FLOATING ? 10 : 0;
+    lua_getfield(L, 2, "z_index");
+    if (lua_isnumber(L, -1)) z_index = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    
     // Create the component
-    ComponentLayout *component = registerComponent(name, COMPONENT_CUSTOM, position);
+    SceneNode *component = registerComponent(name, COMPONENT_CUSTOM, position, z_index);
     if (!component) {
         lua_pushboolean(L, 0);
         return 1;
@@ -1236,11 +1291,6 @@ static int c_kilo_create_component(lua_State *L) {
     if (lua_isnumber(L, -1)) component->height = lua_tointeger(L, -1);
     lua_pop(L, 1);
     
-    // Get z-index if provided
-    lua_getfield(L, 2, "z_index");
-    if (lua_isnumber(L, -1)) component->z_index = lua_tointeger(L, -1);
-    lua_pop(L, 1);
-    
     // Check for initial visibility
     lua_getfield(L, 2, "visible");
     if (lua_isboolean(L, -1)) component->visible = lua_toboolean(L, -1);
@@ -1259,6 +1309,210 @@ static int c_kilo_create_component(lua_State *L) {
     return 1;
 }
 
+/**
+ * Lua API function: kilo.set_color_mode(mode)
+ * Overrides the colour output mode detected from $COLORTERM/$TERM.
+ * mode is "truecolor" (or "24bit"), "256" or "16". Returns true on success.
+ */
+static int c_kilo_set_color_mode(lua_State *L) {
+    const char *mode_str = luaL_checkstring(L, 1);
+    enum editorColorMode mode;
+
+    if (strcmp(mode_str, "truecolor") == 0 || strcmp(mode_str, "24bit") == 0) {
+        mode = COLOR_MODE_TRUECOLOR;
+    } else if (strcmp(mode_str, "256") == 0) {
+        mode = COLOR_MODE_256;
+    } else if (strcmp(mode_str, "16") == 0) {
+        mode = COLOR_MODE_16;
+    } else {
+        debug_printf("kilo.set_color_mode: unknown mode '%s'\n", mode_str);
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    setColorMode(mode);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// Lua API function: kilo.get_color_mode() -> "truecolor" | "256" | "16"
+static int c_kilo_get_color_mode(lua_State *L) {
+    lua_pushstring(L, colorModeName(E.color_mode));
+    return 1;
+}
+
+/**
+ * Lua API function: kilo.set_render_quality(opts)
+ * Configures adaptive render quality. All fields are optional:
+ *   enabled    - false keeps full quality regardless of output pressure
+ *   latency_ms - lower quality while average frame flush latency exceeds this
+ *   min_kbps   - ...or while write throughput drops below this (0 = ignore)
+ *   hold_ms    - minimum time between two quality drops
+ *   idle_ms    - restore full quality after this long without input
+ */
+static int c_kilo_set_render_quality(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    RenderQualityConfig cfg;
+    renderGetQualityConfig(&cfg);
+
+    lua_getfield(L, 1, "enabled");
+    if (lua_isboolean(L, -1)) cfg.enabled = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, 1, "latency_ms");
+    if (lua_isnumber(L, -1)) cfg.latency_ms = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, 1, "min_kbps");
+    if (lua_isnumber(L, -1)) cfg.min_kbps = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, 1, "hold_ms");
+    if (lua_isnumber(L, -1)) cfg.hold_ms = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, 1, "idle_ms");
+    if (lua_isnumber(L, -1)) cfg.idle_ms = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    renderSetQualityConfig(&cfg);
+    return 0;
+}
+
+// Lua API function: kilo.get_render_quality() -> "full" | "reduced" | "minimal"
+static int c_kilo_get_render_quality(lua_State *L) {
+    lua_pushstring(L, renderQualityName(E.render_quality));
+    return 1;
+}
+
+/**
+ * Lua API function: kilo.set_frame_rate(fps)
+ * Caps how often the screen is redrawn (frames per second, 0 = uncapped).
+ * The latest state is always drawn once input stops.
+ */
+static int c_kilo_set_frame_rate(lua_State *L) {
+    lua_Integer fps = luaL_checkinteger(L, 1);
+    if (fps < 0) fps = 0;
+    renderSetFrameRate((int)fps);
+    return 0;
+}
+
+// Lua API function: kilo.get_frame_rate() -> fps cap (0 = uncapped)
+static int c_kilo_get_frame_rate(lua_State *L) {
+    lua_pushinteger(L, renderGetFrameRate());
+    return 1;
+}
+
+/**
+ * Lua API function: kilo.mark_volatile()
+ * Called from a draw callback whose output depends on something the
+ * kilo.* getters don't cover (a clock, a global Lua table...): its result
+ * is not reused and it runs again on the next frame.
+ */
+static int c_kilo_mark_volatile(lua_State *L) {
+    (void)L;
+    luaMemoMarkVolatile();
+    return 0;
+}
+
+/**
+ * Lua API function: kilo.get_callback_stats()
+ * Returns a list of { name=..., hits=..., misses=..., volatile=... }, one
+ * per draw callback: hits are frames that reused its previous output,
+ * misses are frames that called it.
+ */
+static int c_kilo_get_callback_stats(lua_State *L) {
+    lua_newtable(L);
+    int index = 1;
+    for (const LuaMemo *memo = luaMemoFirst(); memo; memo = memo->next) {
+        lua_newtable(L);
+        lua_pushstring(L, memo->name);
+        lua_setfield(L, -2, "name");
+        lua_pushinteger(L, (lua_Integer)memo->hits);
+        lua_setfield(L, -2, "hits");
+        lua_pushinteger(L, (lua_Integer)memo->misses);
+        lua_setfield(L, -2, "misses");
+        lua_pushboolean(L, memo->is_volatile);
+        lua_setfield(L, -2, "volatile");
+        lua_rawseti(L, -2, index++);
+    }
+    return 1;
+}
+
+/**
+ * Lua API function: kilo.color_id(name) -> id | nil
+ * Looks up a theme colour once, so draw callbacks can pass the id to the
+ * segment builder (sb:add(text, fg_id, bg_id)) instead of a name.
+ */
+static int c_kilo_color_id(lua_State *L) {
+    int id = getThemeColorId(luaL_checkstring(L, 1));
+    if (id < 0) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, id);
+    }
+    return 1;
+}
+
+/**
+ * Lua API function: kilo.get_highlight_progress()
+ * Returns { pending=..., rows=..., idle_rows=... }: rows of the current
+ * buffer whose highlighting is still out of date, the buffer's row count,
+ * and how many rows have been brought up to date in idle time so far.
+ */
+static int c_kilo_get_highlight_progress(lua_State *L) {
+    lua_newtable(L);
+    lua_pushinteger(L, E.current_buffer ? E.current_buffer->hl_stale_rows : 0);
+    lua_setfield(L, -2, "pending");
+    lua_pushinteger(L, E.numrows);
+    lua_setfield(L, -2, "rows");
+    lua_pushinteger(L, (lua_Integer)E.hl_idle_rows);
+    lua_setfield(L, -2, "idle_rows");
+    return 1;
+}
+
+// Compiles the template at argument 1 (nil clears it).
+// Returns true, or false and an error message.
+static int setTemplate(lua_State *L, StatusTemplate *tpl, const char *api_name) {
+    if (lua_isnoneornil(L, 1)) {
+        freeStatusTemplate(tpl);
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+
+    char err[128];
+    if (compileStatusTemplate(tpl, luaL_checkstring(L, 1), err, sizeof(err)) != 0) {
+        debug_printf("%s: %s\n", api_name, err);
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/**
+ * Lua API function: kilo.set_statusline_template(template | nil)
+ * Sets a template drawn natively instead of calling Lua every frame, e.g.
+ * "%#mode# %mode %>%#file# %file%modified %= %#pos# %line:%col %percent ".
+ * See statusline.c for the directives. Returns true, or false and an error.
+ */
+static int c_kilo_set_statusline_template(lua_State *L) {
+    int results = setTemplate(L, &statusline_template, "kilo.set_statusline_template");
+    sceneMarkDirty(scene.statusbar);
+    return results;
+}
+
+// Lua API function: kilo.set_tabline_template(template | nil), e.g. "%tabs%=%#ft# %ft "
+static int c_kilo_set_tabline_template(lua_State *L) {
+    int results = setTemplate(L, &tabline_template, "kilo.set_tabline_template");
+    if (scene.tabline) {
+        // %lua output can change without the text changing
+        scene.tabline->depends = tabline_template.uses_lua ? SCENE_DEP_ALWAYS : SCENE_DEP_TEXT | SCENE_DEP_STYLE;
+        sceneMarkDirty(scene.tabline);
+    }
+    return results;
+}
 
 
 // --- Optional: Git Branch ---
@@ -0,0 +1,555 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "kilo.h"
+#include "k_lua.h"
+#include "luamemo.h"
+#include "scene.h"
+#include "render.h"
+#include "unicode.h"
+
+/**
+ * Memoised Lua draw callbacks
+ *
+ * The status bar, tabline, panel, navigator and Lua components call a Lua
+ * function to get their segments. Most of those functions only format a
+ * few pieces of editor state, so their output changes far less often than
+ * frames are drawn.
+ *
+ * While a callback runs, every kilo.* getter it calls records which kind
+ * of editor state it read (LuaMemoDep) into the memo being evaluated. The
+ * parsed result is then reused until one of those kinds changes version.
+ * Versions are derived by probing: each kind hashes the state it covers,
+ * and a changed hash bumps its version. Functions that aren't known
+ * getters (mutators, kilo.mark_volatile()) make the result volatile, so it
+ * is never reused. State read from plain Lua (os.date() for a clock) is
+ * invisible here; such callbacks should call kilo.mark_volatile().
+ */
+
+#define DEP(d) (1u << MEMO_DEP_##d)
+#define DEP_VOLATILE (1u << 31) // Never reuse a result that called this
+
+// What each kilo.* function reads. Functions not listed are volatile.
+static const struct {
+    const char *name;
+    unsigned int deps;
+} getter_deps[] = {
+    {"log_message", 0},
+    {"get_git_branch", 0},
+    {"color_id", 0}, // Ids stay valid across themes; colours are re-resolved per theme
+    {"get_mode", DEP(MODE)},
+    {"get_filename", DEP(FILE)},
+    {"get_dirname", DEP(FILE)},
+    {"get_filetype_icon", DEP(FILE)},
+    {"get_filetype_name", DEP(FILE)},
+    {"is_modified", DEP(TEXT)},
+    {"get_total_lines", DEP(TEXT)},
+    {"get_cursor_line", DEP(CURSOR)},
+    {"get_cursor_col", DEP(CURSOR)},
+    {"get_scroll_percent", DEP(CURSOR) | DEP(TEXT)},
+    {"get_text_area_content", DEP(TEXT) | DEP(SCROLL) | DEP(FILE)},
+    {"get_tabs", DEP(BUFFERS)},
+    {"get_panel_contents", DEP(TREE)},
+    {"get_panel_state", DEP(TREE)},
+    {"navigator_get_results", DEP(TREE)},
+    {"get_navigator_state", DEP(TREE)},
+    {"get_screen_size", DEP(SCREEN)},
+    {"get_component_layout", DEP(SCREEN)},
+    {"get_color_mode", DEP(SCREEN)},
+    {"get_render_quality", DEP(SCREEN)},
+    {"get_frame_rate", DEP(SCREEN)},
+};
+
+static LuaMemo *recording = NULL;  // Memo whose callback is running
+static LuaMemo *memo_list = NULL;  // Every memo evaluated so far (stats)
+
+static uint64_t probe_hash[MEMO_DEP_COUNT];
+static unsigned long dep_version[MEMO_DEP_COUNT];
+
+static uint64_t mix(uint64_t h, uint64_t v) {
+    return (h ^ v) * 1099511628211ULL; // FNV-1a prime
+}
+
+static uint64_t mixPtr(uint64_t h, const void *p) {
+    return mix(h, (uint64_t)(uintptr_t)p);
+}
+
+// Hashes the editor state covered by one dependency kind
+static uint64_t probeDep(int dep) {
+    uint64_t h = 14695981039346656037ULL;
+    switch (dep) {
+        case MEMO_DEP_CURSOR:
+            h = mix(mix(mix(h, E.cx), E.cy), E.rx);
+            break;
+        case MEMO_DEP_SCROLL:
+            h = mix(mix(mix(mix(h, E.rowoff), E.coloff), E.numrows), E.screenrows);
+            break;
+        case MEMO_DEP_TEXT:
+            // E.dirty counts edits; the row array and buffer cover loads and switches
+            h = mix(mix(h, E.dirty), E.numrows);
+            h = mixPtr(mixPtr(h, E.row), E.current_buffer);
+            break;
+        case MEMO_DEP_FILE:
+            h = mixPtr(mixPtr(mixPtr(h, E.current_buffer), E.filename), E.syntax);
+            break;
+        case MEMO_DEP_BUFFERS:
+            h = mix(mixPtr(h, E.current_buffer), E.num_buffers);
+            for (editorBuffer *b = E.buffer_list_head; b; b = b->next) {
+                h = mix(mixPtr(mixPtr(h, b), b->filename), b == E.current_buffer ? E.dirty : b->dirty);
+            }
+            break;
+        case MEMO_DEP_MODE:
+            h = mix(h, E.mode);
+            break;
+        case MEMO_DEP_SCREEN:
+            h = mix(mix(mix(mix(h, E.screencols), E.total_rows), E.screenrows), E.content_width);
+            h = mix(mix(mix(h, E.color_mode), E.render_quality), renderGetFrameRate());
+            h = mix(h, scene.layout_generation); // Component positions
+            break;
+        case MEMO_DEP_TREE:
+            h = mix(mix(h, sceneDomainEpoch(SCENE_DEP_TREE)), E.panel_visible);
+            h = mix(mix(mix(h, E.navigator_active), E.navigator_selected_index), E.navigator_view_offset);
+            h = mixPtr(h, E.navigator_base_node);
+            break;
+    }
+    return h;
+}
+
+// Current version of a dependency kind: bumped whenever its probe changes
+static unsigned long depVersion(int dep) {
+    uint64_t h = probeDep(dep);
+    if (h != probe_hash[dep]) {
+        probe_hash[dep] = h;
+        dep_version[dep]++;
+    }
+    return dep_version[dep];
+}
+
+static bool memoIsCurrent(LuaMemo *memo, int callback_ref) {
+    if (!memo->valid || memo->is_volatile || memo->callback_ref != callback_ref) return false;
+    if (memo->theme_generation != E.theme_generation) return false;
+    for (int d = 0; d < MEMO_DEP_COUNT; d++) {
+        if ((memo->deps & (1u << d)) && memo->versions[d] != depVersion(d)) return false;
+    }
+    return true;
+}
+
+// Resolves the colour value at `index`: a theme colour id (kilo.color_id()),
+// a theme colour name or a direct "#rrggbb"
+static void resolveColor(lua_State *L, int index, const char **resolved, char hex[8]) {
+    *resolved = NULL;
+    hex[0] = '\0';
+    if (lua_type(L, index) == LUA_TNUMBER) {
+        *resolved = getThemeColorById((int)lua_tointeger(L, index));
+    } else if (lua_isstring(L, index)) {
+        const char *n = lua_tostring(L, index);
+        char *t = getThemeColorByName(n);
+        if (t) *resolved = t;
+        else if (n[0] == '#') snprintf(hex, 8, "%s", n);
+    }
+}
+
+static void parseColor(lua_State *L, int table, const char *field, const char **resolved, char hex[8]) {
+    lua_getfield(L, table, field);
+    resolveColor(L, -1, resolved, hex);
+    lua_pop(L, 1);
+}
+
+static int parseInt(lua_State *L, int table, const char *field, int fallback) {
+    int value = fallback;
+    lua_getfield(L, table, field);
+    if (lua_isnumber(L, -1)) value = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return value;
+}
+
+static void clearSegments(LuaMemo *memo) {
+    memo->segment_count = 0;
+    memo->pool_len = 0;
+}
+
+// Appends a segment holding a copy of text, other fields zeroed. The
+// segment and pool arrays are kept across evaluations, so a steady state
+// allocates nothing. Returns NULL if out of memory.
+static LuaMemoSegment *pushSegment(LuaMemo *memo, const char *text, size_t len) {
+    if (memo->segment_count >= memo->segment_capacity) {
+        int new_capacity = memo->segment_capacity ? memo->segment_capacity * 2 : 16;
+        LuaMemoSegment *grown = realloc(memo->segments, sizeof(LuaMemoSegment) * new_capacity);
+        if (!grown) {
+            debug_printf("Failed to allocate memory for Lua segments");
+            return NULL;
+        }
+        memo->segments = grown;
+        memo->segment_capacity = new_capacity;
+    }
+    int needed = memo->pool_len + (int)len + 1;
+    if (needed > memo->pool_capacity) {
+        int new_capacity = memo->pool_capacity ? memo->pool_capacity : 256;
+        while (new_capacity < needed) new_capacity *= 2;
+        char *grown = realloc(memo->text_pool, new_capacity);
+        if (!grown) {
+            debug_printf("Failed to allocate memory for Lua segment text");
+            return NULL;
+        }
+        memo->text_pool = grown;
+        memo->pool_capacity = new_capacity;
+    }
+
+    LuaMemoSegment *s = &memo->segments[memo->segment_count++];
+    memset(s, 0, sizeof(*s));
+    s->text_offset = memo->pool_len;
+    memcpy(memo->text_pool + s->text_offset, text, len);
+    memo->text_pool[s->text_offset + len] = '\0';
+    memo->pool_len = needed;
+    s->len = (int)len;
+    s->width = calculate_visible_length_ansi(memo->text_pool + s->text_offset);
+    return s;
+}
+
+// Points the segments at their text once the pool has stopped moving
+static void finishSegments(LuaMemo *memo) {
+    for (int i = 0; i < memo->segment_count; i++) {
+        memo->segments[i].text = memo->text_pool + memo->segments[i].text_offset;
+    }
+}
+
+// Copies a segments table returned by the callback. Elements that aren't
+// tables or lack a text field are skipped.
+static bool parseSegments(lua_State *L, int table, LuaMemo *memo) {
+    lua_Integer count = lua_rawlen(L, table);
+    if (count < 0 || count > INT_MAX) count = 0;
+
+    for (int i = 1; i <= count; i++) {
+        lua_rawgeti(L, table, i);
+        int seg = lua_gettop(L);
+        if (!lua_istable(L, seg)) { lua_pop(L, 1); continue; }
+
+        size_t len = 0;
+        lua_getfield(L, seg, "text");
+        const char *text = lua_isstring(L, -1) ? lua_tolstring(L, -1, &len) : NULL;
+        LuaMemoSegment *s = text ? pushSegment(memo, text, len) : NULL;
+        lua_pop(L, 1); // Pop text
+        if (!s) {
+            lua_pop(L, 1);
+            if (text) return false; // Out of memory
+            continue;
+        }
+
+        parseColor(L, seg, "fg", &s->fg, s->fg_hex);
+        parseColor(L, seg, "bg", &s->bg, s->bg_hex);
+
+        lua_getfield(L, seg, "align");
+        if (lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), "right") == 0) s->align = 2;
+        lua_pop(L, 1);
+
+        s->line = parseInt(L, seg, "line", 1) - 1; // Lua is 1-based
+        s->x = parseInt(L, seg, "x", 0);
+        s->y = parseInt(L, seg, "y", 0);
+
+        lua_pop(L, 1); // Pop segment table
+    }
+    return true;
+}
+
+static void resetOptions(LuaMemo *memo) {
+    LuaMemoOptions *o = &memo->options;
+    memo->has_options = false;
+    o->x = o->y = o->width = o->height = MEMO_UNSET;
+    o->fg = o->bg = NULL;
+    o->fg_hex[0] = o->bg_hex[0] = '\0';
+}
+
+// Reads an options table; fields it doesn't have are left as they are
+static void parseOptions(lua_State *L, int table, LuaMemo *memo) {
+    LuaMemoOptions *o = &memo->options;
+    memo->has_options = true;
+    o->x = parseInt(L, table, "x", o->x);
+    o->y = parseInt(L, table, "y", o->y);
+    o->width = parseInt(L, table, "width", o->width);
+    o->height = parseInt(L, table, "height", o->height);
+
+    lua_getfield(L, table, "fg");
+    if (!lua_isnil(L, -1)) resolveColor(L, -1, &o->fg, o->fg_hex);
+    lua_getfield(L, table, "bg");
+    if (!lua_isnil(L, -1)) resolveColor(L, -1, &o->bg, o->bg_hex);
+    lua_pop(L, 2);
+}
+
+// --- SegmentBuilder ---
+//
+// Callbacks get a SegmentBuilder as their argument and can add segments
+// through it instead of returning tables:
+//
+//     function(sb)
+//         sb:add(" " .. kilo.get_mode() .. " ", mode_fg, mode_bg)
+//         sb:align("right"):add(kilo.get_cursor_line() .. " ")
+//     end
+//
+// Segments are written straight into the memo's arrays, so a frame costs
+// no Lua tables. Colours are theme colour ids (kilo.color_id()), names or
+// "#rrggbb". A single builder userdata is reused for every call.
+
+#define BUILDER_META "kilo.SegmentBuilder"
+
+// Builder state of the callback being evaluated
+typedef struct SegmentBuild {
+    LuaMemo *memo;   // NULL outside a callback
+    bool used;       // A builder method was called
+    int align, line, x, y;
+} SegmentBuild;
+
+static SegmentBuild build;
+static int builder_ref = LUA_NOREF;
+
+static SegmentBuild *checkBuilder(lua_State *L) {
+    luaL_checkudata(L, 1, BUILDER_META);
+    if (!build.memo) luaL_error(L, "SegmentBuilder used outside of a draw callback");
+    build.used = true;
+    return &build;
+}
+
+// sb:add(text [, fg [, bg]]) -> sb. Following text on the line flows after it.
+static int builderAdd(lua_State *L) {
+    SegmentBuild *b = checkBuilder(L);
+    size_t len = 0;
+    const char *text = luaL_checklstring(L, 2, &len);
+    LuaMemoSegment *s = pushSegment(b->memo, text, len);
+    if (!s) return luaL_error(L, "out of memory");
+    resolveColor(L, 3, &s->fg, s->fg_hex);
+    resolveColor(L, 4, &s->bg, s->bg_hex);
+    s->align = b->align;
+    s->line = b->line;
+    s->x = b->x;
+    s->y = b->y;
+    b->x += s->width;
+    lua_settop(L, 1);
+    return 1;
+}
+
+// sb:align("left" | "right") -> sb
+static int builderAlign(lua_State *L) {
+    SegmentBuild *b = checkBuilder(L);
+    b->align = strcmp(luaL_checkstring(L, 2), "right") == 0 ? 2 : 0;
+    lua_settop(L, 1);
+    return 1;
+}
+
+// sb:line(n) -> sb. Status bar row of the following segments (1-based).
+static int builderLine(lua_State *L) {
+    SegmentBuild *b = checkBuilder(L);
+    b->line = (int)luaL_checkinteger(L, 2) - 1;
+    lua_settop(L, 1);
+    return 1;
+}
+
+// sb:at(x, y) -> sb. Position of the next segment inside a panel or navigator.
+static int builderAt(lua_State *L) {
+    SegmentBuild *b = checkBuilder(L);
+    b->x = (int)luaL_checkinteger(L, 2);
+    b->y = (int)luaL_checkinteger(L, 3);
+    lua_settop(L, 1);
+    return 1;
+}
+
+// sb:set(option, value) -> sb. Options: x, y, width, height, fg, bg.
+static int builderSet(lua_State *L) {
+    SegmentBuild *b = checkBuilder(L);
+    const char *key = luaL_checkstring(L, 2);
+    LuaMemoOptions *o = &b->memo->options;
+    b->memo->has_options = true;
+    if (strcmp(key, "fg") == 0) resolveColor(L, 3, &o->fg, o->fg_hex);
+    else if (strcmp(key, "bg") == 0) resolveColor(L, 3, &o->bg, o->bg_hex);
+    else if (strcmp(key, "x") == 0) o->x = (int)luaL_checkinteger(L, 3);
+    else if (strcmp(key, "y") == 0) o->y = (int)luaL_checkinteger(L, 3);
+    else if (strcmp(key, "width") == 0) o->width = (int)luaL_checkinteger(L, 3);
+    else if (strcmp(key, "height") == 0) o->height = (int)luaL_checkinteger(L, 3);
+    else return luaL_error(L, "unknown option '%s'", key);
+    lua_settop(L, 1);
+    return 1;
+}
+
+static const luaL_Reg builder_methods[] = {
+    {"add", builderAdd},
+    {"align", builderAlign},
+    {"line", builderLine},
+    {"at", builderAt},
+    {"set", builderSet},
+    {NULL, NULL}
+};
+
+// Pushes the shared builder, creating it on first use
+static void pushBuilder(lua_State *L) {
+    if (builder_ref == LUA_NOREF) {
+        lua_newuserdatauv(L, 0, 0);
+        if (luaL_newmetatable(L, BUILDER_META)) {
+            luaL_newlib(L, builder_methods);
+            lua_setfield(L, -2, "__index");
+        }
+        lua_setmetatable(L, -2);
+        builder_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, builder_ref);
+}
+
+/**
+ * @brief Brings a memo up to date with its callback.
+ *
+ * Reuses the previous result if the callback is the same and none of the
+ * state it read has changed since. Otherwise calls it with the segment
+ * builder and takes its segments from the builder, or from the returned
+ * (segments, options) tables if it didn't use the builder. The parsed
+ * segments stay valid until the next evaluation of the same memo.
+ * @return false if there is no callback or it failed.
+ */
+bool luaMemoEvaluate(LuaMemo *memo, int callback_ref) {
+    lua_State *L = getLuaState();
+    if (!L || callback_ref == LUA_NOREF || callback_ref == LUA_REFNIL) return false;
+
+    if (!memo->linked) {
+        memo->next = memo_list;
+        memo_list = memo;
+        memo->linked = true;
+    }
+
+    if (memoIsCurrent(memo, callback_ref)) {
+        memo->hits++;
+        return true;
+    }
+    memo->misses++;
+    memo->valid = false;
+    memo->callback_ref = callback_ref;
+    memo->deps = 0;
+    memo->is_volatile = false;
+    clearSegments(memo);
+    resetOptions(memo);
+
+    LuaMemo *outer = recording;
+    SegmentBuild outer_build = build;
+    recording = memo;
+    build = (SegmentBuild){memo, false, 0, 0, 0, 0};
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, callback_ref);
+    pushBuilder(L);
+    int status = lua_pcall(L, 1, 2, 0);
+    bool used_builder = build.used;
+
+    recording = outer;
+    build = outer_build;
+
+    if (status != LUA_OK) {
+        const char *error_msg = lua_tostring(L, -1);
+        debug_printf("Error calling '%s' Lua callback: %s", memo->name, error_msg ? error_msg : "unknown");
+        lua_pop(L, 1); // Pop error message
+        return false;
+    }
+
+    bool ok = true;
+    if (!used_builder && lua_istable(L, -2)) {
+        ok = parseSegments(L, lua_absindex(L, -2), memo);
+        if (lua_istable(L, -1)) parseOptions(L, lua_absindex(L, -1), memo);
+    } else if (lua_istable(L, -2)) {
+        parseOptions(L, lua_absindex(L, -2), memo); // Builder callbacks may return their options
+    }
+    lua_pop(L, 2); // Pop results
+    if (!ok) return false;
+    finishSegments(memo);
+
+    for (int d = 0; d < MEMO_DEP_COUNT; d++) {
+        if (memo->deps & (1u << d)) memo->versions[d] = depVersion(d);
+    }
+    memo->theme_generation = E.theme_generation;
+    memo->valid = true;
+    return true;
+}
+
+// Frees a memo's parsed output and removes it from the stats
+void luaMemoFree(LuaMemo *memo) {
+    clearSegments(memo);
+    free(memo->segments);
+    free(memo->text_pool);
+    memo->segments = NULL;
+    memo->text_pool = NULL;
+    memo->segment_capacity = 0;
+    memo->pool_capacity = 0;
+    memo->valid = false;
+
+    if (memo->linked) {
+        for (LuaMemo **p = &memo_list; *p; p = &(*p)->next) {
+            if (*p == memo) { *p = memo->next; break; }
+        }
+        memo->linked = false;
+    }
+}
+
+// Drops the cached output of every memo of `callback_ref`. Called when the
+// callback is replaced: luaL_ref hands the freed ref straight back, so the
+// new callback would otherwise be served the old one's output.
+void luaMemoForgetCallback(int callback_ref) {
+    for (LuaMemo *m = memo_list; m; m = m->next) {
+        if (m->callback_ref == callback_ref) m->valid = false;
+    }
+}
+
+// Picks the colour to draw with: a direct hex colour, else the resolved
+// theme colour, else the caller's default
+const char *luaMemoColor(const char *resolved, const char *hex, const char *fallback) {
+    if (hex[0]) return hex;
+    return resolved ? resolved : fallback;
+}
+
+// Marks the result being evaluated as not reusable (kilo.mark_volatile())
+void luaMemoMarkVolatile(void) {
+    if (recording) recording->is_volatile = true;
+}
+
+const LuaMemo *luaMemoFirst(void) {
+    return memo_list;
+}
+
+void luaMemoTotals(unsigned long *hits, unsigned long *misses) {
+    *hits = *misses = 0;
+    for (const LuaMemo *m = memo_list; m; m = m->next) {
+        *hits += m->hits;
+        *misses += m->misses;
+    }
+}
+
+// Trampoline around a kilo.* function: records what it reads, then calls it.
+// Upvalues: the original C function and its dependency mask.
+static int trackedCall(lua_State *L) {
+    lua_CFunction func = lua_tocfunction(L, lua_upvalueindex(1));
+    unsigned int deps = (unsigned int)lua_tointeger(L, lua_upvalueindex(2));
+    if (recording) {
+        if (deps & DEP_VOLATILE) recording->is_volatile = true;
+        else recording->deps |= deps;
+    }
+    return func(L);
+}
+
+static unsigned int lookupDeps(const char *name) {
+    for (size_t i = 0; i < sizeof(getter_deps) / sizeof(getter_deps[0]); i++) {
+        if (strcmp(getter_deps[i].name, name) == 0) return getter_deps[i].deps;
+    }
+    return DEP_VOLATILE;
+}
+
+/**
+ * @brief Wraps every C function of the library table at `index` so calls
+ * made from a memoised callback record what they read.
+ */
+void luaMemoInstrument(lua_State *L, int index) {
+    index = lua_absindex(L, index);
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+        // Stack: key, value. Overwriting an existing field is allowed during lua_next.
+        if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)) {
+            const char *name = lua_tostring(L, -2);
+            lua_pushvalue(L, -1);
+            lua_pushinteger(L, lookupDeps(name));
+            lua_pushcclosure(L, trackedCall, 2);
+            lua_setfield(L, index, name);
+        }
+        lua_pop(L, 1); // Pop value, keep key for lua_next
+    }
+}
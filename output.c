@@ -7,11 +7,17 @@
 #include <time.h>
 #include <math.h> // Kept from original, check if needed
 #include <limits.h> // Kept from original, check if needed
-#include <wchar.h>  // Needed for wcwidth() and mbtowc()
+#include <stddef.h>
 
 // Kilo Project Headers
 #include "kilo.h"
 #include "k_lua.h"
+#include "render.h"
+#include "unicode.h"
+#include "overlay.h"
+#include "luamemo.h"
+#include "statusline.h"
+#include "hllayer.h"
 
 // Lua Headers
 #include <lua.h>
@@ -21,6 +27,12 @@
 // Macro to initialize an append buffer
 #define ABUF_INIT {NULL, 0}
 
+// Parsed output of the Lua draw callbacks (see luamemo.c)
+static LuaMemo statusbar_memo = LUA_MEMO_INIT("statusbar");
+static LuaMemo tabline_memo = LUA_MEMO_INIT("tabline");
+static LuaMemo dirtree_memo = LUA_MEMO_INIT("dirtree");
+static LuaMemo navigator_memo = LUA_MEMO_INIT("navigator");
+
 // --- Append Buffer Functions ---
 // (abAppend and abFree remain the same as before)
 void abAppend(struct abuf *ab, const char *s, int len) {
@@ -40,6 +52,61 @@ void abFree(struct abuf *ab) {
     free(ab->b);
 }
 
+// Appends n blank cells in the current colours, advancing the cursor.
+// Long runs use REP (CSI n b) when available; otherwise the spaces are
+// written with one realloc and a memset instead of n single-byte appends.
+void abAppendSpaces(struct abuf *ab, int n) {
+    if (n <= 0) return;
+
+    if ((E.term_caps & TERM_CAP_REP) && n > 8) {
+        char rep_buf[16];
+        int rep_len = snprintf(rep_buf, sizeof(rep_buf), " \x1b[%db", n - 1);
+        abAppend(ab, rep_buf, rep_len);
+        return;
+    }
+
+    char *new_buf = realloc(ab->b, ab->len + n);
+    if (new_buf == NULL) {
+        perror("abAppendSpaces: realloc failed");
+        return;
+    }
+    memset(new_buf + ab->len, ' ', n);
+    ab->b = new_buf;
+    ab->len += n;
+}
+
+/**
+ * @brief Fills a w x h block of cells at (x, y) with blanks in the given colours.
+ *
+ * Shared clearing primitive for the text area, panels, overlays and bars.
+ * Rows that run to the right edge of the screen are cleared with EL, other
+ * rows with ECH when the terminal supports it, and with bulk spaces
+ * otherwise. Both EL and ECH use the current background colour, so the
+ * result is the same as writing spaces. The cursor position afterwards is
+ * unspecified; callers position it before drawing again.
+ */
+void fillRect(struct abuf *ab, int x, int y, int w, int h, const char *fg, const char *bg) {
+    if (w <= 0 || h <= 0) return;
+
+    applyTrueColor(ab, fg, bg);
+
+    bool to_eol = (x + w - 1 >= E.screencols);
+    char seq_buf[48];
+    for (int r = 0; r < h; r++) {
+        int seq_len = snprintf(seq_buf, sizeof(seq_buf), "\x1b[%d;%dH", y + r, x);
+        if (to_eol) {
+            abAppend(ab, seq_buf, seq_len);
+            abAppend(ab, "\x1b[K", 3);
+        } else if (E.term_caps & TERM_CAP_ECH) {
+            seq_len += snprintf(seq_buf + seq_len, sizeof(seq_buf) - seq_len, "\x1b[%dX", w);
+            abAppend(ab, seq_buf, seq_len);
+        } else {
+            abAppend(ab, seq_buf, seq_len);
+            abAppendSpaces(ab, w);
+        }
+    }
+}
+
 
 // --- Screen Update Logic ---
 // (editorScroll remains the same)
@@ -54,67 +121,308 @@ void editorScroll() {
   if (E.rx >= E.coloff + E.screencols) E.coloff = E.rx - E.screencols + 1;
 }
 
-// (editorDrawRows remains the same)
+// Encodes the visible part of a row (colour escapes + text) into ab.
+// coloff and width are in screen cells; non-ASCII rows are walked with the
+// row's cell width map so wide characters are never split or mis-clipped.
+// `layers` (see highlightLayersForRow) are drawn over the syntax runs.
+// Returns the number of screen cells written.
+static int editorEncodeRowContent(struct abuf *ab, erow *row, int coloff, int width,
+                                  const HighlightInterval *layers, int layer_count) {
+    char *c = row->render;
+    unsigned char *cw = row->cell_width;
+    int j = 0;     // Byte index into render
+    int cells = 0; // Cells written so far
+
+    if (row->ascii) {
+        j = coloff; // One cell per byte
+    } else {
+        // Skip characters left of the scroll offset (and combining marks
+        // attached to the last of them)
+        int col = 0;
+        while (j < row->rsize && col + cw[j] <= coloff) col += cw[j++];
+        if (j < row->rsize && col < coloff) {
+            // A wide character straddles the left edge: blank its visible half
+            int visible = col + cw[j] - coloff;
+            if (visible > width) visible = width;
+            applyTrueColor(ab, E.theme.hl_normal_fg, E.theme.ui_background_bg);
+            abAppendSpaces(ab, visible);
+            cells += visible;
+            j++;
+            while (j < row->rsize && cw[j] == 0 && (c[j] & 0xC0) == 0x80) j++;
+        }
+    }
+
+    int current_applied_hl = -1;
+    // Minimal render quality keeps only search matches coloured
+    bool plain = E.render_quality >= RENDER_QUALITY_MINIMAL;
+    erowHlRun run = {0}; // Highlighting is looked up once per run
+    int run_end = 0;     // End of the part of the run no layer interval starts or ends in
+    int hl_class = HL_NORMAL;
+
+    while (j < row->rsize && cells < width) {
+        // One character: a lead byte plus its continuation bytes
+        int glyph_len = 1, glyph_width = 1;
+        if (!row->ascii) {
+            glyph_width = cw[j];
+            while (j + glyph_len < row->rsize && (c[j + glyph_len] & 0xC0) == 0x80) glyph_len++;
+            if (cells + glyph_width > width) {
+                // Wide character doesn't fit at the right edge: blank the rest
+                if (current_applied_hl != HL_NORMAL)
+                    applyTrueColor(ab, E.theme.hl_normal_fg, E.theme.ui_background_bg);
+                abAppendSpaces(ab, width - cells);
+                cells = width;
+                break;
+            }
+        }
+
+        unsigned char ch = (unsigned char)c[j];
+        if (j >= run_end) {
+            editorHighlightRunAt(row, j, &run);
+            int hl = run.hl;
+            run_end = run.end;
+            for (int k = 0; k < layer_count; k++) { // Later intervals are on top
+                if (layers[k].start <= j && j < layers[k].end) {
+                    hl = layers[k].hl;
+                    if (layers[k].end < run_end) run_end = layers[k].end;
+                } else if (layers[k].start > j && layers[k].start < run_end) {
+                    run_end = layers[k].start;
+                }
+            }
+            hl_class = (plain && hl != HL_MATCH) ? HL_NORMAL : hl;
+        }
+        if (ch < 0x80 && iscntrl(ch)) {
+            // Handle Control Chars (draw inverted)
+            char sym = (ch <= 26) ? '@' + ch : '?';
+            // Ensure default background for inverted char
+            applyTrueColor(ab, E.theme.hl_normal_fg, E.theme.ui_background_bg);
+            abAppend(ab, "\x1b[7m", 4); // Inverse video
+            abAppend(ab, &sym, 1);
+            abAppend(ab, "\x1b[m", 3);  // Reset all attributes
+            current_applied_hl = -1; // Force color re-application next
+        } else {
+            if (hl_class != current_applied_hl) {
+                // Apply Syntax Highlighting Color Change
+                current_applied_hl = hl_class;
+                char *fg = NULL, *bg = E.theme.ui_background_bg; // Default to area background
+                // Switch statement mapping the run's class to fg/bg from E.theme...
+                switch (current_applied_hl) {
+                    case HL_COMMENT:   fg = E.theme.hl_comment_fg;   /* bg = E.theme.hl_comment_bg; */   break; // Use theme BG or default?
+                    case HL_MLCOMMENT: fg = E.theme.hl_mlcomment_fg; /* bg = E.theme.hl_mlcomment_bg; */ break;
+                    case HL_KEYWORD1:  fg = E.theme.hl_keyword1_fg;  /* bg = E.theme.hl_keyword1_bg; */  break;
+                    case HL_KEYWORD2:  fg = E.theme.hl_keyword2_fg;  /* bg = E.theme.hl_keyword2_bg; */  break;
+                    case HL_KEYWORD3:  fg = E.theme.hl_keyword3_fg;  /* bg = E.theme.hl_keyword3_bg; */  break;
+                    case HL_TYPE:      fg = E.theme.hl_type_fg;      /* bg = E.theme.hl_type_bg; */      break;
+                    case HL_BUILTIN:   fg = E.theme.hl_builtin_fg;   /* bg = E.theme.hl_builtin_bg; */   break;
+                    case HL_STRING:    fg = E.theme.hl_string_fg;    /* bg = E.theme.hl_string_bg; */    break;
+                    case HL_NUMBER:    fg = E.theme.hl_number_fg;    /* bg = E.theme.hl_number_bg; */    break;
+                    case HL_MATCH:     fg = E.theme.hl_match_fg;     bg = E.theme.hl_match_bg;     break; // Match often uses explicit BG
+                    case HL_NORMAL:
+                    default:           fg = E.theme.hl_normal_fg;    bg = E.theme.ui_background_bg;    break;
+                }
+                // Use resolved background only if explicitly set by theme, else default area bg
+                char* final_bg = (bg && strcmp(bg, E.theme.ui_background_bg) != 0) ? bg : E.theme.ui_background_bg;
+                applyTrueColor(ab, fg, final_bg);
+            }
+            abAppend(ab, &c[j], glyph_len);
+        }
+        cells += glyph_width;
+        j += glyph_len;
+    }
+    return cells;
+}
+
+// Render bytes [*from, *to) shown in screen cells [coloff, coloff + width)
+// of a row, for looking up the highlight layers drawn over them
+static void editorRowVisibleBytes(const erow *row, int coloff, int width, int *from, int *to) {
+    if (row->ascii) {
+        *from = coloff < row->rsize ? coloff : row->rsize;
+        *to = coloff + width < row->rsize ? coloff + width : row->rsize;
+        return;
+    }
+    const unsigned char *cw = row->cell_width;
+    int j = 0, col = 0;
+    while (j < row->rsize && col + cw[j] <= coloff) col += cw[j++];
+    *from = j;
+    while (j < row->rsize && (col < coloff + width || cw[j] == 0)) col += cw[j++];
+    *to = j;
+}
+
+/**
+ * @brief Appends the visible, coloured part of a file row to the frame.
+ *
+ * The encoded bytes are cached on the row, keyed by the row's version, the
+ * theme generation, the highlight layers over the row, the horizontal scroll
+ * offset and the available width. Rows that have not changed since the last
+ * frame are spliced in directly instead of re-walking hl and re-emitting
+ * colour escapes.
+ * @return Number of screen cells written.
+ */
+static int editorDrawRowContent(struct abuf *ab, erow *row, int coloff, int width) {
+    erowRenderCache *cache = &row->render_cache;
+    HighlightInterval layers[HL_LAYER_ROW_MAX];
+    int from, to;
+    editorRowVisibleBytes(row, coloff, width, &from, &to);
+    int layer_count = highlightLayersForRow(E.current_buffer, row, from, to, layers, HL_LAYER_ROW_MAX);
+
+    // Rows no layer touches keep their encoding when the layers change
+    if (cache->version == row->version && row->version != 0 &&
+        cache->theme_generation == E.theme_generation &&
+        cache->layered == (layer_count > 0) &&
+        (layer_count == 0 || cache->layer_generation == E.hl_layer_generation) &&
+        cache->coloff == coloff && cache->width == width) {
+        E.render_stats.row_cache_hits++;
+        abAppend(ab, cache->bytes, cache->len);
+        return cache->cells;
+    }
+
+    E.render_stats.row_cache_misses++;
+    struct abuf encoded = ABUF_INIT;
+    int cells = editorEncodeRowContent(&encoded, row, coloff, width, layers, layer_count);
+
+    free(cache->bytes);
+    cache->bytes = encoded.b; // Cache takes ownership
+    cache->len = encoded.len;
+    cache->cells = cells;
+    cache->version = row->version;
+    cache->theme_generation = E.theme_generation;
+    cache->layer_generation = E.hl_layer_generation;
+    cache->layered = layer_count > 0;
+    cache->coloff = coloff;
+    cache->width = width;
+
+    abAppend(ab, cache->bytes, cache->len);
+    return cells;
+}
+
+// Formats the line number column for a screen row into buf (ln_width cells)
+// and returns the foreground colour to draw it in.
+static const char *editorFormatLineNumber(char *buf, size_t size, int filerow, int y,
+                                          int text_area_height, int ln_width) {
+    if (filerow < E.numrows) {
+        // Line numbers for actual file lines
+        snprintf(buf, size, "%*d ", ln_width - 1, filerow + 1);
+        return E.theme.ui_lineno_fg;
+    }
+    // Tildes or welcome message padding
+    snprintf(buf, size, "%*s", ln_width, ""); // Padding
+    // Show tilde only in the rows corresponding to empty lines after file end OR empty file screen
+    if (y >= E.numrows - E.rowoff || E.numrows == 0) {
+        // Don't show tilde on the welcome message line itself if customizing
+        if (!(E.numrows == 0 && y == text_area_height / 3)) {
+            buf[0] = '~';
+        }
+    } // Else: leave blank space
+    return E.theme.ui_tilde_fg;
+}
+
+/**
+ * @brief Draws the visible columns [span.start, span.end) of one text row.
+ *
+ * Used for rows partly hidden by opaque overlays: only the cells around the
+ * overlay are written (bypassing the row cache, whose bytes cover the full
+ * width), and the overlay layer is drawn over the gap afterwards.
+ */
+static void editorDrawRowSpan(struct abuf *ab, OverlaySpan span, int screen_row, int y, int filerow,
+                              int text_area_start_col, int ln_width, int text_area_height) {
+    char pos_buf[32];
+    snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", screen_row, span.start);
+    abAppend(ab, pos_buf, strlen(pos_buf));
+
+    int col = span.start;
+    int content_start_col_abs = text_area_start_col + ln_width;
+
+    // Visible part of the line number column
+    if (col < content_start_col_abs) {
+        char linenum[32];
+        const char *fg = editorFormatLineNumber(linenum, sizeof(linenum), filerow, y,
+                                                text_area_height, ln_width);
+        int from = col - text_area_start_col;
+        int to = (span.end < content_start_col_abs ? span.end : content_start_col_abs) - text_area_start_col;
+        applyTrueColor(ab, fg, E.theme.ui_background_bg);
+        abAppend(ab, linenum + from, to - from);
+        col = text_area_start_col + to;
+    }
+
+    // Visible part of the content, then background for the rest of the span
+    if (col < span.end) {
+        int width = span.end - col;
+        int drawn = 0;
+        if (filerow < E.numrows) {
+            erow *row = &E.row[filerow];
+            int coloff = E.coloff + (col - content_start_col_abs);
+            HighlightInterval layers[HL_LAYER_ROW_MAX];
+            int from, to;
+            editorRowVisibleBytes(row, coloff, width, &from, &to);
+            int layer_count = highlightLayersForRow(E.current_buffer, row, from, to, layers, HL_LAYER_ROW_MAX);
+            drawn = editorEncodeRowContent(ab, row, coloff, width, layers, layer_count);
+        }
+        applyTrueColor(ab, E.theme.hl_normal_fg, E.theme.ui_background_bg);
+        abAppendSpaces(ab, width - drawn);
+    }
+}
+
 // Draws rows within the specified text area boundaries
 void editorDrawRows(struct abuf *ab, int text_area_start_row, int text_area_start_col, int text_area_height, int text_area_width) {
     int y;
+    if (E.current_buffer) {
+        editorHighlightRange(E.current_buffer, E.rowoff, E.rowoff + text_area_height - 1); // Rows scrolled into view
+    }
     // Loop for the number of rows available in the calculated text area height
     for (y = 0; y < text_area_height; y++) {
         int filerow = y + E.rowoff; // Calculate the actual file row index
         int screen_row = text_area_start_row + y; // Calculate the absolute screen row
 
-        // --- Position Cursor and Clear Line within Bounds ---
-        char pos_buf[32];
-        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", screen_row, text_area_start_col);
-        abAppend(ab, pos_buf, strlen(pos_buf));
-
-        // Apply background and clear *only* the width of the text area
-        applyTrueColor(ab, NULL, E.theme.ui_background_bg); // Use theme background
-        for (int k = 0; k < text_area_width; ++k) {
-            abAppend(ab, " ", 1);
+        int ln_width = KILO_LINE_NUMBER_WIDTH;
+        if (ln_width > text_area_width) ln_width = 0; // Disable if no space
+        bool welcome_row = (filerow >= E.numrows && E.numrows == 0 && y == text_area_height / 3);
+
+        // --- Occlusion by opaque overlays ---
+        // Rows completely hidden are skipped; rows partly hidden only get
+        // the cells around the overlay. The welcome line is always drawn whole.
+        if (overlayAnyVisible() && !welcome_row) {
+            OverlaySpan spans[OVERLAY_MAX_SPANS];
+            int span_count = overlayVisibleSpans(screen_row, text_area_start_col,
+                                                 text_area_start_col + text_area_width,
+                                                 spans, OVERLAY_MAX_SPANS);
+            if (span_count == 0) {
+                E.render_stats.rows_culled++;
+                continue;
+            }
+            if (span_count > 1 || (span_count == 1 &&
+                (spans[0].start != text_area_start_col ||
+                 spans[0].end != text_area_start_col + text_area_width))) {
+                E.render_stats.rows_clipped++;
+                for (int i = 0; i < span_count; i++) {
+                    editorDrawRowSpan(ab, spans[i], screen_row, y, filerow,
+                                      text_area_start_col, ln_width, text_area_height);
+                }
+                applyThemeDefaultColor(ab);
+                continue;
+            }
         }
-        // Reposition cursor back to start column for this line after clearing
+
+        // --- Position Cursor at the start of the line ---
+        // The part of the line not covered by the line number and content is
+        // cleared with fillRect once the content has been drawn.
+        char pos_buf[32];
         snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", screen_row, text_area_start_col);
         abAppend(ab, pos_buf, strlen(pos_buf));
 
         // --- Draw Line Number (at the start of the text area) ---
-        int ln_width = KILO_LINE_NUMBER_WIDTH;
-        if (ln_width > text_area_width) ln_width = 0; // Disable if no space
-
         if (ln_width > 0) {
             char linenum[32];
-            if (filerow < E.numrows) {
-                // Line numbers for actual file lines
-                snprintf(linenum, sizeof(linenum), "%*d ", ln_width - 1, filerow + 1);
-                applyTrueColor(ab, E.theme.ui_lineno_fg, E.theme.ui_background_bg);
-                abAppend(ab, linenum, strlen(linenum));
-            } else {
-                // Tildes or welcome message padding
-                snprintf(linenum, sizeof(linenum), "%*s", ln_width, ""); // Padding
-                // Show tilde only in the rows corresponding to empty lines after file end OR empty file screen
-                if (y >= E.numrows - E.rowoff || E.numrows == 0) {
-                    // Don't show tilde on the welcome message line itself if customizing
-                     if (!(E.numrows == 0 && y == text_area_height / 3)) {
-                         linenum[0] = '~';
-                     }
-                } // Else: leave blank space
-                applyTrueColor(ab, E.theme.ui_tilde_fg, E.theme.ui_background_bg);
-                abAppend(ab, linenum, strlen(linenum));
-            }
+            const char *fg = editorFormatLineNumber(linenum, sizeof(linenum), filerow, y,
+                                                    text_area_height, ln_width);
+            applyTrueColor(ab, fg, E.theme.ui_background_bg);
+            abAppend(ab, linenum, strlen(linenum));
         }
-        // Reset color before drawing content
-        applyThemeDefaultColor(ab);
 
         // --- Calculate Content Area ---
         int content_start_col_abs = text_area_start_col + ln_width;
         int content_available_width = text_area_width - ln_width;
         if (content_available_width < 0) content_available_width = 0;
+        int content_drawn = 0; // Cells of content written on this line
 
-        // Reposition cursor after line number (if drawn)
-        if (ln_width > 0) { // Only reposition if line numbers took space
-             snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", screen_row, content_start_col_abs);
-             abAppend(ab, pos_buf, strlen(pos_buf));
-        }
         // Ensure default colors for content area
         applyTrueColor(ab, E.theme.hl_normal_fg, E.theme.ui_background_bg);
 
@@ -122,75 +430,26 @@ void editorDrawRows(struct abuf *ab, int text_area_start_row, int text_area_star
         // --- Draw Row Content / Welcome Message ---
         if (filerow >= E.numrows) {
             // Draw Welcome Message (only if file is empty)
-            if (E.numrows == 0 && y == text_area_height / 3 && content_available_width > 0) {
+            if (welcome_row && content_available_width > 0) {
                 char welcome[80];
                 int welcomelen = snprintf(welcome, sizeof(welcome),
                                           "Kilo editor -- version %s", KILO_VERSION);
                 if (welcomelen > content_available_width) welcomelen = content_available_width;
 
                 int padding = (content_available_width - welcomelen) / 2;
-                if (padding > 0) {
-                    for (int p = 0; p < padding; ++p) abAppend(ab, " ", 1);
-                }
+                abAppendSpaces(ab, padding);
                 abAppend(ab, welcome, welcomelen);
-                // Fill rest of welcome line with spaces?
-                // for (int p = padding + welcomelen; p < content_available_width; ++p) abAppend(ab, " ", 1);
+                content_drawn = (padding > 0 ? padding : 0) + welcomelen;
             }
              // Tilde drawing is handled in the line number section
         } else {
             // Draw Actual File Content
-            erow *row = &E.row[filerow];
-            int len = row->rsize - E.coloff; // Content to draw based on horizontal scroll
-            if (len < 0) len = 0;
-            // Clip length to the available width in the content area
-            if (len > content_available_width) len = content_available_width;
-
-            if (len > 0) {
-                char *c = &row->render[E.coloff];
-                unsigned char *hl = &row->hl[E.coloff];
-                int current_applied_hl = -1;
-
-                for (int j = 0; j < len; j++) {
-                    if (iscntrl(c[j])) {
-                        // Handle Control Chars (draw inverted)
-                        char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                        // Ensure default background for inverted char
-                        applyTrueColor(ab, E.theme.hl_normal_fg, E.theme.ui_background_bg);
-                        abAppend(ab, "\x1b[7m", 4); // Inverse video
-                        abAppend(ab, &sym, 1);
-                        abAppend(ab, "\x1b[m", 3);  // Reset all attributes
-                        current_applied_hl = -1; // Force color re-application next
-                    } else if (hl[j] != current_applied_hl) {
-                        // Apply Syntax Highlighting Color Change
-                         current_applied_hl = hl[j];
-                         char *fg = NULL, *bg = E.theme.ui_background_bg; // Default to area background
-                         // Switch statement mapping hl[j] to fg/bg from E.theme...
-                         switch (hl[j]) {
-                             case HL_COMMENT:   fg = E.theme.hl_comment_fg;   /* bg = E.theme.hl_comment_bg; */   break; // Use theme BG or default?
-                             case HL_MLCOMMENT: fg = E.theme.hl_mlcomment_fg; /* bg = E.theme.hl_mlcomment_bg; */ break;
-                             case HL_KEYWORD1:  fg = E.theme.hl_keyword1_fg;  /* bg = E.theme.hl_keyword1_bg; */  break;
-                             case HL_KEYWORD2:  fg = E.theme.hl_keyword2_fg;  /* bg = E.theme.hl_keyword2_bg; */  break;
-                             case HL_KEYWORD3:  fg = E.theme.hl_keyword3_fg;  /* bg = E.theme.hl_keyword3_bg; */  break;
-                             case HL_TYPE:      fg = E.theme.hl_type_fg;      /* bg = E.theme.hl_type_bg; */      break;
-                             case HL_BUILTIN:   fg = E.theme.hl_builtin_fg;   /* bg = E.theme.hl_builtin_bg; */   break;
-                             case HL_STRING:    fg = E.theme.hl_string_fg;    /* bg = E.theme.hl_string_bg; */    break;
-                             case HL_NUMBER:    fg = E.theme.hl_number_fg;    /* bg = E.theme.hl_number_bg; */    break;
-                             case HL_MATCH:     fg = E.theme.hl_match_fg;     bg = E.theme.hl_match_bg;     break; // Match often uses explicit BG
-                             case HL_NORMAL:
-                             default:           fg = E.theme.hl_normal_fg;    bg = E.theme.ui_background_bg;    break;
-                         }
-                         // Use resolved background only if explicitly set by theme, else default area bg
-                         char* final_bg = (bg && strcmp(bg, E.theme.ui_background_bg) != 0) ? bg : E.theme.ui_background_bg;
-                         applyTrueColor(ab, fg, final_bg);
-                         abAppend(ab, &c[j], 1);
-                    } else {
-                         // Character has same highlight, just append
-                         abAppend(ab, &c[j], 1);
-                    }
-                }
-            }
-            // No need to clear rest of line here, done at the start
+            content_drawn = editorDrawRowContent(ab, &E.row[filerow], E.coloff, content_available_width);
         }
+
+        // Clear whatever is left of the line in the text area background
+        fillRect(ab, content_start_col_abs + content_drawn, screen_row,
+                 content_available_width - content_drawn, 1, NULL, E.theme.ui_background_bg);
         // Reset colors before next line potentially (or rely on start of loop)
          applyThemeDefaultColor(ab);
     } // End main loop 'for y'
@@ -199,122 +458,55 @@ void editorDrawRows(struct abuf *ab, int text_area_start_row, int text_area_star
 
 // --- Status Bar Functions ---
 
-// (getThemeColorByName remains the same)
-char* getThemeColorByName(const char* name) {
-    if (!name) return NULL;
-    // Consider using a more efficient lookup (hash map?) if the number of names grows significantly.
-    char* color = NULL;
-    if (strcmp(name, "ui_background_bg") == 0) color = E.theme.ui_background_bg;
-    else if (strcmp(name, "ui_lineno_fg") == 0) color = E.theme.ui_lineno_fg;
-    else if (strcmp(name, "ui_tilde_fg") == 0) color = E.theme.ui_tilde_fg;
-    else if (strcmp(name, "ui_message_fg") == 0) color = E.theme.ui_message_fg;
-    else if (strcmp(name, "ui_message_bg") == 0) color = E.theme.ui_message_bg;
-    else if (strcmp(name, "ui_status_bg") == 0) color = E.theme.ui_status_bg;
-    else if (strcmp(name, "ui_status_fg") == 0) color = E.theme.ui_status_fg;
-    else if (strcmp(name, "ui_status_mode_fg") == 0) color = E.theme.ui_status_mode_fg;
-    else if (strcmp(name, "ui_status_mode_bg") == 0) color = E.theme.ui_status_mode_bg;
-    else if (strcmp(name, "ui_status_file_fg") == 0) color = E.theme.ui_status_file_fg;
-    else if (strcmp(name, "ui_status_file_bg") == 0) color = E.theme.ui_status_file_bg;
-    else if (strcmp(name, "ui_status_ft_fg") == 0) color = E.theme.ui_status_ft_fg;
-    else if (strcmp(name, "ui_status_ft_bg") == 0) color = E.theme.ui_status_ft_bg;
-    else if (strcmp(name, "ui_status_pos_fg") == 0) color = E.theme.ui_status_pos_fg;
-    else if (strcmp(name, "ui_status_pos_bg") == 0) color = E.theme.ui_status_pos_bg;
-    else if (strcmp(name, "ui_status_info_fg") == 0) color = E.theme.ui_status_info_fg;
-    else if (strcmp(name, "ui_status_info_bg") == 0) color = E.theme.ui_status_info_bg;
-    // Syntax highlight colors (if needed by Lua)
-    else if (strcmp(name, "hl_comment_fg") == 0) color = E.theme.hl_comment_fg;
-    else if (strcmp(name, "hl_mlcomment_fg") == 0) color = E.theme.hl_mlcomment_fg;
+// Theme colours Lua can refer to, by name or by index (kilo.color_id())
+static const struct {
+    const char *name;
+    size_t offset; // Of the char* field in editorTheme
+} theme_color_fields[] = {
+    {"ui_background_bg", offsetof(editorTheme, ui_background_bg)},
+    {"ui_lineno_fg", offsetof(editorTheme, ui_lineno_fg)},
+    {"ui_tilde_fg", offsetof(editorTheme, ui_tilde_fg)},
+    {"ui_message_fg", offsetof(editorTheme, ui_message_fg)},
+    {"ui_message_bg", offsetof(editorTheme, ui_message_bg)},
+    {"ui_status_bg", offsetof(editorTheme, ui_status_bg)},
+    {"ui_status_fg", offsetof(editorTheme, ui_status_fg)},
+    {"ui_status_mode_fg", offsetof(editorTheme, ui_status_mode_fg)},
+    {"ui_status_mode_bg", offsetof(editorTheme, ui_status_mode_bg)},
+    {"ui_status_file_fg", offsetof(editorTheme, ui_status_file_fg)},
+    {"ui_status_file_bg", offsetof(editorTheme, ui_status_file_bg)},
+    {"ui_status_ft_fg", offsetof(editorTheme, ui_status_ft_fg)},
+    {"ui_status_ft_bg", offsetof(editorTheme, ui_status_ft_bg)},
+    {"ui_status_pos_fg", offsetof(editorTheme, ui_status_pos_fg)},
+    {"ui_status_pos_bg", offsetof(editorTheme, ui_status_pos_bg)},
+    {"ui_status_info_fg", offsetof(editorTheme, ui_status_info_fg)},
+    {"ui_status_info_bg", offsetof(editorTheme, ui_status_info_bg)},
+    {"hl_comment_fg", offsetof(editorTheme, hl_comment_fg)},
+    {"hl_mlcomment_fg", offsetof(editorTheme, hl_mlcomment_fg)},
     // ... add other hl_ colors if Lua might request them by name ...
-    return color;
-}
+};
 
+#define THEME_COLOR_FIELDS (int)(sizeof(theme_color_fields) / sizeof(theme_color_fields[0]))
 
-/**
- * @brief Calculate the visible column width of a UTF-8 string, ignoring ANSI escape codes.
- *
- * This function processes a UTF-8 encoded string, skips over ANSI SGR escape
- * sequences (like colors), and uses wcwidth() to determine the column width
- * of each visible character. It requires the locale to be set correctly
- * (e.g., via setlocale(LC_CTYPE, "") in main) to handle multi-byte characters.
- *
- * @param s The null-terminated UTF-8 string to measure.
- * @return The total visible column width of the string.
- */
-int calculate_visible_length_ansi(const char *s) {
-    if (!s) return 0;
-
-    // IMPORTANT: Requires setlocale(LC_CTYPE, "") to be called previously!
-    // Reset mbtowc internal state at the beginning (good practice)
-    mbtowc(NULL, NULL, 0);
-
-    int visible_width = 0;
-    int i = 0; // Byte index into the string 's'
-    int n = strlen(s);
-
-    while (i < n) {
-        // Check for ANSI escape sequence
-        if (s[i] == '\x1b') {
-            i++; // Skip '\x1b'
-            if (i < n && s[i] == '[') { // CSI (Control Sequence Introducer)
-                i++; // Skip '['
-                // Skip parameters (digits and ';')
-                while (i < n && ((s[i] >= '0' && s[i] <= '9') || s[i] == ';')) {
-                    i++;
-                }
-                // Skip the final command character (if present)
-                if (i < n) {
-                    // Common SGR command is 'm'
-                    // Could add checks for other common CSI sequences if needed
-                    i++;
-                }
-            } else if (i < n && s[i] == ']') { // OSC (Operating System Command) - less common in status lines
-                i++; // Skip ']'
-                // Skip until BEL ('\a') or ST ('\x1b\\')
-                while (i < n && s[i] != '\a') {
-                     if (s[i] == '\x1b' && i + 1 < n && s[i+1] == '\\') {
-                         i += 2; // Skip ST
-                         break;
-                     }
-                     i++;
-                }
-                if(i < n && s[i] == '\a') i++; // Skip BEL
-            }
-             else {
-                // Other escape sequence type (less common for SGR, e.g., '\x1b' followed by a single char)
-                // Skip the next character as well
-                if (i < n) i++;
-            }
-        } else { // Not an escape sequence, process as a character
-            wchar_t wc;
-            int bytes_consumed = mbtowc(&wc, &s[i], n - i); // Pass remaining length
-
-            if (bytes_consumed > 0) { // Valid multi-byte character decoded
-                int width = wcwidth(wc);
-                if (width > 0) { // Only count printable characters with positive width
-                    visible_width += width;
-                } else if (width == 0) {
-                    // Zero-width character (e.g., combining marks), don't add width
-                } else { // width < 0 implies non-printable or error
-                    // Treat as single-width replacement? Or ignore?
-                    // Let's ignore for width calculation, like control chars.
-                }
-                i += bytes_consumed; // Advance index by number of bytes used
-            } else if (bytes_consumed == 0) {
-                 // Null terminator encountered within the string? Should not happen if n=strlen(s)
-                 // Treat as end of string for safety.
-                 break;
-            } else { // bytes_consumed < 0: Invalid UTF-8 sequence
-                // Treat the invalid byte as a single-width replacement character ('?') visually.
-                visible_width++;
-                i++; // Skip the invalid byte
-                // Reset mbtowc state after an error
-                mbtowc(NULL, NULL, 0);
-            }
-        }
+// Returns the id of a theme colour name, or -1 if there is none
+int getThemeColorId(const char* name) {
+    if (!name) return -1;
+    for (int i = 0; i < THEME_COLOR_FIELDS; i++) {
+        if (strcmp(name, theme_color_fields[i].name) == 0) return i;
     }
-    return visible_width;
+    return -1;
 }
 
+// Returns the current value of a theme colour by id (NULL if unknown or unset)
+char* getThemeColorById(int id) {
+    if (id < 0 || id >= THEME_COLOR_FIELDS) return NULL;
+    return *(char **)((char *)&E.theme + theme_color_fields[id].offset);
+}
+
+char* getThemeColorByName(const char* name) {
+    return getThemeColorById(getThemeColorId(name));
+}
+
+
 // Draw default C-based status bar (Updated to use ANSI-aware width calc)
 void editorDrawDefaultStatusBar(struct abuf *ab) {
     // --- Configuration ---
@@ -525,8 +717,7 @@ void editorDrawDefaultStatusBar(struct abuf *ab) {
      // Calculate and append padding
      applyTrueColor(ab, status_fg, status_bg); // Ensure padding uses default status colors
      int padding = E.screencols - visible_left_width - visible_right_width;
-     if (padding < 0) padding = 0; // Prevent negative padding
-     for (int i = 0; i < padding; i++) abAppend(ab, " ", 1);
+     abAppendSpaces(ab, padding);
 
      // Append the right side buffer
      abAppend(ab, sb_right.b, sb_right.len);
@@ -544,90 +735,37 @@ void editorDrawDefaultStatusBar(struct abuf *ab) {
 
 // Draw status bar using Lua configuration
 void editorDrawStatusBar(struct abuf *ab) {
-    lua_State *L = getLuaState(); // Assuming getLuaState() is defined
-
-    // Ensure statusbar_callback_ref is defined and initialized
-    if (!L || statusbar_callback_ref == LUA_NOREF) {
-        // showDebugOnError("Failed to draw status bar: Lua not ready or no callback"); // Optional debug
-        editorDrawDefaultStatusBar(ab); // Fallback
-        return;
-    }
-
-    // --- Call Lua Function ---
-    lua_rawgeti(L, LUA_REGISTRYINDEX, statusbar_callback_ref);
-    if (lua_pcall(L, 0, 2, 0) != LUA_OK) {
-        const char *error_msg = lua_tostring(L, -1);
-        debug_printf(error_msg ? error_msg : "unknown error in status bar Lua function");
-        lua_pop(L, 1); // Pop error message
-        editorDrawDefaultStatusBar(ab); // Fallback on error
+    // A template set with kilo.set_statusline_template() is drawn natively
+    if (statusline_template.op_count > 0) {
+        const LuaMemo *dynamic = NULL;
+        if (statusline_template.uses_lua && luaMemoEvaluate(&statusbar_memo, statusbar_callback_ref)) {
+            dynamic = &statusbar_memo;
+        }
+        drawStatusTemplate(ab, &statusline_template, E.screencols, dynamic);
+        abAppend(ab, "\r\n", 2);
         return;
     }
 
-    // --- Parse Lua Return Values ---
-    int segments_idx = -2;
-    int options_idx = -1;
-    int has_options = 0;
-    int top = lua_gettop(L);
-
-    if (top >= 1 && lua_istable(L, -1)) {
-        if (top >= 2 && lua_istable(L, -2)) {
-            segments_idx = -2; options_idx = -1; has_options = 1;
-        } else {
-            segments_idx = -1; options_idx = 0; has_options = 0;
-        }
-    } else {
-        debug_printf("Failed to draw status bar: Must return a table of segments");
-        lua_pop(L, top); // Clear the stack
-        editorDrawDefaultStatusBar(ab);
+    // --- Evaluate the Lua callback (reused while the state it read is unchanged) ---
+    if (!luaMemoEvaluate(&statusbar_memo, statusbar_callback_ref)) {
+        editorDrawDefaultStatusBar(ab); // Fallback on error or missing callback
         return;
     }
+    const LuaMemo *memo = &statusbar_memo;
 
     // --- Default & Parsed Options ---
     int statusbar_height = 1;
-         // --- Define Segment Colors (using theme or fallbacks) ---
-     // Helper macro for getting theme color or fallback
-     #define GET_COLOR(theme_field, fallback) (E.theme.theme_field ? E.theme.theme_field : fallback)
-
-     char *mode_fg = GET_COLOR(ui_status_mode_fg, "#000000"); // Black text
-     char *mode_bg = GET_COLOR(ui_status_mode_bg, "#98971a"); // Green bg
-     char *file_fg = GET_COLOR(ui_status_file_fg, "#ffffff"); // White text
-     char *file_bg = GET_COLOR(ui_status_file_bg, "#504945"); // Dark gray bg
-     char *ft_fg = GET_COLOR(ui_status_ft_fg, file_fg);      // Inherit from file fg
-     char *ft_bg = GET_COLOR(ui_status_ft_bg, file_bg);      // Inherit from file bg
-     char *pos_fg = GET_COLOR(ui_status_pos_fg, file_fg);      // Inherit from file fg
-     char *pos_bg = GET_COLOR(ui_status_pos_bg, "#665c54"); // Mid gray bg
-     char *info_fg = GET_COLOR(ui_status_info_fg, file_fg);     // Inherit from file fg
-     char *info_bg = GET_COLOR(ui_status_info_bg, file_bg);     // Inherit from file bg
-     char *status_bg = GET_COLOR(ui_status_bg, "#282828");   // Default status bg
-     char *status_fg = GET_COLOR(ui_status_fg, "#ebdbb2");   // Default status fg
-     char *dirty_fg = GET_COLOR(hl_keyword1_fg, "#fb4934"); // Use a highlight color for dirty indicator
+    const char *status_bg = E.theme.ui_status_bg ? E.theme.ui_status_bg : "#282828";   // Default status bg
+    const char *status_fg = E.theme.ui_status_fg ? E.theme.ui_status_fg : "#ebdbb2";   // Default status fg
 
-     #undef GET_COLOR // Undefine macro after use
-
-    if (has_options) {
-        lua_getfield(L, options_idx, "height");
-        if (lua_isnumber(L, -1)) {
-            statusbar_height = lua_tointeger(L, -1);
+    if (memo->has_options) {
+        if (memo->options.height != MEMO_UNSET) {
+            statusbar_height = memo->options.height;
             if (statusbar_height < 1) statusbar_height = 1;
             if (statusbar_height > 5) statusbar_height = 5; // Limit max height
         }
-        lua_pop(L, 1);
-
-        lua_getfield(L, options_idx, "bg");
-        if (lua_isstring(L, -1)) {
-            const char *n = lua_tostring(L, -1);
-            char* t = getThemeColorByName(n); // Check theme map first
-            if(t) status_bg = t; else if(n[0] == '#') status_bg = (char*)n; // Allow direct hex
-        }
-        lua_pop(L, 1);
-
-        lua_getfield(L, options_idx, "fg");
-        if (lua_isstring(L, -1)) {
-            const char *n = lua_tostring(L, -1);
-            char* t = getThemeColorByName(n);
-            if(t) status_fg = t; else if(n[0] == '#') status_fg = (char*)n;
-        }
-        lua_pop(L, 1);
+        status_bg = luaMemoColor(memo->options.bg, memo->options.bg_hex, status_bg);
+        status_fg = luaMemoColor(memo->options.fg, memo->options.fg_hex, status_fg);
     }
 
     // Clamp statusbar height based on available screen rows
@@ -636,123 +774,33 @@ void editorDrawStatusBar(struct abuf *ab) {
         if (statusbar_height < 1) statusbar_height = 1; // Ensure at least 1 if possible
     }
 
-    // Define structure for collected segment data
-    typedef struct {
-        const char *text; // Pointer to Lua string (includes ANSI)
-        char *fg;
-        char *bg;
-        int width;       // Visual width (ANSI stripped)
-        int alignment;   // 0=left, 1=center(unused), 2=right
-    } SegmentData;
-
     // --- Loop Through Each Status Bar Line ---
     for (int line_idx = 0; line_idx < statusbar_height; line_idx++) {
-
-        // --- Collect Segments for this specific line ---
-        lua_Integer segment_count_raw = lua_rawlen(L, segments_idx);
-        if (segment_count_raw > INT_MAX || segment_count_raw < 0) { // Added check for negative result
-             debug_printf("Failed to draw status bar: Invalid segment count from Lua");
-             segment_count_raw = 0; // Treat as zero segments
-        }
-        int segment_count = (int)segment_count_raw;
-
-        // Use dynamic allocation, check for failure
-        SegmentData *line_segments = NULL; // Initialize to NULL
-        if (segment_count > 0) { // Avoid malloc(0) if Lua returns empty table
-             line_segments = malloc(sizeof(SegmentData) * segment_count);
-             if (!line_segments) {
-                 debug_printf("Failed to draw status bar: Status bar segment memory allocation failed");
-                 // Clean up Lua stack before returning
-                 lua_pop(L, has_options ? 2 : 1);
-                 editorDrawDefaultStatusBar(ab); // Attempt fallback drawing
-                 return; // Exit the function
-             }
-        }
-
-        int line_segment_idx = 0; // Index within line_segments for the current line
-        int total_left_width = 0;
         int total_right_width = 0;
+        for (int i = 0; i < memo->segment_count; i++) {
+            if (memo->segments[i].line == line_idx && memo->segments[i].align == 2) {
+                total_right_width += memo->segments[i].width;
+            }
+        }
 
-        // Iterate through all segments returned by Lua to collect data for the current line
-        for (int i = 1; i <= segment_count; i++) {
-            lua_rawgeti(L, segments_idx, i);
-            if (!lua_istable(L, -1)) { lua_pop(L, 1); continue; } // Skip non-tables
-
-            // Check segment line number
-            int segment_line_num = 0; // Default to line index 0 (first line)
-            lua_getfield(L, -1, "line");
-            if (lua_isnumber(L, -1)) segment_line_num = lua_tointeger(L, -1) - 1; // Lua is 1-based
-            lua_pop(L, 1);
-
-            // Only collect segments for the current line being drawn
-            if (segment_line_num != line_idx) { lua_pop(L, 1); continue; }
-
-            // Get mandatory segment text
-            const char *text = NULL;
-            lua_getfield(L, -1, "text");
-            if (lua_isstring(L, -1)) text = lua_tostring(L, -1);
-            lua_pop(L, 1);
-            if (!text) { lua_pop(L, 1); continue; } // Skip segments without text
-
-            // Get optional fg/bg colors
-            const char *fg_name = NULL, *bg_name = NULL;
-            lua_getfield(L, -1, "fg"); if (lua_isstring(L, -1)) fg_name = lua_tostring(L, -1); lua_pop(L, 1);
-            lua_getfield(L, -1, "bg"); if (lua_isstring(L, -1)) bg_name = lua_tostring(L, -1); lua_pop(L, 1);
-
-            // Resolve colors
-            char* fg_color = status_fg; // Start with line default
-            if (fg_name) { char* t = getThemeColorByName(fg_name); if(t) fg_color = t; else if(fg_name[0] == '#') fg_color = (char*)fg_name; }
-            char* bg_color = status_bg; // Start with line default
-            if (bg_name) { char* t = getThemeColorByName(bg_name); if(t) bg_color = t; else if(bg_name[0] == '#') bg_color = (char*)bg_name; }
-
-            // Get optional alignment
-            int alignment = 0; // Default left
-            lua_getfield(L, -1, "align");
-            if (lua_isstring(L, -1)) { if (strcmp(lua_tostring(L, -1), "right") == 0) alignment = 2; }
-            lua_pop(L, 1);
-
-            // Calculate visual width (ensure calculate_visible_length_ansi exists and works correctly)
-            // ASSUMPTION: calculate_visible_length_ansi handles NULL input gracefully (returns 0).
-            int visual_width = calculate_visible_length_ansi(text);
-
-            // Store segment data for rendering pass (check index bounds)
-            // line_segment_idx should be < segment_count if malloc succeeded and loop runs
-            line_segments[line_segment_idx].text = text;
-            line_segments[line_segment_idx].fg = fg_color;
-            line_segments[line_segment_idx].bg = bg_color;
-            line_segments[line_segment_idx].width = visual_width;
-            line_segments[line_segment_idx].alignment = alignment;
-
-            // Accumulate widths based on alignment
-            if (alignment == 0) total_left_width += visual_width;
-            else if (alignment == 2) total_right_width += visual_width;
-
-            line_segment_idx++;
-
-            lua_pop(L, 1); // Pop the segment table
-        } // --- End segment data collection loop ---
-
-        // --- Render the status line using collected data ---
+        // --- Render the status line ---
         applyTrueColor(ab, status_fg, status_bg); // Set default background/foreground for the line
         abAppend(ab, "\x1b[K", 3);               // Clear line with these default colors
 
         int left_render_end_col = 0; // Track visual column position *after* rendering left segments (0-based)
 
         // Render Left-Aligned Segments
-        if (line_segments) { // Check if segments were allocated
-             for (int i = 0; i < line_segment_idx; i++) {
-                 if (line_segments[i].alignment == 0) { // Left aligned
-                     if (left_render_end_col + line_segments[i].width <= E.screencols) {
-                         applyTrueColor(ab, line_segments[i].fg, line_segments[i].bg);
-                         abAppend(ab, line_segments[i].text, strlen(line_segments[i].text));
-                         left_render_end_col += line_segments[i].width;
-                     } else { break; } // Stop if segment doesn't fit
-                 }
-             }
+        for (int i = 0; i < memo->segment_count; i++) {
+            const LuaMemoSegment *seg = &memo->segments[i];
+            if (seg->line != line_idx || seg->align != 0) continue;
+            if (left_render_end_col + seg->width > E.screencols) break; // Stop if segment doesn't fit
+            applyTrueColor(ab, luaMemoColor(seg->fg, seg->fg_hex, status_fg), luaMemoColor(seg->bg, seg->bg_hex, status_bg));
+            abAppend(ab, seg->text, seg->len);
+            left_render_end_col += seg->width;
         }
 
         // Render Right-Aligned Segments using absolute positioning
-        if (line_segments && total_right_width > 0 && E.screencols > 0) {
+        if (total_right_width > 0 && E.screencols > 0) {
             // Calculate target start column (1-based for \x1b[...G)
             int right_start_col = E.screencols - total_right_width + 1;
 
@@ -766,35 +814,23 @@ void editorDrawStatusBar(struct abuf *ab) {
 
                 int current_right_col = right_start_col; // Track columns for right segments (1-based)
 
-                for (int i = 0; i < line_segment_idx; i++) {
-                    if (line_segments[i].alignment == 2) { // Right aligned
-                        // Check if segment fits: end column <= screen width
-                        if (current_right_col + line_segments[i].width - 1 <= E.screencols) {
-                            applyTrueColor(ab, line_segments[i].fg, line_segments[i].bg);
-                            abAppend(ab, line_segments[i].text, strlen(line_segments[i].text));
-                            current_right_col += line_segments[i].width;
-                        } else { break; } // Stop if segment doesn't fit
-                    }
+                for (int i = 0; i < memo->segment_count; i++) {
+                    const LuaMemoSegment *seg = &memo->segments[i];
+                    if (seg->line != line_idx || seg->align != 2) continue;
+                    // Check if segment fits: end column <= screen width
+                    if (current_right_col + seg->width - 1 > E.screencols) break;
+                    applyTrueColor(ab, luaMemoColor(seg->fg, seg->fg_hex, status_fg), luaMemoColor(seg->bg, seg->bg_hex, status_bg));
+                    abAppend(ab, seg->text, seg->len);
+                    current_right_col += seg->width;
                 }
             } // else: Right segments would overlap or touch left segments, skipped.
         }
 
-        // Reset colors at the very end of the line drawing (maybe redundant if applyThemeDefaultColor does it)
-        // applyTrueColor(ab, status_fg, status_bg); // Or just reset fully:
         applyThemeDefaultColor(ab); // Should reset SGR attributes
-
-        // Free collected segment data for this line (if allocated)
-        free(line_segments); // free(NULL) is safe.
-
     } // --- End loop through status bar lines ---
 
     // Add required newline after the status bar content (before message bar)
     abAppend(ab, "\r\n", 2);
-
-    // Pop Lua return values from the stack
-    lua_pop(L, has_options ? 2 : 1);
-
-    // applyThemeDefaultColor(ab); // Usually done AFTER the message bar in editorRefreshScreen
 }
 
 
@@ -889,11 +925,7 @@ void editorDrawDefaultTabline(struct abuf *ab) {
         // Fill remaining space in the tab slot
         // Note: Using byte length `total_len`. If using multi-byte chars, a visual width calculation would be more accurate.
         int remaining_width = tab_width - total_len;
-        if (remaining_width < 0) remaining_width = 0;
-
-        for (int k = 0; k < remaining_width; k++) {
-             abAppend(ab, " ", 1); // Fill with spaces using current tab color
-        }
+        abAppendSpaces(ab, remaining_width); // Fill with spaces using current tab color
 
         i++; // Increment buffer index counter
 
@@ -908,172 +940,54 @@ void editorDrawDefaultTabline(struct abuf *ab) {
 
 /**
  * @brief Draws the tabline, attempting to use Lua configuration first.
- * Parses segment tables returned by Lua, similar to editorDrawStatusBar.
+ * Draws the segments returned by Lua, similar to editorDrawStatusBar.
  * Falls back to C implementation if Lua is unavailable or fails.
  * @param ab The append buffer to draw into.
  */
 void editorDrawTabline(struct abuf *ab) {
-    typedef struct {
-    const char *text; // Pointer to Lua string (valid during render)
-    char *fg;         // Resolved color string
-    char *bg;         // Resolved color string
-    int width;        // Calculated visual width
-    } TabSegmentData;
-
-    lua_State *L = getLuaState();
-
-    // Check if Lua is configured and ready for tabline
-    if (!L || tabline_callback_ref == LUA_NOREF || tabline_callback_ref == LUA_REFNIL) {
-        editorDrawDefaultTabline(ab); // Use C implementation
-        return;
-    }
-
-    // --- Call Lua Function ---
-    lua_rawgeti(L, LUA_REGISTRYINDEX, tabline_callback_ref);
-
-    // Call Lua function: 0 arguments, expect 2 return values (segments, options)
-    if (lua_pcall(L, 0, 2, 0) != LUA_OK) {
-        const char *error_msg = lua_tostring(L, -1);
-        debug_printf(error_msg ? error_msg : "unknown error in tabline Lua function");
-        lua_pop(L, 1); // Pop error message
-        editorDrawDefaultTabline(ab); // Fallback on error
+    // A template set with kilo.set_tabline_template() is drawn natively
+    if (tabline_template.op_count > 0) {
+        const LuaMemo *dynamic = NULL;
+        if (tabline_template.uses_lua && luaMemoEvaluate(&tabline_memo, tabline_callback_ref)) {
+            dynamic = &tabline_memo;
+        }
+        drawStatusTemplate(ab, &tabline_template, E.screencols, dynamic);
+        abAppend(ab, "\r\n", 2);
         return;
     }
 
-    // --- Parse Lua Return Values ---
-    // Use similar logic as status bar to find segments/options tables on stack
-    int segments_idx = -2;
-    int options_idx = -1;
-    int has_options = 0;
-    int top = lua_gettop(L);
-
-    if (top >= 1 && lua_istable(L, -1)) { // Check top value (options)
-        if (top >= 2 && lua_istable(L, -2)) { // Check value below (segments)
-            segments_idx = -2; options_idx = -1; has_options = 1;
-        } else { // Only one table returned, assume it's segments
-            segments_idx = -1; options_idx = 0; has_options = 0;
-        }
-    } else {
-        debug_printf("Tabline Lua function must return a table (list) of segments");
-        lua_pop(L, top); // Clear the stack
-        editorDrawDefaultTabline(ab);
+    // Evaluate the Lua callback (reused while the state it read is unchanged)
+    if (!luaMemoEvaluate(&tabline_memo, tabline_callback_ref)) {
+        editorDrawDefaultTabline(ab); // Use C implementation
         return;
     }
+    const LuaMemo *memo = &tabline_memo;
 
     // --- Default & Parsed Options ---
     // Get defaults from theme or hardcoded values
-    char *default_tab_bg = E.theme.ui_status_bg ? E.theme.ui_status_bg : "#282828";
-    char *default_tab_fg = E.theme.ui_status_fg ? E.theme.ui_status_fg : "#ebdbb2";
-    // int tabline_height = 1; // Default height (might parse from options)
-
-    if (has_options) {
-        // Optionally parse "height", "bg", "fg" from options_idx table
-        // Remember to pop values retrieved from the options table.
-        // Example for background:
-        lua_getfield(L, options_idx, "bg");
-        if (lua_isstring(L, -1)) {
-            const char *n = lua_tostring(L, -1);
-            char* t = getThemeColorByName(n);
-            if(t) default_tab_bg = t; else if(n[0] == '#') default_tab_bg = (char*)n;
-        }
-        lua_pop(L, 1);
-        // Add similar for "fg", "height" if needed
-    }
-
-    // --- Collect Segment Data ---
-    lua_Integer segment_count_raw = lua_rawlen(L, segments_idx);
-    if (segment_count_raw > INT_MAX || segment_count_raw < 0) {
-        debug_printf("Invalid segment count from Lua for tabline");
-        segment_count_raw = 0;
-    }
-    int segment_count = (int)segment_count_raw;
-
-    TabSegmentData *tabs = NULL; // Array to hold parsed C data
-    if (segment_count > 0) {
-        tabs = malloc(sizeof(TabSegmentData) * segment_count);
-        if (!tabs) {
-            debug_printf("Failed to allocate memory for tabline segments");
-            lua_pop(L, has_options ? 2 : 1); // Pop Lua return values before falling back
-            editorDrawDefaultTabline(ab);
-            return;
-        }
+    const char *default_tab_bg = E.theme.ui_status_bg ? E.theme.ui_status_bg : "#282828";
+    const char *default_tab_fg = E.theme.ui_status_fg ? E.theme.ui_status_fg : "#ebdbb2";
+    if (memo->has_options) {
+        default_tab_bg = luaMemoColor(memo->options.bg, memo->options.bg_hex, default_tab_bg);
     }
 
-    int collected_tab_count = 0; // Track valid segments collected
-    for (int i = 1; i <= segment_count; i++) {
-        lua_rawgeti(L, segments_idx, i);
-        if (!lua_istable(L, -1)) { // *** Check if element is a TABLE ***
-            debug_printf("Tabline Lua function returned non-table element at index %d", i);
-            lua_pop(L, 1); continue; // Skip this element
-        }
-
-        // Get mandatory segment text
-        const char *text = NULL;
-        lua_getfield(L, -1, "text");
-        if (lua_isstring(L, -1)) text = lua_tostring(L, -1);
-        lua_pop(L, 1);
-        if (!text) {
-            debug_printf("Tabline segment at index %d missing 'text' field", i);
-            lua_pop(L, 1); continue; // Skip segment without text
-        }
-
-        // Get optional fg/bg colors
-        const char *fg_name = NULL, *bg_name = NULL;
-        lua_getfield(L, -1, "fg"); if (lua_isstring(L, -1)) fg_name = lua_tostring(L, -1); lua_pop(L, 1);
-        lua_getfield(L, -1, "bg"); if (lua_isstring(L, -1)) bg_name = lua_tostring(L, -1); lua_pop(L, 1);
-
-        // Resolve colors using tabline defaults
-        char* fg_color = default_tab_fg;
-        if (fg_name) { char* t = getThemeColorByName(fg_name); if(t) fg_color = t; else if(fg_name[0] == '#') fg_color = (char*)fg_name; }
-        char* bg_color = default_tab_bg;
-        if (bg_name) { char* t = getThemeColorByName(bg_name); if(t) bg_color = t; else if(bg_name[0] == '#') bg_color = (char*)bg_name; }
-
-        // Calculate visual width
-        int visual_width = calculate_visible_length_ansi(text);
-
-        // Store parsed segment data
-        // NOTE: `tabs[collected_tab_count].text` points to Lua's memory.
-        // This is okay for immediate rendering, but don't store it long-term without copying.
-        tabs[collected_tab_count].text = text;
-        tabs[collected_tab_count].fg = fg_color;
-        tabs[collected_tab_count].bg = bg_color;
-        tabs[collected_tab_count].width = visual_width;
-        collected_tab_count++;
-
-        lua_pop(L, 1); // Pop the segment table
-    } // --- End segment data collection loop ---
-
-
     // --- Render the Tabline Line ---
     applyTrueColor(ab, default_tab_fg, default_tab_bg);
     abAppend(ab, "\x1b[K", 3); // Clear line with default background
 
     int current_visual_width = 0;
-    if (tabs) { // Check if tabs array was allocated
-        for (int i = 0; i < collected_tab_count; i++) {
-            // Check if segment fits on screen
-            if (current_visual_width + tabs[i].width <= E.screencols) {
-                applyTrueColor(ab, tabs[i].fg, tabs[i].bg);
-                // Use strlen to get byte length for abAppend
-                abAppend(ab, tabs[i].text, strlen(tabs[i].text));
-                current_visual_width += tabs[i].width;
-            } else {
-                // Not enough space, stop rendering segments
-                break;
-            }
-        }
+    for (int i = 0; i < memo->segment_count; i++) {
+        const LuaMemoSegment *seg = &memo->segments[i];
+        // Check if segment fits on screen
+        if (current_visual_width + seg->width > E.screencols) break; // Not enough space
+        applyTrueColor(ab, luaMemoColor(seg->fg, seg->fg_hex, default_tab_fg), luaMemoColor(seg->bg, seg->bg_hex, default_tab_bg));
+        abAppend(ab, seg->text, seg->len);
+        current_visual_width += seg->width;
     }
 
-    // Optionally: Fill remaining space on the line with default background
+    // Fill remaining space on the line with default background
     applyTrueColor(ab, default_tab_fg, default_tab_bg);
-    while (current_visual_width < E.screencols) {
-        abAppend(ab, " ", 1);
-        current_visual_width++;
-    }
-
-    // Clean up allocated C memory and Lua stack
-    free(tabs); // free(NULL) is safe
-    lua_pop(L, has_options ? 2 : 1); // Pop Lua return values (segments table, options table)
+    abAppendSpaces(ab, E.screencols - current_visual_width);
 
     // Reset terminal colors and add newline
     applyThemeDefaultColor(ab);
@@ -1085,423 +999,138 @@ void editorDrawTabline(struct abuf *ab) {
 // Called by editorRefreshScreen when panel is registered and E.panel_mode is LEFT/RIGHT
 void editorDrawDirTreeFixed(struct abuf *ab, int panel_x, int panel_y, int panel_w, int panel_h) {
     // Basic checks - Use the *global* callback ref
-    if (!E.panel_visible || dirtree_callback_ref == LUA_NOREF || dirtree_callback_ref == LUA_REFNIL) {
-        return;
-    }
-    lua_State *L = getLuaState();
-    if (!L) return;
+    if (!E.panel_visible) return;
 
-    // --- Call Lua ---
-    lua_rawgeti(L, LUA_REGISTRYINDEX, dirtree_callback_ref);
-    // 0 args, expect 1 return: segments table
-    if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
-        const char *error_msg = lua_tostring(L, -1);
-        debug_printf("Fixed Panel Lua Error: %s", error_msg ? error_msg : "unknown");
-        lua_pop(L, 1);
-        return;
-     }
-
-    // --- Process Segments ---
-    if (!lua_istable(L, -1)) {
-        debug_printf("Fixed Panel Lua function must return a table of segments");
-        lua_pop(L, 1);
-        return;
-    }
+    // --- Evaluate Lua (reused while the state it read is unchanged) ---
+    if (!luaMemoEvaluate(&dirtree_memo, dirtree_callback_ref)) return;
+    const LuaMemo *memo = &dirtree_memo;
 
     // Get default colors
-    char* panel_default_fg = E.theme.hl_normal_fg ? E.theme.hl_normal_fg : "#ffffff"; // Provide fallbacks
-    char* panel_default_bg = E.theme.ui_background_bg ? E.theme.ui_background_bg : "#000000";
+    const char* panel_default_fg = E.theme.hl_normal_fg ? E.theme.hl_normal_fg : "#ffffff"; // Provide fallbacks
+    const char* panel_default_bg = E.theme.ui_background_bg ? E.theme.ui_background_bg : "#000000";
 
     // Clear panel area background (optional but recommended for fixed panels)
-    applyTrueColor(ab, panel_default_fg, panel_default_bg);
-    for (int r = 0; r < panel_h; ++r) {
-        char pos_buf[32];
-        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", panel_y + r, panel_x);
-        abAppend(ab, pos_buf, strlen(pos_buf));
-        for (int c = 0; c < panel_w; ++c) abAppend(ab, " ", 1);
-    }
-
-    // Render segments sequentially top-to-bottom
-    lua_Integer segment_count_raw = lua_rawlen(L, -1);
-    int segment_count = (segment_count_raw > 0 && segment_count_raw < INT_MAX) ? (int)segment_count_raw : 0;
-    int current_panel_line = 0; // Relative line within panel (0-based)
-
-    for (int i = 1; i <= segment_count; i++) {
-        // Stop if panel height reached
-        if (current_panel_line >= panel_h) break;
-
-        lua_rawgeti(L, -1, i); // Get segment table at index i from segments table at top stack (-1)
-        if (!lua_istable(L, -1)) { lua_pop(L, 1); continue; } // Skip non-table segment
-
-        // Get text (Mandatory)
-        const char *text = NULL;
-        lua_getfield(L, -1, "text");
-        if (lua_isstring(L, -1)) text = lua_tostring(L, -1);
-        lua_pop(L, 1);
-        if (!text) { lua_pop(L, 1); continue; } // Skip segment without text
-
-        // Get optional fg/bg
-        const char *fg_name = NULL, *bg_name = NULL;
-        lua_getfield(L, -1, "fg"); if (lua_isstring(L, -1)) fg_name = lua_tostring(L, -1); lua_pop(L, 1);
-        lua_getfield(L, -1, "bg"); if (lua_isstring(L, -1)) bg_name = lua_tostring(L, -1); lua_pop(L, 1);
-
-        // Resolve colors
-        char* fg_color = panel_default_fg;
-        char* bg_color = panel_default_bg;
-        // Assuming getThemeColorByName helper exists
-        if (fg_name) { char* t = getThemeColorByName(fg_name); if(t) fg_color = t; else if(fg_name[0] == '#') fg_color = (char*)fg_name; }
-        if (bg_name) { char* t = getThemeColorByName(bg_name); if(t) bg_color = t; else if(bg_name[0] == '#') bg_color = (char*)bg_name; }
+    fillRect(ab, panel_x, panel_y, panel_w, panel_h, panel_default_fg, panel_default_bg);
 
-        // --- Draw Segment Sequentially ---
-        int abs_row = panel_y + current_panel_line;
-        int abs_col = panel_x;
-        int available_width = panel_w;
+    // Render segments sequentially top-to-bottom, one per line, until the panel is full
+    for (int i = 0; i < memo->segment_count && i < panel_h; i++) {
+        const LuaMemoSegment *seg = &memo->segments[i];
 
         // Position Cursor
         char pos_buf[32];
-        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", abs_row, abs_col);
+        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", panel_y + i, panel_x);
         abAppend(ab, pos_buf, strlen(pos_buf));
         // Set Colors
-        applyTrueColor(ab, fg_color, bg_color);
+        applyTrueColor(ab, luaMemoColor(seg->fg, seg->fg_hex, panel_default_fg),
+                       luaMemoColor(seg->bg, seg->bg_hex, panel_default_bg));
         // Append Text (Clip)
-        int text_len = strlen(text);
-        int len_to_draw = (text_len > available_width) ? available_width : text_len;
+        int len_to_draw = (seg->len > panel_w) ? panel_w : seg->len;
         if (len_to_draw < 0) len_to_draw = 0;
-        abAppend(ab, text, len_to_draw);
-        // Clear rest of line within panel (optional)
-        // applyTrueColor(ab, panel_default_fg, panel_default_bg);
-        // for(int k=len_to_draw; k < available_width; ++k) abAppend(ab, " ", 1);
+        abAppend(ab, seg->text, len_to_draw);
+    }
 
+    applyThemeDefaultColor(ab); // Reset color
+}
 
-        current_panel_line++; // Move to next line for next segment
-        lua_pop(L, 1); // Pop segment table value
-    } // End segment loop
+// Draws a floating element from a memoised callback result: the options
+// place it (x/y/width/height, defaulting to the given rectangle) and each
+// segment is positioned by its x/y relative to the element. Reports the
+// final rectangle for the overlay `state`.
+static void drawFloatingSegments(struct abuf *ab, void *state, const LuaMemo *memo,
+                                 int x, int y, int w, int h, const char *default_fg, const char *default_bg) {
+    const LuaMemoOptions *o = &memo->options;
+    if (o->x != MEMO_UNSET) x = o->x;
+    if (o->y != MEMO_UNSET) y = o->y;
+    if (o->width != MEMO_UNSET) w = o->width;
+    if (o->height != MEMO_UNSET) h = o->height;
+    default_bg = luaMemoColor(o->bg, o->bg_hex, default_bg);
+    default_fg = luaMemoColor(o->fg, o->fg_hex, default_fg);
 
-    // --- Cleanup ---
-    lua_pop(L, 1); // Pop the main segments table
-    applyThemeDefaultColor(ab); // Reset color
+    // Clamp/validate x, y, w, h to screen bounds
+    if (x < 1) x = 1;
+    if (y < 1) y = 1; // Allow drawing anywhere on screen for overlays
+    if (w <= 0) w = 1;
+    if (h <= 0) h = 1;
+    if (x + w > E.screencols + 1) w = E.screencols - x + 1;
+    if (y + h > E.total_rows + 1) h = E.total_rows - y + 1;
+
+    // Draw background/border (optional)
+    fillRect(ab, x, y, w, h, default_fg, default_bg);
+    editorOverlayReportRect(state, x, y, w, h);
+
+    for (int i = 0; i < memo->segment_count; i++) {
+        const LuaMemoSegment *seg = &memo->segments[i];
+        int abs_row = y + seg->y;
+        int abs_col = x + seg->x;
+        int available_width = w - seg->x;
+
+        // Check bounds & Draw segment
+        if (abs_row >= y && abs_row < y + h &&
+            abs_col >= x && abs_col < x + w &&
+            available_width > 0) // Check if there's actually space to draw at this col
+        {
+            char pos_buf[32];
+            snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", abs_row, abs_col);
+            abAppend(ab, pos_buf, strlen(pos_buf));
+            applyTrueColor(ab, luaMemoColor(seg->fg, seg->fg_hex, default_fg),
+                           luaMemoColor(seg->bg, seg->bg_hex, default_bg));
+            int len_to_draw = (seg->len > available_width) ? available_width : seg->len;
+            abAppend(ab, seg->text, len_to_draw);
+        }
+    }
+
+    applyThemeDefaultColor(ab);
 }
 
 // Draws the panel as a floating overlay
 // Called by the overlay system loop in editorRefreshScreen
 void editorDrawDirTreeFloating(struct abuf *ab, void *state /* DirTreeState* */) {
-    // Use the state parameter (mark as used for now)
-    DirTreeState *pstate = (DirTreeState*)state;
-    (void)pstate; // Suppress unused warning until pstate fields are used
-
-    // Basic checks - Use the global dirtree_callback_ref
-    lua_State *L = getLuaState();
-    if (!E.panel_visible || !L || dirtree_callback_ref == LUA_NOREF || dirtree_callback_ref == LUA_REFNIL) {
-        return;
-    }
+    if (!E.panel_visible) return;
 
-    // --- Call Lua ---
-    lua_rawgeti(L, LUA_REGISTRYINDEX, dirtree_callback_ref);
-    // 0 args, expect 2 returns: segments, options (layout needed here)
-    if (lua_pcall(L, 0, 2, 0) != LUA_OK) {
-        const char *error_msg = lua_tostring(L, -1);
-        debug_printf("Floating Panel Lua Error: %s", error_msg ? error_msg : "unknown");
-        lua_pop(L, 1); // Pop error message
+    // --- Evaluate Lua: segments and options (layout needed here) ---
+    if (!luaMemoEvaluate(&dirtree_memo, dirtree_callback_ref)) return;
+    if (!dirtree_memo.has_options) {
+        debug_printf("Floating Panel Lua function must return segments and options tables");
         return;
     }
 
-    // --- Parse Segments & Options ---
-    int segments_idx = -2, options_idx = -1, has_options = 0;
-    int top = lua_gettop(L);
-    // Find segments (mandatory) and options (mandatory for float) tables
-    if (top >= 2 && lua_istable(L, -1) && lua_istable(L, -2)) {
-        segments_idx = -2; options_idx = -1; has_options = 1; // Correct order found
-    } else {
-         debug_printf("Floating Panel Lua function must return segments and options tables");
-         lua_pop(L, top); // Clear stack
-         return;
-    }
-
-    // --- Determine Layout (Always Floating) ---
-    // Get layout from Lua options or use defaults
+    // --- Default Layout (Always Floating) ---
     int panel_w = E.screencols / 3;
     int panel_h = E.screenrows / 2; // Use calculated text area height for default
     int panel_x = (E.screencols - panel_w) / 2 + 1;
-    // ** CORRECTED DEFAULT Y ** Use E.content_start_row
     int panel_y = E.content_start_row + (E.screenrows - panel_h) / 2;
 
-    // Defaults for colors
-    char* panel_default_fg = E.theme.hl_normal_fg ? E.theme.hl_normal_fg : "#ffffff";
-    char* panel_default_bg = E.theme.ui_background_bg ? E.theme.ui_background_bg : "#000000";
-
-    // Read layout from options table using options_idx
-    lua_getfield(L, options_idx, "x"); if (lua_isnumber(L, -1)) panel_x = lua_tointeger(L, -1); lua_pop(L, 1);
-    lua_getfield(L, options_idx, "y"); if (lua_isnumber(L, -1)) panel_y = lua_tointeger(L, -1); lua_pop(L, 1);
-    lua_getfield(L, options_idx, "width"); if (lua_isnumber(L, -1)) panel_w = lua_tointeger(L, -1); lua_pop(L, 1);
-    lua_getfield(L, options_idx, "height"); if (lua_isnumber(L, -1)) panel_h = lua_tointeger(L, -1); lua_pop(L, 1);
-    // Get bg/fg overrides
-    lua_getfield(L, options_idx, "bg"); if (lua_isstring(L, -1)) { const char *n=lua_tostring(L,-1); char *t=getThemeColorByName(n); if(t) panel_default_bg=t; else if(n[0]=='#') panel_default_bg=(char*)n;} lua_pop(L, 1);
-    lua_getfield(L, options_idx, "fg"); if (lua_isstring(L, -1)) { const char *n=lua_tostring(L,-1); char *t=getThemeColorByName(n); if(t) panel_default_fg=t; else if(n[0]=='#') panel_default_fg=(char*)n;} lua_pop(L, 1);
-
-    // Clamp/validate x, y, w, h to screen bounds
-    if (panel_x < 1) panel_x = 1;
-    if (panel_y < 1) panel_y = 1; // Allow drawing anywhere on screen for overlays
-    if (panel_w <= 0) panel_w = 1;
-    if (panel_h <= 0) panel_h = 1;
-    if (panel_x + panel_w > E.screencols + 1) panel_w = E.screencols - panel_x + 1;
-    if (panel_y + panel_h > E.total_rows + 1) panel_h = E.total_rows - panel_y + 1;
-
-    // Draw floating panel background/border (optional)
-    applyTrueColor(ab, panel_default_fg, panel_default_bg);
-    for (int r = 0; r < panel_h; ++r) {
-        char pos_buf[32];
-        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", panel_y + r, panel_x);
-        abAppend(ab, pos_buf, strlen(pos_buf));
-        // Fill with spaces - check bounds correctly
-        for (int c = 0; c < panel_w; ++c) {
-             // Ensure we don't write past screen width (though ANSI might handle it)
-             // if (panel_x + c <= E.screencols) {
-                   abAppend(ab, " ", 1);
-             // }
-        }
-    }
-
-    // --- Render Segments ---
-    lua_Integer segment_count_raw = lua_rawlen(L, segments_idx);
-    // ** FIX: Use segment_count in loop **
-    int segment_count = (segment_count_raw > 0 && segment_count_raw < INT_MAX) ? (int)segment_count_raw : 0;
-
-    for (int i = 1; i <= segment_count; ++i) { // Use for loop
-        lua_rawgeti(L, segments_idx, i); // Get segment table at index i from segments table
-        if (!lua_istable(L, -1)) { lua_pop(L, 1); continue; } // Skip non-tables
-
-        // Get text, fg, bg
-        const char *text = NULL; lua_getfield(L, -1, "text"); if (lua_isstring(L, -1)) text = lua_tostring(L, -1); lua_pop(L, 1);
-        if (!text) { lua_pop(L, 1); continue; } // Skip segment without text
-
-        const char *fg_name = NULL, *bg_name = NULL;
-        lua_getfield(L, -1, "fg"); if (lua_isstring(L, -1)) fg_name = lua_tostring(L, -1); lua_pop(L, 1);
-        lua_getfield(L, -1, "bg"); if (lua_isstring(L, -1)) bg_name = lua_tostring(L, -1); lua_pop(L, 1);
-
-        // Resolve colors
-        char* fg_color = panel_default_fg;
-        char* bg_color = panel_default_bg; // Use panel's default BG unless overridden
-        if (fg_name) { char* t = getThemeColorByName(fg_name); if(t) fg_color = t; else if(fg_name[0] == '#') fg_color = (char*)fg_name; }
-        if (bg_name) { char* t = getThemeColorByName(bg_name); if(t) bg_color = t; else if(bg_name[0] == '#') bg_color = (char*)bg_name; }
-
-        // Get relative x/y from segment
-        int rel_x = 0, rel_y = 0;
-        lua_getfield(L, -1, "x"); if (lua_isnumber(L, -1)) rel_x = lua_tointeger(L, -1); lua_pop(L, 1);
-        lua_getfield(L, -1, "y"); if (lua_isnumber(L, -1)) rel_y = lua_tointeger(L, -1); lua_pop(L, 1);
-
-        int abs_row = panel_y + rel_y;
-        int abs_col = panel_x + rel_x;
-        int available_width = panel_w - rel_x;
-
-        // Check bounds & Draw segment
-        if (abs_row >= panel_y && abs_row < panel_y + panel_h &&
-            abs_col >= panel_x && abs_col < panel_x + panel_w &&
-            available_width > 0) // Check if there's actually space to draw at this col
-        {
-            char pos_buf[32];
-            snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", abs_row, abs_col);
-            abAppend(ab, pos_buf, strlen(pos_buf));
-            applyTrueColor(ab, fg_color, bg_color);
-            int text_len = strlen(text);
-            int len_to_draw = (text_len > available_width) ? available_width : text_len;
-            if (len_to_draw < 0) len_to_draw = 0;
-            abAppend(ab, text, len_to_draw);
-        }
-        lua_pop(L, 1); // Pop segment table value
-    } // End segment loop
-
-    // --- Cleanup ---
-    lua_pop(L, 2); // Pop segments table & options table
-    applyThemeDefaultColor(ab);
+    drawFloatingSegments(ab, state, &dirtree_memo, panel_x, panel_y, panel_w, panel_h,
+                         E.theme.hl_normal_fg ? E.theme.hl_normal_fg : "#ffffff",
+                         E.theme.ui_background_bg ? E.theme.ui_background_bg : "#000000");
 }
 
 
 // Draws the navigator overlay
 // Called by the overlay system loop in editorRefreshScreen
 void editorDrawNavigator(struct abuf *ab, void *state /* NavigatorState* */) {
-    // Use the state parameter
-    NavigatorState *nstate = (NavigatorState*)state;
-    (void)nstate; // Mark as used for now, replace with actual usage later
+    if (!E.navigator_active) return;
 
-    // Basic checks - Use the global navigator callback ref
-    // Check navigator_active flag from E or maybe from nstate->active? Assume E for now.
-    if (!E.navigator_active || navigator_callback_ref == LUA_NOREF || navigator_callback_ref == LUA_REFNIL) {
-        return;
-    }
-    lua_State *L = getLuaState();
-    if (!L) return;
-
-    // --- Call Lua ---
-    lua_rawgeti(L, LUA_REGISTRYINDEX, navigator_callback_ref);
-    // 0 args, expect 2 returns: segments, options
-    if (lua_pcall(L, 0, 2, 0) != LUA_OK) {
-        const char *error_msg = lua_tostring(L, -1);
-        debug_printf("Navigator Lua Error: %s", error_msg ? error_msg : "unknown");
-        lua_pop(L, 1);
+    // --- Evaluate Lua: segments and options ---
+    if (!luaMemoEvaluate(&navigator_memo, navigator_callback_ref)) return;
+    if (!navigator_memo.has_options) {
+        debug_printf("Navigator Lua function must return segments and options tables");
         return;
     }
 
-    // --- Parse Segments & Options ---
-    int segments_idx = -2, options_idx = -1, has_options = 0;
-    int top = lua_gettop(L);
-    // Find segments (mandatory) and options (mandatory) tables
-    if (top >= 2 && lua_istable(L, -1) && lua_istable(L, -2)) {
-        segments_idx = -2; options_idx = -1; has_options = 1;
-    } else {
-         debug_printf("Navigator Lua function must return segments and options tables");
-         lua_pop(L, top); return;
-    }
-     if (!lua_istable(L, segments_idx)){ debug_printf("Navigator segments is not a table"); lua_pop(L, top); return; }
-     // options_idx should point to the options table now
-
-    // --- Determine Layout (Always Floating) ---
-    // Get layout from Lua options or use defaults
+    // --- Default Layout (Always Floating) ---
     int nav_w = E.screencols * 3 / 4;
     int nav_h = E.screenrows / 2;
     int nav_x = (E.screencols - nav_w) / 2 + 1;
-    // ** CORRECTED DEFAULT Y ** Use E.content_start_row
     int nav_y = E.content_start_row + (E.screenrows - nav_h) / 2;
 
-    // Defaults for colors
-    char* nav_default_fg = E.theme.hl_normal_fg ? E.theme.hl_normal_fg : "#ffffff";
-    char* nav_default_bg = E.theme.ui_background_bg ? E.theme.ui_background_bg : "#1d2021"; // Darker default?
-
-    // Read layout from options table using options_idx
-    lua_getfield(L, options_idx, "x"); if (lua_isnumber(L, -1)) nav_x = lua_tointeger(L, -1); lua_pop(L, 1);
-    lua_getfield(L, options_idx, "y"); if (lua_isnumber(L, -1)) nav_y = lua_tointeger(L, -1); lua_pop(L, 1);
-    lua_getfield(L, options_idx, "width"); if (lua_isnumber(L, -1)) nav_w = lua_tointeger(L, -1); lua_pop(L, 1);
-    lua_getfield(L, options_idx, "height"); if (lua_isnumber(L, -1)) nav_h = lua_tointeger(L, -1); lua_pop(L, 1);
-    // Get bg/fg overrides
-    lua_getfield(L, options_idx, "bg"); if (lua_isstring(L, -1)) { const char *n=lua_tostring(L,-1); char *t=getThemeColorByName(n); if(t) nav_default_bg=t; else if(n[0]=='#') nav_default_bg=(char*)n;} lua_pop(L, 1);
-    lua_getfield(L, options_idx, "fg"); if (lua_isstring(L, -1)) { const char *n=lua_tostring(L,-1); char *t=getThemeColorByName(n); if(t) nav_default_fg=t; else if(n[0]=='#') nav_default_fg=(char*)n;} lua_pop(L, 1);
-
-    // Clamp/validate x, y, w, h to screen bounds
-    if (nav_x < 1) nav_x = 1;
-    if (nav_y < 1) nav_y = 1; // Allow drawing anywhere on screen for overlays
-    if (nav_w <= 0) nav_w = 1;
-    if (nav_h <= 0) nav_h = 1;
-    if (nav_x + nav_w > E.screencols + 1) nav_w = E.screencols - nav_x + 1;
-    if (nav_y + nav_h > E.total_rows + 1) nav_h = E.total_rows - nav_y + 1;
-
-    // Draw navigator background/border (optional)
-    applyTrueColor(ab, nav_default_fg, nav_default_bg);
-    for (int r = 0; r < nav_h; ++r) {
-        char pos_buf[32];
-        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", nav_y + r, nav_x);
-        abAppend(ab, pos_buf, strlen(pos_buf));
-        for (int c = 0; c < nav_w; ++c) abAppend(ab, " ", 1);
-    }
-
-    // --- Render Segments ---
-    lua_Integer segment_count_raw = lua_rawlen(L, segments_idx);
-    // ** FIX: Use segment_count in loop **
-    int segment_count = (segment_count_raw > 0 && segment_count_raw < INT_MAX) ? (int)segment_count_raw : 0;
-
-    // Use for loop
-    for (int i = 1; i <= segment_count; ++i) {
-        lua_rawgeti(L, segments_idx, i); // Get segment table at index i
-        if (!lua_istable(L, -1)) { lua_pop(L, 1); continue; }
-
-        // Get text, fg, bg
-        const char *text = NULL; lua_getfield(L, -1, "text"); if (lua_isstring(L, -1)) text = lua_tostring(L, -1); lua_pop(L, 1);
-        if (!text) { lua_pop(L, 1); continue; }
-        const char *fg_name = NULL, *bg_name = NULL;
-        lua_getfield(L, -1, "fg"); if (lua_isstring(L, -1)) fg_name = lua_tostring(L, -1); lua_pop(L, 1);
-        lua_getfield(L, -1, "bg"); if (lua_isstring(L, -1)) bg_name = lua_tostring(L, -1); lua_pop(L, 1);
-
-        // Resolve colors
-        char* fg_color = nav_default_fg;
-        char* bg_color = nav_default_bg;
-        if (fg_name) { char* t = getThemeColorByName(fg_name); if(t) fg_color = t; else if(fg_name[0] == '#') fg_color = (char*)fg_name; }
-        if (bg_name) { char* t = getThemeColorByName(bg_name); if(t) bg_color = t; else if(bg_name[0] == '#') bg_color = (char*)bg_name; }
-
-        // Get relative x/y from segment
-        int rel_x = 0, rel_y = 0;
-        lua_getfield(L, -1, "x"); if (lua_isnumber(L, -1)) rel_x = lua_tointeger(L, -1); lua_pop(L, 1);
-        lua_getfield(L, -1, "y"); if (lua_isnumber(L, -1)) rel_y = lua_tointeger(L, -1); lua_pop(L, 1);
-
-        int abs_row = nav_y + rel_y;
-        int abs_col = nav_x + rel_x;
-        int available_width = nav_w - rel_x;
-
-        // Check bounds & Draw segment (using nav_x, nav_y, nav_w, nav_h)
-        if (abs_row >= nav_y && abs_row < nav_y + nav_h &&
-            abs_col >= nav_x && abs_col < nav_x + nav_w &&
-            available_width > 0)
-        {
-            char pos_buf[32];
-            snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", abs_row, abs_col);
-            abAppend(ab, pos_buf, strlen(pos_buf));
-            applyTrueColor(ab, fg_color, bg_color);
-            int text_len = strlen(text);
-            int len_to_draw = (text_len > available_width) ? available_width : text_len;
-             if (len_to_draw < 0) len_to_draw = 0;
-            abAppend(ab, text, len_to_draw);
-        }
-        lua_pop(L, 1); // Pop segment table value
-    } // End segment loop
-
-    // --- Cleanup ---
-    lua_pop(L, 2); // Pop segments table & options table
-    applyThemeDefaultColor(ab);
+    drawFloatingSegments(ab, state, &navigator_memo, nav_x, nav_y, nav_w, nav_h,
+                         E.theme.hl_normal_fg ? E.theme.hl_normal_fg : "#ffffff",
+                         E.theme.ui_background_bg ? E.theme.ui_background_bg : "#1d2021");
 }
 
 // --- Overlay Management ---
-
-// Adds or updates an overlay entry for a given state pointer
-// Returns 1 on success, 0 on failure
-int activateOverlay(void (*draw_func)(struct abuf *, void *), void *state) {
-    if (!draw_func || !state) {
-        debug_printf("activateOverlay: Invalid draw_func or state pointer.");
-        return 0;
-    }
-
-    // Check if already active
-    for (int i = 0; i < E.num_active_overlays; i++) {
-        if (E.active_overlays[i].state == state) {
-            E.active_overlays[i].draw_func = draw_func; // Update func just in case
-            return 1; // Already active
-        }
-    }
-
-    // Add to list if space available
-    if (E.num_active_overlays < MAX_ACTIVE_OVERLAYS) {
-        OverlayInstance *overlay = &E.active_overlays[E.num_active_overlays];
-        overlay->draw_func = draw_func;
-        overlay->state = state;
-        // overlay->is_active = true; // Field is in your struct, maybe use it?
-        E.num_active_overlays++;
-        return 1; // Success
-    } else {
-        debug_printf("Error: Cannot activate overlay, maximum reached (%d)", MAX_ACTIVE_OVERLAYS);
-        return 0; // Failure
-    }
-}
-
-// Deactivates overlay associated with the given state pointer
-// Returns 1 if deactivated, 0 if not found
-int deactivateOverlay(void *state) {
-    if (!state) {
-         debug_printf("deactivateOverlay: Invalid state pointer.");
-         return 0;
-    }
-
-    for (int i = 0; i < E.num_active_overlays; i++) {
-        if (E.active_overlays[i].state == state) {
-            // Found it
-            E.num_active_overlays--; // Decrease count first
-            // Shift subsequent elements down to fill the gap
-            if (i < E.num_active_overlays) {
-                 memmove(&E.active_overlays[i], &E.active_overlays[i + 1],
-                        (E.num_active_overlays - i) * sizeof(OverlayInstance));
-            }
-            // Zero out the last (now unused) slot
-            memset(&E.active_overlays[E.num_active_overlays], 0, sizeof(OverlayInstance));
-            return 1; // Success
-        }
-    }
-    return 0; // Not found
-}
+// The overlay stack and compositor live in overlay.c
 
 
 // Helper potentially called by Lua API config function
@@ -1516,15 +1145,72 @@ void editorSetPanelMode(PanelDisplayMode new_mode) {
     // If the new mode is FLOAT and it should be visible, activate it
     if (E.panel_mode == PANEL_MODE_FLOAT && E.panel_visible) {
         // Activate overlay using the FLOATING draw func and panel state
-        if (!activateOverlay(editorDrawDirTreeFloating, &E.panel_state)) {
+        if (!activateOverlay(editorDrawDirTreeFloating, &E.panel_state, OVERLAY_Z_PANEL, true,
+                             SCENE_DEP_TREE | SCENE_DEP_STYLE)) {
              editorSetStatusMessage("Error: Could not activate floating panel overlay.");
              E.panel_visible = false; // Mark as not visible if activation failed
         }
     }
 
-    // If switching TO a fixed mode, ensure component is registered and enabled
-    // (Registration might happen once in initEditor)
-    // You might need uiEnableComponent("dir_panel", E.panel_visible && E.panel_mode != PANEL_MODE_FLOAT);
+    sceneTouch(SCENE_DEP_TREE); // The fixed panel is drawn (or not) from E.panel_visible
+}
+
+#define DEBUG_STATS_MAX_LINES 7
+#define DEBUG_STATS_LINE_LEN 160
+
+// Formats the render statistics shown at the bottom of the debug overlay.
+// Returns the number of lines written to lines[].
+static int formatRenderStats(char lines[][DEBUG_STATS_LINE_LEN], int max_lines) {
+    int count = 0;
+    const editorRenderStats *st = &E.render_stats;
+    RenderPipelineStats pipe;
+    renderGetStats(&pipe);
+
+    unsigned long lookups = st->row_cache_hits + st->row_cache_misses;
+    double hit_rate = lookups ? 100.0 * (double)st->row_cache_hits / (double)lookups : 0.0;
+
+    if (count < max_lines) {
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Row cache: %lu hits / %lu misses (%.1f%%) | colours: %s",
+                 st->row_cache_hits, st->row_cache_misses, hit_rate,
+                 colorModeName(E.color_mode));
+    }
+    if (count < max_lines) {
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Scene: %d nodes, %lu redrawn / %lu replayed | rows culled %lu, clipped %lu",
+                 scene.node_count, scene.nodes_drawn, scene.nodes_replayed,
+                 st->rows_culled, st->rows_clipped);
+    }
+    if (count < max_lines) {
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Frames: %lu written, %lu dropped, %lu skipped | cap %d fps, sync %s",
+                 pipe.frames_written, pipe.frames_dropped, pipe.frames_skipped,
+                 renderGetFrameRate(), (E.term_caps & TERM_CAP_SYNC) ? "on" : "off");
+    }
+    if (count < max_lines) {
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Flush: last %.1f ms, avg %.1f ms, max %.1f ms | %lu KB written, %lu errors",
+                 pipe.flush_ms_last, pipe.flush_ms_avg, pipe.flush_ms_max,
+                 pipe.bytes_written / 1024, pipe.write_errors);
+    }
+    if (count < max_lines) {
+        unsigned long memo_hits, memo_misses;
+        luaMemoTotals(&memo_hits, &memo_misses);
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Lua callbacks: %lu cached / %lu called (see kilo.get_callback_stats())",
+                 memo_hits, memo_misses);
+    }
+    if (count < max_lines) {
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Highlight: %d of %d rows pending | %lu done in idle time",
+                 E.current_buffer ? E.current_buffer->hl_stale_rows : 0, E.numrows, E.hl_idle_rows);
+    }
+    if (count < max_lines) {
+        snprintf(lines[count++], DEBUG_STATS_LINE_LEN,
+                 " Quality: %s | throughput %.0f KB/s",
+                 renderQualityName(E.render_quality), pipe.write_kbps_avg);
+    }
+    return count;
 }
 
 void editorDrawDebugOverlay(struct abuf *ab) {
@@ -1555,7 +1241,12 @@ void editorDrawDebugOverlay(struct abuf *ab) {
 
     // Calculate how many lines we might need from the raw buffer
     int title_lines = 1;
-    int border_lines = 1; // Assuming a bottom border/blank line for padding
+    // Render statistics take the bottom lines of the overlay
+    char stats_lines[DEBUG_STATS_MAX_LINES][DEBUG_STATS_LINE_LEN];
+    int stats_count = formatRenderStats(stats_lines, DEBUG_STATS_MAX_LINES);
+    if (stats_count > overlay_height - title_lines) stats_count = overlay_height - title_lines;
+    if (stats_count < 0) stats_count = 0;
+    int border_lines = stats_count;
     int content_height = overlay_height - title_lines - border_lines;
     if (content_height < 0) content_height = 0;
 
@@ -1640,11 +1331,12 @@ void editorDrawDebugOverlay(struct abuf *ab) {
              }
             // Remainder of line is cleared by \x1b[K
 
-        } else if (i == overlay_height - 1) {
-            // --- Draw Bottom Border (optional) ---
-            // Line is already cleared with the default overlay background/foreground
-            // You could add specific characters like '─' here if desired
-            ; // Currently draws a blank line with the overlay background
+        } else if (i >= overlay_height - stats_count) {
+            // --- Draw Bottom Lines: render statistics ---
+            const char *stats = stats_lines[i - (overlay_height - stats_count)];
+            int stats_len = strlen(stats);
+            if (stats_len > overlay_width) stats_len = overlay_width;
+            abAppend(ab, stats, stats_len);
 
         } else {
             // --- Draw Content Lines ---
@@ -1719,10 +1411,7 @@ void editorDrawMessageBar(struct abuf *ab) {
              // Message fits, append the whole thing
              abAppend(ab, E.statusmsg, strlen(E.statusmsg));
          }
-         // Fill remaining space on the message line with background color
-         int padding = E.screencols - msglen;
-         if (padding < 0) padding = 0;
-         for(int i = 0; i < padding; ++i) abAppend(ab, " ", 1);
+         // The rest of the line was already cleared by \x1b[K above
 
     } else {
         // No message or expired, line is already cleared by \x1b[K
@@ -1822,16 +1511,7 @@ int editorDrawUiElement(struct abuf *ab, int lua_callback_ref) {
     if (!bg) bg = E.theme.ui_background_bg ? E.theme.ui_background_bg : "#000000";
 
     // Clear the background area
-    for (int r = 0; r < height; r++) {
-        char pos_buf[32];
-        snprintf(pos_buf, sizeof(pos_buf), "\x1b[%d;%dH", y + r, x);
-        abAppend(ab, pos_buf, strlen(pos_buf));
-        applyTrueColor(ab, fg, bg);
-        
-        for (int c = 0; c < width; c++) {
-            abAppend(ab, " ", 1);
-        }
-    }
+    fillRect(ab, x, y, width, height, fg, bg);
 
     // Process segments
     lua_Integer segment_count_raw = lua_rawlen(L, segments_idx);
@@ -1896,23 +1576,11 @@ int editorDrawUiElement(struct abuf *ab, int lua_callback_ref) {
             abAppend(ab, pos_buf, strlen(pos_buf));
             applyTrueColor(ab, segment_fg, segment_bg);
             
-            // Calculate available width and clip text if needed
+            // Draw as much of the text as fits in the element, clipped by cells
             int available_width = width - rel_x;
-            int text_len = strlen(text);
-            int visible_width = calculate_visible_length_ansi(text);
-            
             if (available_width > 0) {
-                if (visible_width > available_width) {
-                    // Text is too long, needs clipping
-                    // For simplicity, just truncate by byte length
-                    // A more accurate approach would clip based on visual width
-                    int len_to_draw = text_len * available_width / visible_width;
-                    if (len_to_draw > text_len) len_to_draw = text_len;
-                    abAppend(ab, text, len_to_draw);
-                } else {
-                    // Text fits, draw it all
-                    abAppend(ab, text, text_len);
-                }
+                int len_to_draw = calculate_visible_prefix_ansi(text, available_width, NULL);
+                abAppend(ab, text, len_to_draw);
             }
         }
         
@@ -1927,201 +1595,31 @@ int editorDrawUiElement(struct abuf *ab, int lua_callback_ref) {
 }
 
 
-// Helper function to draw all UI components using Lua layout
-bool drawLuaLayout(struct abuf *ab) {
-  lua_State *L = getLuaState();
-  bool using_lua_layout = false;
-
-  if (L && layout_callback_ref != LUA_NOREF) {
-    lua_rawgeti(L, LUA_REGISTRYINDEX, layout_callback_ref);
-    if (lua_pcall(L, 0, 1, 0) == LUA_OK && lua_istable(L, -1)) {
-      // Process UI elements from Lua
-      lua_getfield(L, -1, "elements");
-      if (lua_istable(L, -1)) {
-        lua_Integer element_count = lua_rawlen(L, -1);
-        for (int i = 1; i <= element_count; i++) {
-          lua_rawgeti(L, -1, i);
-          if (lua_istable(L, -1)) {
-            lua_getfield(L, -1, "name");
-            const char *element_name = lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL;
-            lua_pop(L, 1);
-            
-            if (element_name) {
-              // Add debug code here
-              printf("Looking for UI element: %s", element_name);
-              lua_getglobal(L, "kilo");
-              lua_getfield(L, -1, "ui_elements");
-              if (lua_istable(L, -1)) {
-                printf("kilo.ui_elements table exists");
-                lua_getfield(L, -1, element_name);
-                printf("kilo.ui_elements[%s] is %s", element_name, 
-                          lua_isfunction(L, -1) ? "a function" : 
-                          lua_isnil(L, -1) ? "nil" : "not a function");
-                lua_pop(L, 1); // Pop the result
-              } else {
-                printf("kilo.ui_elements is not a table!");
-              }
-              lua_pop(L, 2); // Pop ui_elements and kilo
-              
-              // Special case for text area
-              if (strcmp(element_name, "textarea") == 0) {
-                editorDrawTextArea(ab);
-              } else {
-                // Get callback function for other elements
-                lua_getglobal(L, "kilo");
-                lua_getfield(L, -1, "ui_elements");
-                lua_getfield(L, -1, element_name);
-                
-                if (lua_isfunction(L, -1)) {
-                  int temp_callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-                  lua_pop(L, 2); // Pop ui_elements and kilo tables
-                  
-                  editorDrawUiElement(ab, temp_callback_ref);
-                  
-                  luaL_unref(L, LUA_REGISTRYINDEX, temp_callback_ref);
-                } else {
-                  lua_pop(L, 3); // Pop function (or nil), ui_elements, and kilo tables
-                }
-              }
-            }
-            
-            lua_pop(L, 1); // Pop element table
-          }
-        }
-      }
-      lua_pop(L, 1); // Pop elements table
-      
-      // Set flag that we used Lua layout
-      using_lua_layout = true;
-      
-      // Pop layout table
-      lua_pop(L, 1);
-    } else {
-      // Failed to call Lua function or result is not a table
-      if (lua_gettop(L) > 0) {
-        printf("Failed to call layout function or result is not a table");
-        lua_pop(L, 1); // Pop error message or non-table result
-      }
-    }
-  } else {
-    printf("Layout not used: L valid=%s, layout_callback_ref=%d", 
-                L ? "yes" : "no", layout_callback_ref);
-  }
-  
-  // If Lua layout failed or isn't available, use default layout
-  if (!using_lua_layout) {
-    // Draw tabline
-    editorDrawTabline(ab);
-    
-    // Draw panel if visible
-    if (E.panel_visible) {
-      if (E.panel_mode == PANEL_MODE_LEFT) {
-        editorDrawDirTreeFixed(ab, 1, E.content_start_row, 
-                            E.panel_render_width, E.screenrows);
-      } else if (E.panel_mode == PANEL_MODE_RIGHT) {
-        int right_panel_start_col = E.screencols - E.panel_render_width + 1;
-        editorDrawDirTreeFixed(ab, right_panel_start_col, E.content_start_row, 
-                            E.panel_render_width, E.screenrows);
-      }
-    }
-    
-    // Draw text area
-    editorDrawTextArea(ab);
-    
-    // Draw statusbar and message bar
-    editorDrawStatusBar(ab);
-    editorDrawMessageBar(ab);
-  }
-  
-  // Draw active overlays (always done regardless of layout)
-  for (int i = 0; i < E.num_active_overlays; i++) {
-    OverlayInstance *overlay = &E.active_overlays[i];
-    if (overlay->draw_func) {
-      overlay->draw_func(ab, overlay->state);
-    }
-  }
-  
-  // Draw debug overlay if active
-  if (debug_overlay_active) {
-    editorDrawDebugOverlay(ab);
-  }
-  
-  return true;
-}
-
-
-void editorDrawTextArea(struct abuf *ab) {
-  // Default text area dimensions - calculate based on fixed components
-  int reserved_rows_top = 1;     // Tabline
-  int reserved_rows_bottom = 2;  // Statusbar & messagebar
-  int reserved_cols_left = 0;    // Default: no side panel
-  int reserved_cols_right = 0;   // Default: no right panel
-  
-  // Check if panel is enabled in fixed mode
-  if (E.panel_visible) {
-    if (E.panel_mode == PANEL_MODE_LEFT) {
-      reserved_cols_left = E.panel_render_width;
-    } else if (E.panel_mode == PANEL_MODE_RIGHT) {
-      reserved_cols_right = E.panel_render_width;
-    }
-  }
-  
-  // Calculate default text area dimensions
-  int text_area_start_row = reserved_rows_top + 1;
-  int text_area_start_col = reserved_cols_left + 1;
-  int text_area_width = E.screencols - reserved_cols_left - reserved_cols_right;
-  int text_area_height = E.total_rows - reserved_rows_top - reserved_rows_bottom;
-  
-  // Ensure minimum dimensions
-  if (text_area_width < 1) text_area_width = 1;
-  if (text_area_height < 1) text_area_height = 1;
-  
-  lua_State *L = getLuaState();
-  if (L && textarea_callback_ref != LUA_NOREF) {
-    lua_rawgeti(L, LUA_REGISTRYINDEX, textarea_callback_ref);
-    if (lua_pcall(L, 0, 1, 0) == LUA_OK && lua_istable(L, -1)) {
-      lua_getfield(L, -1, "x");
-      if (!lua_isnil(L, -1)) text_area_start_col = lua_tointeger(L, -1);
-      lua_pop(L, 1);
-      
-      lua_getfield(L, -1, "y");
-      if (!lua_isnil(L, -1)) text_area_start_row = lua_tointeger(L, -1);
-      lua_pop(L, 1);
-      
-      lua_getfield(L, -1, "width");
-      if (!lua_isnil(L, -1)) text_area_width = lua_tointeger(L, -1);
-      lua_pop(L, 1);
-      
-      lua_getfield(L, -1, "height");
-      if (!lua_isnil(L, -1)) text_area_height = lua_tointeger(L, -1);
-      lua_pop(L, 1);
+void editorRefreshScreen() {
+    // Frame pacing: skip frames that would be superseded before they are
+    // seen (see renderShouldSkipFrame). Scroll state is still kept current
+    // because the queued keys (e.g. PageDown) depend on it.
+    if (renderShouldSkipFrame()) {
+        editorScroll();
+        return;
     }
-    lua_pop(L, 1);
-  }
-  
-  // Update global screen dimensions for scrolling
-  E.content_start_row = text_area_start_row;
-  E.content_start_col = text_area_start_col;
-  E.screenrows = text_area_height;
-  E.content_width = text_area_width;
-  
-  editorDrawRows(ab, text_area_start_row, text_area_start_col, 
-                text_area_height, text_area_width);
-}
-
+    renderUpdateQuality();
 
-void editorRefreshScreen() {
     struct abuf ab = ABUF_INIT;
     
+    // Begin synchronized update: the terminal holds painting until the
+    // matching end, so a large frame never shows half-drawn
+    if (E.term_caps & TERM_CAP_SYNC) abAppend(&ab, "\x1b[?2026h", 8);
+
     // Hide cursor and go to home position
     abAppend(&ab, "\x1b[?25l", 6);
     abAppend(&ab, "\x1b[H", 3);
     
-    // Calculate component layout
+    // Calculate component layout (only recomputed when invalidated)
     calculateLayout();
     
-    // Draw all components
-    drawComponents(&ab);
+    // Redraw dirty scene nodes and composite all of them
+    sceneRender(&ab);
     
     // Position cursor based on text area and scroll position
     editorScroll();
@@ -2151,55 +1649,14 @@ void editorRefreshScreen() {
     
     // Show cursor
     abAppend(&ab, "\x1b[?25h", 6);
+
+    if (E.term_caps & TERM_CAP_SYNC) abAppend(&ab, "\x1b[?2026l", 8);
     
-    // Write the buffer to stdout
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    // Hand the finished frame to the render thread, which writes it out
+    renderSubmitFrame(&ab);
 }
 
 
-// OLD IMPLEMENTATION
-// void editorRefreshScreen() {
-//   struct abuf ab = ABUF_INIT;
-  
-//   // Update screen dimensions
-//   getWindowSize(&E.total_rows, &E.screencols);
-  
-//   // Hide cursor and go to home position
-//   abAppend(&ab, "\x1b[?25l", 6);
-//   abAppend(&ab, "\x1b[H", 3);
-  
-//   // Draw all UI components (with default fallback)
-//   drawLuaLayout(&ab);
-  
-//   // Perform scrolling
-//   editorScroll();
-  
-//   // Position cursor (using global values set by drawLuaLayout > editorDrawTextArea)
-//   int cursor_screen_row = (E.cy - E.rowoff) + E.content_start_row;
-//   int cursor_screen_col = (E.rx - E.coloff) + E.content_start_col + KILO_LINE_NUMBER_WIDTH;
-  
-//   // Clamp cursor (using global text area dimensions)
-//   if (cursor_screen_row < E.content_start_row) 
-//     cursor_screen_row = E.content_start_row;
-//   if (cursor_screen_row >= E.content_start_row + E.screenrows) 
-//     cursor_screen_row = E.content_start_row + E.screenrows - 1;
-  
-//   if (cursor_screen_col < E.content_start_col) 
-//     cursor_screen_col = E.content_start_col;
-//   if (cursor_screen_col >= E.content_start_col + E.content_width) 
-//     cursor_screen_col = E.content_start_col + E.content_width - 1;
-  
-//   char buf[32];
-//   snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cursor_screen_row, cursor_screen_col);
-//   abAppend(&ab, buf, strlen(buf));
-  
-//   // Show cursor and write buffer
-//   abAppend(&ab, "\x1b[?25h", 6);
-//   write(STDOUT_FILENO, ab.b, ab.len);
-//   abFree(&ab);
-// }
-
 void editorSetStatusMessage(const char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
@@ -2207,6 +1664,7 @@ void editorSetStatusMessage(const char *fmt, ...) {
   vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
   va_end(ap);
   E.statusmsg_time = time(NULL); // Record the time the message was set
+  sceneTouch(SCENE_DEP_STATUS);
 }
 
 // (editorClearStatusMessage remains the same, or provide a default message)
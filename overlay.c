@@ -0,0 +1,176 @@
+#include "kilo.h"
+#include "overlay.h"
+#include "debug.h"
+
+/**
+ * Overlays
+ *
+ * Floating overlays (directory panel, navigator, debug log) are scene graph
+ * nodes (see scene.c) that are drawn by a C function and position
+ * themselves: while drawing, an overlay reports the rectangle it covers
+ * with editorOverlayReportRect. sceneRender brings opaque overlays up to
+ * date before the text area, so text-area cells under them are skipped
+ * instead of being drawn and immediately overdrawn (see overlayVisibleSpans).
+ *
+ * The debug overlay and the navigator are toggled through flags set from
+ * several places (debug_overlay_active, E.navigator_active); their nodes
+ * are kept in sync with those flags at the start of every frame.
+ */
+
+// Key of the debug overlay node
+static int debug_layer_state;
+
+static void drawDebugLayer(struct abuf *ab, void *state) {
+    editorDrawDebugOverlay(ab);
+    // Covers the full width of rows 1..E.screenrows (see editorDrawDebugOverlay)
+    editorOverlayReportRect(state, 1, 1, E.screencols, E.screenrows);
+}
+
+// Adds an overlay node, or updates it if state is already in the scene.
+// Overlays with equal z-index keep their activation order. depends says
+// which SCENE_DEP_* changes make it redraw.
+// Returns 1 on success, 0 on failure
+int activateOverlay(void (*draw_func)(struct abuf *, void *), void *state, int z_index, bool opaque, unsigned int depends) {
+    if (!draw_func || !state) {
+        debug_printf("activateOverlay: Invalid draw_func or state pointer.");
+        return 0;
+    }
+
+    // Check if already active
+    SceneNode *node = sceneFindNodeByState(state);
+    if (node) {
+        if (node->z_index == z_index && node->draw_func == draw_func) {
+            node->opaque = opaque;
+            node->depends = depends;
+            return 1; // Already active
+        }
+        // z-index or drawing changed: take it out and re-insert below
+        sceneRemoveNode(node);
+    }
+
+    node = sceneInsertNode("overlay", COMPONENT_OVERLAY, POSITION_FLOATING, z_index);
+    if (!node) {
+        debug_printf("Error: Cannot activate overlay, out of memory");
+        return 0;
+    }
+    node->draw_func = draw_func;
+    node->state = state;
+    node->opaque = opaque;
+    node->depends = depends;
+    return 1; // Success
+}
+
+// Deactivates overlay associated with the given state pointer
+// Returns 1 if deactivated, 0 if not found
+int deactivateOverlay(void *state) {
+    if (!state) {
+         debug_printf("deactivateOverlay: Invalid state pointer.");
+         return 0;
+    }
+
+    SceneNode *node = sceneFindNodeByState(state);
+    if (!node) return 0; // Not found
+    sceneRemoveNode(node);
+    return 1; // Success
+}
+
+/**
+ * @brief Records the screen rectangle an overlay covers.
+ *
+ * Called by overlay draw functions once their geometry is known (1-based
+ * coordinates). Overlays that never report a rectangle hide nothing. The
+ * rectangle is kept while the overlay's retained output is replayed.
+ */
+void editorOverlayReportRect(void *state, int x, int y, int width, int height) {
+    SceneNode *node = sceneFindNodeByState(state);
+    if (!node) return;
+    node->x = x;
+    node->y = y;
+    node->width = width;
+    node->height = height;
+}
+
+// Keeps the navigator and debug overlay nodes in line with their flags.
+// Called by sceneRender before anything is drawn.
+void overlaySyncBuiltins(void) {
+    if (E.navigator_active) {
+        activateOverlay(editorDrawNavigator, &E.navigator_state, OVERLAY_Z_NAVIGATOR, true,
+                        SCENE_DEP_TREE | SCENE_DEP_STYLE);
+    } else {
+        deactivateOverlay(&E.navigator_state);
+    }
+
+    // The debug overlay shows live stats, so it is redrawn every frame
+    if (debug_overlay_active) {
+        activateOverlay(drawDebugLayer, &debug_layer_state, OVERLAY_Z_DEBUG, true, SCENE_DEP_ALWAYS);
+    } else {
+        deactivateOverlay(&debug_layer_state);
+    }
+}
+
+// Removes the columns [cut_start, cut_end) from the span list in place
+static int subtractSpan(OverlaySpan *spans, int count, int cut_start, int cut_end, int max_spans) {
+    for (int i = 0; i < count; i++) {
+        OverlaySpan s = spans[i];
+        if (cut_end <= s.start || cut_start >= s.end) continue; // No overlap
+
+        bool keep_left = cut_start > s.start;
+        bool keep_right = cut_end < s.end;
+        if (keep_left && keep_right) {
+            if (count >= max_spans) return -1; // Too fragmented to track
+            memmove(&spans[i + 2], &spans[i + 1], (count - i - 1) * sizeof(OverlaySpan));
+            spans[i].end = cut_start;
+            spans[i + 1].start = cut_end;
+            spans[i + 1].end = s.end;
+            count++;
+            i++;
+        } else if (keep_left) {
+            spans[i].end = cut_start;
+        } else if (keep_right) {
+            spans[i].start = cut_end;
+        } else {
+            memmove(&spans[i], &spans[i + 1], (count - i - 1) * sizeof(OverlaySpan));
+            count--;
+            i--;
+        }
+    }
+    return count;
+}
+
+static int subtractLayer(const SceneNode *node, int row, OverlaySpan *spans, int count, int max_spans) {
+    if (count <= 0 || !node->visible || !node->opaque || node->width <= 0 || node->height <= 0) return count;
+    if (row < node->y || row >= node->y + node->height) return count;
+    return subtractSpan(spans, count, node->x, node->x + node->width, max_spans);
+}
+
+/**
+ * @brief Works out which columns of [x0, x1) on a screen row stay visible.
+ *
+ * Subtracts the rectangles of all opaque nodes above the text area.
+ * @return Number of spans written (0 = the row is completely hidden), or
+ *         -1 if there are more than max_spans (the caller should then just
+ *         draw the whole row).
+ */
+int overlayVisibleSpans(int row, int x0, int x1, OverlaySpan *spans, int max_spans) {
+    if (max_spans < 1) return -1;
+    spans[0].start = x0;
+    spans[0].end = x1;
+    int count = 1;
+
+    int text_z = scene.textarea ? scene.textarea->z_index : 0;
+    for (int i = 0; i < scene.node_count && count > 0; i++) {
+        if (scene.nodes[i].z_index <= text_z) continue;
+        count = subtractLayer(&scene.nodes[i], row, spans, count, max_spans);
+    }
+    return count;
+}
+
+// True if any opaque node above the text area is on screen this frame
+bool overlayAnyVisible(void) {
+    int text_z = scene.textarea ? scene.textarea->z_index : 0;
+    for (int i = 0; i < scene.node_count; i++) {
+        const SceneNode *node = &scene.nodes[i];
+        if (node->z_index > text_z && node->visible && node->opaque && node->width > 0) return true;
+    }
+    return false;
+}
@@ -0,0 +1,392 @@
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "kilo.h"
+#include "render.h"
+
+/**
+ * Render Thread
+ *
+ * editorRefreshScreen composes a frame on the input thread and hands the
+ * finished bytes to a dedicated render thread, which writes them to the
+ * terminal. The input thread goes straight back to reading keys while a
+ * (possibly large) frame is still being written.
+ *
+ * Composition stays on the input thread because it runs the Lua component
+ * callbacks and Lua state must only be touched by one thread. The composed
+ * frame is the immutable snapshot of the view: once submitted, nothing on
+ * the input thread refers to it again.
+ *
+ * Hand-off is a single-slot mailbox. If the render thread has not picked up
+ * the previous frame yet, the new one replaces it, so under burst input only
+ * the newest snapshot is ever written.
+ *
+ * Output goes through a separate non-blocking descriptor opened on the
+ * terminal device. Setting O_NONBLOCK on STDOUT_FILENO itself would also
+ * make stdin non-blocking (they normally share one open file description),
+ * which breaks the VMIN/VTIME reads in editorReadKey. The writer polls for
+ * POLLOUT between partial writes, so a congested link only ever holds up
+ * the frame in flight; anything submitted meanwhile waits in the mailbox
+ * and is replaced wholesale by newer frames.
+ */
+
+static pthread_t render_thread;
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+
+static struct abuf mailbox = {NULL, 0}; // Newest frame not yet picked up
+static double mailbox_submit_ms = 0;      // When the mailbox frame was submitted
+static bool mailbox_full = false;
+static unsigned long mailbox_seq = 0;      // Sequence number of the mailbox frame
+static unsigned long frame_seq_submitted = 0; // Last sequence number handed out (input thread only)
+static unsigned long frame_seq_taken = 0;  // Newest frame that can no longer be dropped
+static bool render_thread_running = false; // Thread exists and accepts frames
+static bool render_thread_started = false; // render_thread is valid (set once, input thread)
+
+static int output_fd = STDOUT_FILENO;     // Non-blocking tty fd, or stdout as a fallback
+static bool output_fd_owned = false;      // output_fd was opened by renderInit
+
+static RenderPipelineStats pipeline_stats;
+static double last_submit_ms = 0;          // Input thread only
+static double frame_interval_ms = 1000.0 / KILO_DEFAULT_FRAME_RATE; // Pacer (input thread only)
+
+// Adaptive quality state (input thread only)
+static RenderQualityConfig quality_config = {
+    .enabled = true,
+    .latency_ms = 40,
+    .min_kbps = 0,
+    .hold_ms = 250,
+    .idle_ms = 300,
+};
+static double last_quality_change_ms = 0;
+
+double getMonotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+// Writes the whole buffer, retrying on short writes and EINTR.
+// On a non-blocking fd, waits for POLLOUT whenever the kernel buffer is full.
+static int writeAll(int fd, const char *buf, int len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+                if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (int)n;
+    }
+    return 0;
+}
+
+// Folds one written frame into the flush latency and throughput stats.
+// submit_ms is when the frame was handed over, start_ms when writing began.
+// Caller holds render_lock (or the render thread is not running).
+static void recordFlush(double submit_ms, double start_ms, int bytes) {
+    double now = getMonotonicMs();
+    double latency = now - submit_ms;
+    double write_ms = now - start_ms;
+
+    pipeline_stats.frames_written++;
+    pipeline_stats.bytes_written += (unsigned long)bytes;
+    pipeline_stats.flush_ms_last = latency;
+    if (latency > pipeline_stats.flush_ms_max) pipeline_stats.flush_ms_max = latency;
+    // Exponential moving average; the first frame seeds it
+    if (pipeline_stats.frames_written == 1) pipeline_stats.flush_ms_avg = latency;
+    else pipeline_stats.flush_ms_avg += (latency - pipeline_stats.flush_ms_avg) / 8.0;
+
+    // Throughput is only meaningful for frames that took measurable time;
+    // tiny frames written instantly would report absurd rates
+    if (write_ms >= 1.0) {
+        double kbps = ((double)bytes / 1024.0) / (write_ms / 1000.0);
+        if (pipeline_stats.write_kbps_avg == 0) pipeline_stats.write_kbps_avg = kbps;
+        else pipeline_stats.write_kbps_avg += (kbps - pipeline_stats.write_kbps_avg) / 8.0;
+    }
+}
+
+// Opens a second, non-blocking descriptor on the terminal for frame output.
+// Falls back to blocking writes on stdout when it is not a tty.
+static void openOutputFd(void) {
+    const char *tty = isatty(STDOUT_FILENO) ? ttyname(STDOUT_FILENO) : NULL;
+    int fd = tty ? open(tty, O_WRONLY | O_NOCTTY | O_NONBLOCK) : -1;
+
+    if (fd < 0) {
+        debug_printf("renderInit: no non-blocking tty fd, using blocking stdout\n");
+        output_fd = STDOUT_FILENO;
+        output_fd_owned = false;
+        return;
+    }
+    output_fd = fd;
+    output_fd_owned = true;
+}
+
+static void closeOutputFd(void) {
+    if (output_fd_owned) close(output_fd);
+    output_fd = STDOUT_FILENO;
+    output_fd_owned = false;
+}
+
+static void *renderThreadMain(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&render_lock);
+    for (;;) {
+        while (!mailbox_full && render_thread_running) {
+            pthread_cond_wait(&render_cond, &render_lock);
+        }
+        if (!mailbox_full) break; // Shutting down and nothing left to write
+
+        // Take the frame out of the mailbox; it is now in flight and will
+        // be written completely, while newer frames replace the mailbox.
+        struct abuf frame = mailbox;
+        double submit_ms = mailbox_submit_ms;
+        frame_seq_taken = mailbox_seq;
+        mailbox.b = NULL;
+        mailbox.len = 0;
+        mailbox_full = false;
+        pthread_mutex_unlock(&render_lock);
+
+        int len = frame.len;
+        double start_ms = getMonotonicMs();
+        int result = writeAll(output_fd, frame.b, len);
+        abFree(&frame);
+
+        pthread_mutex_lock(&render_lock);
+        if (result == 0) recordFlush(submit_ms, start_ms, len);
+        else pipeline_stats.write_errors++;
+    }
+    pthread_mutex_unlock(&render_lock);
+    return NULL;
+}
+
+// Starts the render thread. If it cannot be started, frames are written
+// synchronously by renderSubmitFrame instead.
+void renderInit(void) {
+    openOutputFd();
+
+    pthread_mutex_lock(&render_lock);
+    render_thread_running = true;
+    pthread_mutex_unlock(&render_lock);
+
+    if (pthread_create(&render_thread, NULL, renderThreadMain, NULL) != 0) {
+        debug_printf("renderInit: could not start render thread, writing frames synchronously\n");
+        pthread_mutex_lock(&render_lock);
+        render_thread_running = false;
+        pthread_mutex_unlock(&render_lock);
+        return;
+    }
+    render_thread_started = true;
+}
+
+// True while frames are written by the render thread; nothing else may
+// write to the terminal then
+bool renderThreadRunning(void) {
+    pthread_mutex_lock(&render_lock);
+    bool running = render_thread_running;
+    pthread_mutex_unlock(&render_lock);
+    return running;
+}
+
+// True when called from the render thread itself (e.g. die() on a failed write)
+bool renderOnRenderThread(void) {
+    return render_thread_started && pthread_equal(pthread_self(), render_thread);
+}
+
+// Writes out any pending frame and stops the render thread.
+// Must be called before anything else writes to the terminal on exit.
+void renderShutdown(void) {
+    pthread_mutex_lock(&render_lock);
+    if (!render_thread_running) {
+        pthread_mutex_unlock(&render_lock);
+        closeOutputFd();
+        return;
+    }
+    render_thread_running = false;
+    pthread_cond_broadcast(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+
+    if (!renderOnRenderThread()) pthread_join(render_thread, NULL); // Can't wait for itself
+    closeOutputFd();
+}
+
+/**
+ * @brief Hands a composed frame to the render thread.
+ *
+ * Takes ownership of frame->b; the caller's abuf is left empty. A frame
+ * still waiting in the mailbox is dropped in favour of this one; a frame
+ * already being written is always finished first.
+ */
+void renderSubmitFrame(struct abuf *frame) {
+    struct abuf dropped = {NULL, 0};
+    double now = getMonotonicMs();
+    unsigned long seq = ++frame_seq_submitted;
+
+    last_submit_ms = now;
+
+    pthread_mutex_lock(&render_lock);
+    pipeline_stats.frames_submitted++;
+    if (!render_thread_running) {
+        frame_seq_taken = seq;
+        pthread_mutex_unlock(&render_lock);
+        // No render thread: write synchronously
+        if (writeAll(output_fd, frame->b, frame->len) == 0) recordFlush(now, now, frame->len);
+        else pipeline_stats.write_errors++;
+        abFree(frame);
+        frame->b = NULL;
+        frame->len = 0;
+        return;
+    }
+    if (mailbox_full) {
+        dropped = mailbox;
+        pipeline_stats.frames_dropped++;
+    }
+    mailbox = *frame;
+    mailbox_seq = seq;
+    mailbox_submit_ms = now;
+    mailbox_full = true;
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+
+    abFree(&dropped); // Free outside the lock
+    frame->b = NULL;
+    frame->len = 0;
+}
+
+// Sequence number the next renderSubmitFrame will give its frame
+unsigned long renderNextFrameSeq(void) {
+    return frame_seq_submitted + 1;
+}
+
+// True once frame `seq` or a later one has left the mailbox. A frame taken
+// by the render thread (or written synchronously) is always written out in
+// full before anything after it; one still in the mailbox may be dropped.
+bool renderFrameTaken(unsigned long seq) {
+    pthread_mutex_lock(&render_lock);
+    bool taken = frame_seq_taken >= seq;
+    pthread_mutex_unlock(&render_lock);
+    return taken;
+}
+
+/**
+ * @brief Frame pacer: decides whether editorRefreshScreen draws this frame.
+ *
+ * Frames are capped at frame_interval_ms apart. A refresh that comes too
+ * early waits out the rest of the interval for more input: if a key
+ * arrives, this frame is skipped (the key's own refresh will draw the newer
+ * state); if not, the frame is drawn, so the latest state always reaches
+ * the screen once input stops.
+ *
+ * While more keys are already waiting, the frame would be superseded before
+ * anyone saw it, so it is skipped too, but a frame is still produced every
+ * KILO_MAX_FRAME_SKIP_MS so long pastes or key repeat show progress.
+ */
+bool renderShouldSkipFrame(void) {
+    double since_last = getMonotonicMs() - last_submit_ms;
+    bool skip = false;
+
+    if (editorInputPending()) {
+        skip = since_last < KILO_MAX_FRAME_SKIP_MS;
+    } else if (since_last < frame_interval_ms) {
+        skip = editorWaitForInput((int)(frame_interval_ms - since_last + 0.5));
+    }
+    if (!skip) return false;
+
+    pthread_mutex_lock(&render_lock);
+    pipeline_stats.frames_skipped++;
+    pthread_mutex_unlock(&render_lock);
+    return true;
+}
+
+// Caps redraws at fps frames per second (0 = uncapped)
+void renderSetFrameRate(int fps) {
+    frame_interval_ms = fps > 0 ? 1000.0 / fps : 0;
+}
+
+int renderGetFrameRate(void) {
+    return frame_interval_ms > 0 ? (int)(1000.0 / frame_interval_ms + 0.5) : 0;
+}
+
+// Copies the pipeline counters (safe to call while the render thread runs)
+void renderGetStats(RenderPipelineStats *out) {
+    pthread_mutex_lock(&render_lock);
+    *out = pipeline_stats;
+    pthread_mutex_unlock(&render_lock);
+}
+
+/**
+ * Adaptive Render Quality
+ *
+ * When the terminal link can't keep up (e.g. holding PageDown on a wide
+ * truecolor screen over SSH), frames are made cheaper rather than slower:
+ * RENDER_QUALITY_REDUCED quantises truecolor to the 256-colour palette, and
+ * RENDER_QUALITY_MINIMAL also drops syntax colours and stops redrawing the
+ * side panel. Quality is lowered one step at a time while the measured flush
+ * latency or throughput is past its threshold, and restored in one go once
+ * input has been idle for quality_config.idle_ms.
+ */
+
+static void setRenderQuality(enum editorRenderQuality quality) {
+    if (E.render_quality == quality) return;
+    debug_printf("render quality: %s -> %s\n",
+                 renderQualityName(E.render_quality), renderQualityName(quality));
+    E.render_quality = quality;
+    last_quality_change_ms = getMonotonicMs();
+    rebuildThemeColors(); // New palette cap; also invalidates cached rows
+}
+
+// Called by editorRefreshScreen before composing a frame
+void renderUpdateQuality(void) {
+    if (!quality_config.enabled) {
+        setRenderQuality(RENDER_QUALITY_FULL);
+        return;
+    }
+    if (E.render_quality == RENDER_QUALITY_MINIMAL) return;
+    if (getMonotonicMs() - last_quality_change_ms < quality_config.hold_ms) return;
+
+    RenderPipelineStats st;
+    renderGetStats(&st);
+    if (st.frames_written == 0) return;
+
+    bool slow = st.flush_ms_avg > quality_config.latency_ms;
+    bool narrow = quality_config.min_kbps > 0 && st.write_kbps_avg > 0 &&
+                  st.write_kbps_avg < quality_config.min_kbps;
+    if (slow || narrow) setRenderQuality(E.render_quality + 1);
+}
+
+// Called from the editorReadKey wait loop on every read timeout. Restores
+// full quality once input has gone idle and redraws with it.
+void renderIdleTick(void) {
+    if (E.render_quality == RENDER_QUALITY_FULL) return;
+    if (getMonotonicMs() - last_submit_ms < quality_config.idle_ms) return;
+    if (editorInputPending()) return;
+
+    setRenderQuality(RENDER_QUALITY_FULL);
+    editorRefreshScreen();
+}
+
+void renderGetQualityConfig(RenderQualityConfig *out) {
+    *out = quality_config;
+}
+
+void renderSetQualityConfig(const RenderQualityConfig *cfg) {
+    quality_config = *cfg;
+    if (!quality_config.enabled) setRenderQuality(RENDER_QUALITY_FULL);
+}
+
+const char *renderQualityName(enum editorRenderQuality quality) {
+    switch (quality) {
+        case RENDER_QUALITY_REDUCED: return "reduced";
+        case RENDER_QUALITY_MINIMAL: return "minimal";
+        case RENDER_QUALITY_FULL:
+        default: return "full";
+    }
+}
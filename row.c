@@ -1,43 +1,167 @@
 #include "kilo.h"
+#include "unicode.h"
+#include "hllayer.h"
 
 
+/*
+ * Converts a byte index into chars to a screen column.
+ * Tabs advance to the next tab stop; non-ASCII rows use the cell width map.
+ */
 int editorRowCxToRx(erow *row, int cx) {
   int rx = 0;
   int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
-      rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-    rx++;
+  if (row->ascii) {
+    for (j = 0; j < cx; j++) {
+      if (row->chars[j] == '\t')
+        rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+      rx++;
+    }
+    return rx;
+  }
+
+  int ri = 0; // Matching index into render/cell_width
+  for (j = 0; j < cx && j < row->size; j++) {
+    if (row->chars[j] == '\t') {
+      int spaces = KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+      rx += spaces;
+      ri += spaces;
+    } else {
+      rx += row->cell_width[ri++];
+    }
   }
   return rx;
 }
 
+// Converts a screen column back to a byte index into chars (a character start)
 int editorRowRxToCx(erow *row, int rx) {
   int cur_rx = 0;
   int cx;
+  if (row->ascii) {
+    for (cx = 0; cx < row->size; cx++) {
+      if (row->chars[cx] == '\t')
+        cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
+      cur_rx++;
+      if (cur_rx > rx) return cx;
+    }
+    return cx;
+  }
+
+  int ri = 0;
   for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t')
-      cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-    cur_rx++;
+    if (row->chars[cx] == '\t') {
+      int spaces = KILO_TAB_STOP - (cur_rx % KILO_TAB_STOP);
+      cur_rx += spaces;
+      ri += spaces;
+    } else {
+      cur_rx += row->cell_width[ri++];
+    }
     if (cur_rx > rx) return cx;
   }
   return cx;
 }
 
+// Converts a byte index into render (e.g. a search match) to one into chars
+int editorRowRenderToCx(erow *row, int render_idx) {
+  int ri = 0, rx = 0;
+  int cx;
+  for (cx = 0; cx < row->size; cx++) {
+    if (row->chars[cx] == '\t') {
+      int spaces = KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+      rx += spaces;
+      ri += spaces;
+    } else {
+      rx += row->ascii ? 1 : row->cell_width[ri];
+      ri++;
+    }
+    if (ri > render_idx) return cx;
+  }
+  return cx;
+}
+
+// Byte index of the character before the one at cx
+int editorRowPrevCx(erow *row, int cx) {
+  if (cx <= 0) return 0;
+  cx--;
+  while (cx > 0 && IS_UTF8_CONT(row->chars[cx])) cx--;
+  return cx;
+}
+
+// Byte index of the character after the one at cx
+int editorRowNextCx(erow *row, int cx) {
+  if (cx >= row->size) return row->size;
+  cx++;
+  while (cx < row->size && IS_UTF8_CONT(row->chars[cx])) cx++;
+  return cx;
+}
+
+// Moves cx back to the start of the character it points into
+int editorRowSnapCx(erow *row, int cx) {
+  if (cx > row->size) cx = row->size;
+  while (cx > 0 && cx < row->size && IS_UTF8_CONT(row->chars[cx])) cx--;
+  return cx;
+}
+
+/*
+ * Builds render and cell_width for a row containing non-ASCII bytes.
+ * Valid sequences are copied as-is; each byte of an invalid sequence or a
+ * C1 control is replaced by '?', so render stays byte-for-byte aligned with
+ * chars (apart from tab expansion). cell_width holds the screen width of
+ * the character starting at each render byte, 0 for continuation bytes.
+ */
+static int editorRenderUtf8(erow *row) {
+    int idx = 0, cells = 0;
+    for (int j = 0; j < row->size; j++) {
+        unsigned char c = (unsigned char)row->chars[j];
+        if (c == '\t') {
+            do {
+                row->render[idx] = ' ';
+                row->cell_width[idx++] = 1;
+                cells++;
+            } while (cells % KILO_TAB_STOP != 0);
+        } else if (c < 0x80) {
+            row->render[idx] = c;
+            row->cell_width[idx++] = 1;
+            cells++;
+        } else {
+            unsigned int cp;
+            int n = utf8Decode(&row->chars[j], row->size - j, &cp);
+            int w = n > 0 ? unicodeWidth(cp) : -1; // -1 also for C1 controls
+            if (w < 0) {
+                row->render[idx] = '?';
+                row->cell_width[idx++] = 1;
+                cells++;
+                continue;
+            }
+            memcpy(&row->render[idx], &row->chars[j], n);
+            row->cell_width[idx] = (unsigned char)w;
+            memset(&row->cell_width[idx + 1], 0, n - 1);
+            idx += n;
+            cells += w;
+            j += n - 1;
+        }
+    }
+    return idx;
+}
+
 
 /*
- * Updates the render buffer and highlighting buffer for a given row.
+ * Updates the render buffer and highlighting for a given row.
  * Expands tabs in chars into spaces in render.
- * Allocates/reallocates hl buffer based on render size.
- * Calls editorUpdateSyntax to fill the hl buffer.
+ * For non-ASCII rows also builds the cell width map used for drawing,
+ * scrolling and cursor placement, so frames never have to decode UTF-8.
+ * Calls editorUpdateSyntax to rebuild its highlighting, using the syntax and
+ * neighbouring rows of `buf`, the buffer the row belongs to.
  */
-void editorUpdateRow(erow *row) {
+void editorUpdateRow(editorBuffer *buf, erow *row) {
     int tabs = 0;
     int j;
+    bool ascii = true;
 
-    // Calculate number of tabs
-    for (j = 0; j < row->size; j++)
+    // Calculate number of tabs and whether the row is plain ASCII
+    for (j = 0; j < row->size; j++) {
         if (row->chars[j] == '\t') tabs++;
+        else if ((unsigned char)row->chars[j] >= 0x80) ascii = false;
+    }
 
     // --- Update Render Buffer ---
     free(row->render); // Free old render buffer (safe if NULL)
@@ -47,46 +171,49 @@ void editorUpdateRow(erow *row) {
     if (!row->render) die("malloc failed for row->render in editorUpdateRow");
 
     int idx = 0; // Current index in row->render
-    // Fill render buffer, expanding tabs
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' '; // Append first space for the tab
-            while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' '; // Append spaces until tab stop
-        } else {
-            row->render[idx++] = row->chars[j]; // Copy normal character
+    row->ascii = ascii;
+    if (ascii) {
+        free(row->cell_width); // ASCII rows are one cell per byte
+        row->cell_width = NULL;
+        // Fill render buffer, expanding tabs
+        for (j = 0; j < row->size; j++) {
+            if (row->chars[j] == '\t') {
+                row->render[idx++] = ' '; // Append first space for the tab
+                while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' '; // Append spaces until tab stop
+            } else {
+                row->render[idx++] = row->chars[j]; // Copy normal character
+            }
         }
+    } else {
+        row->cell_width = realloc(row->cell_width, row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+        if (!row->cell_width) die("realloc failed for row->cell_width in editorUpdateRow");
+        idx = editorRenderUtf8(row);
     }
     row->render[idx] = '\0'; // Null-terminate render string
     row->rsize = idx;        // Store final render size
+    row->version++;          // Cached encodings of this row are now stale
 
-    // Allocate or resize the 'hl' buffer to match the render size 'rsize'.
-    // Using realloc handles both initial allocation (if row->hl is NULL)
-    // and resizing if the render size changed from a previous update.
-    row->hl = realloc(row->hl, row->rsize);
-    // Check if realloc failed (returns NULL) but only if size > 0
-    if (row->hl == NULL && row->rsize > 0) {
-         die("realloc failed for row->hl in editorUpdateRow");
-    }
-
-    // IMPORTANT: Initialize the allocated/reallocated memory.
-    // Set all highlight bytes to HL_NORMAL by default before syntax is applied.
-    // This prevents reading uninitialized memory later if editorUpdateSyntax doesn't cover every byte.
-    if (row->hl) { // Check if hl is valid (allocation succeeded or rsize was 0)
-         memset(row->hl, HL_NORMAL, row->rsize);
-    }
-
-    editorUpdateSyntax(row);
+    // Highlighting (hl or hl_spans) is rebuilt for the new render
+    editorUpdateSyntax(buf, row);
 }
 
 void editorFreeRow(erow *row) {
   free(row->render);
   free(row->chars);
   free(row->hl);
+  free(row->hl_spans);
+  free(row->render_cache.bytes);
+  free(row->cell_width);
 }
 
 void editorDelRow(int at) {
   if (!E.current_buffer || at < 0 || at >= E.numrows) return;
   
+  editorBuffer *buf = E.current_buffer;
+  if (E.row[at].hl_stale) buf->hl_stale_rows--;
+  if (at < buf->hl_stale_from) buf->hl_stale_from--;
+  editorInvalidateSyntaxCheckpoints(buf, at - 1); // Rows below move up
+  highlightLayerShiftRows(buf, at, -1);
   editorFreeRow(&E.row[at]);
   memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
   
@@ -107,7 +234,7 @@ void editorRowInsertChar(erow *row, int at, int c) {
   memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
   row->size++;
   row->chars[at] = c;
-  editorUpdateRow(row);
+  editorUpdateRow(E.current_buffer, row);
   
   E.dirty++;
   if (E.current_buffer) E.current_buffer->dirty = E.dirty;
@@ -119,7 +246,7 @@ void editorRowAppendString(erow *row, char *s, size_t len) {
   memcpy(&row->chars[row->size], s, len);
   row->size += len;
   row->chars[row->size] = '\0';
-  editorUpdateRow(row);
+  editorUpdateRow(E.current_buffer, row);
   
   E.dirty++;
   if (E.current_buffer) E.current_buffer->dirty = E.dirty;
@@ -130,7 +257,7 @@ void editorRowDelChar(erow *row, int at) {
   
   memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
   row->size--;
-  editorUpdateRow(row);
+  editorUpdateRow(E.current_buffer, row);
   
   E.dirty++;
   if (E.current_buffer) E.current_buffer->dirty = E.dirty;
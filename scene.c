@@ -0,0 +1,281 @@
+#include "kilo.h"
+#include "k_lua.h"
+#include "scene.h"
+#include "render.h"
+#include "overlay.h"
+#include "luamemo.h"
+
+/**
+ * Scene Graph
+ *
+ * Everything drawn on screen is a node of one retained scene graph: the
+ * components laid out by calculateLayout (text area, bars, panel, Lua
+ * components) and the overlays that place themselves (directory panel,
+ * navigator, debug log). Nodes are kept sorted by z-index on insert, so
+ * there is a single traversal order for layout, culling and drawing.
+ *
+ * Each node keeps the output of its last draw. A frame only redraws the
+ * nodes that are dirty: marked explicitly, moved or resized by the layout,
+ * or depending on a domain (text, status message, tree, style) that was
+ * touched since they were drawn. Clean nodes replay their retained output,
+ * so every frame still paints the whole screen and a frame dropped by the
+ * render thread loses nothing.
+ */
+
+SceneGraph scene;
+
+void sceneInit(void) {
+    memset(&scene, 0, sizeof(scene));
+    scene.node_capacity = 10;
+    scene.nodes = malloc(sizeof(SceneNode) * scene.node_capacity);
+    if (!scene.nodes) die("sceneInit");
+    scene.layout_dirty = true;
+    scene.theme_generation = E.theme_generation;
+}
+
+static void freeNodeMemo(SceneNode *node) {
+    if (!node->memo) return;
+    luaMemoFree(node->memo);
+    free(node->memo);
+    node->memo = NULL;
+}
+
+void sceneFree(void) {
+    for (int i = 0; i < scene.node_count; i++) {
+        free(scene.nodes[i].name);
+        free(scene.nodes[i].output);
+        freeNodeMemo(&scene.nodes[i]);
+    }
+    free(scene.nodes);
+    scene.nodes = NULL;
+    scene.node_count = 0;
+    scene.node_capacity = 0;
+}
+
+// Re-point the quick references after nodes moved in the array
+static void updateQuickReferences(void) {
+    scene.textarea = NULL;
+    scene.statusbar = NULL;
+    scene.tabline = NULL;
+    scene.messagebar = NULL;
+    scene.panel = NULL;
+
+    for (int i = 0; i < scene.node_count; i++) {
+        SceneNode *node = &scene.nodes[i];
+        if (node->type == COMPONENT_OVERLAY) continue;
+        if (strcmp(node->name, "textarea") == 0) {
+            scene.textarea = node;
+        } else if (strcmp(node->name, "statusbar") == 0) {
+            scene.statusbar = node;
+        } else if (strcmp(node->name, "tabline") == 0) {
+            scene.tabline = node;
+        } else if (strcmp(node->name, "messagebar") == 0) {
+            scene.messagebar = node;
+        } else if (strcmp(node->name, "panel") == 0) {
+            scene.panel = node;
+        }
+    }
+}
+
+/**
+ * @brief Adds a node, keeping the array sorted by z-index.
+ *
+ * Nodes with equal z-index stay in insertion order. The node starts
+ * visible, dirty and redrawn every frame (SCENE_DEP_ALWAYS); callers narrow
+ * its dependencies. Pointers to other nodes are invalidated.
+ * @return The new node, or NULL if out of memory.
+ */
+SceneNode *sceneInsertNode(const char *name, ComponentType type, ComponentPosition position, int z_index) {
+    if (scene.node_count >= scene.node_capacity) {
+        int new_capacity = scene.node_capacity ? scene.node_capacity * 2 : 10;
+        SceneNode *grown = realloc(scene.nodes, sizeof(SceneNode) * new_capacity);
+        if (!grown) {
+            debug_printf("Failed to allocate memory for scene nodes");
+            return NULL;
+        }
+        scene.nodes = grown;
+        scene.node_capacity = new_capacity;
+    }
+
+    // Insert after the last node with the same or lower z-index
+    int at = scene.node_count;
+    while (at > 0 && scene.nodes[at - 1].z_index > z_index) at--;
+    memmove(&scene.nodes[at + 1], &scene.nodes[at], sizeof(SceneNode) * (scene.node_count - at));
+    scene.node_count++;
+
+    SceneNode *node = &scene.nodes[at];
+    memset(node, 0, sizeof(*node));
+    node->name = strdup(name);
+    node->type = type;
+    node->position = position;
+    node->visible = true;
+    node->z_index = z_index;
+    node->lua_callback_ref = LUA_NOREF;
+    node->hint_width = -1;
+    node->hint_height = -1;
+    node->depends = SCENE_DEP_ALWAYS;
+    node->dirty = true;
+
+    updateQuickReferences();
+    return node;
+}
+
+// Removes a node and frees its retained output. Pointers to nodes are invalidated.
+void sceneRemoveNode(SceneNode *node) {
+    int i = (int)(node - scene.nodes);
+    if (i < 0 || i >= scene.node_count) return;
+
+    free(node->name);
+    free(node->output);
+    freeNodeMemo(node);
+    scene.node_count--;
+    memmove(&scene.nodes[i], &scene.nodes[i + 1], sizeof(SceneNode) * (scene.node_count - i));
+    updateQuickReferences();
+}
+
+// Find an overlay node by the state pointer it was activated with
+SceneNode *sceneFindNodeByState(const void *state) {
+    for (int i = 0; i < scene.node_count; i++) {
+        if (scene.nodes[i].type == COMPONENT_OVERLAY && scene.nodes[i].state == state) {
+            return &scene.nodes[i];
+        }
+    }
+    return NULL;
+}
+
+// Records that the given SCENE_DEP_* domains changed; nodes depending on
+// them are redrawn on the next frame
+void sceneTouch(unsigned int domains) {
+    scene.epoch++;
+    for (int d = 0; d < SCENE_DEP_DOMAINS; d++) {
+        if (domains & (1u << d)) scene.domain_epoch[d] = scene.epoch;
+    }
+}
+
+// Epoch at which a single SCENE_DEP_* domain last changed
+unsigned long sceneDomainEpoch(unsigned int domain) {
+    for (int d = 0; d < SCENE_DEP_DOMAINS; d++) {
+        if (domain == (1u << d)) return scene.domain_epoch[d];
+    }
+    return 0;
+}
+
+// Forces a node to be redrawn on the next frame
+void sceneMarkDirty(SceneNode *node) {
+    if (node) node->dirty = true;
+}
+
+static bool nodeNeedsDraw(const SceneNode *node) {
+    if (node->dirty || (node->depends & SCENE_DEP_ALWAYS)) return true;
+
+    // Overlays place themselves while drawing; components are placed by the layout
+    if (node->type != COMPONENT_OVERLAY &&
+        (node->x != node->drawn_x || node->y != node->drawn_y ||
+         node->width != node->drawn_width || node->height != node->drawn_height)) {
+        return true;
+    }
+
+    for (int d = 0; d < SCENE_DEP_DOMAINS; d++) {
+        if ((node->depends & (1u << d)) && scene.domain_epoch[d] > node->drawn_epoch) return true;
+    }
+    return false;
+}
+
+// Redraws a node into its retained output
+static void drawNode(SceneNode *node) {
+    struct abuf ab = {NULL, 0};
+    unsigned long epoch = scene.epoch; // Touches made while drawing count for the next frame
+
+    if (node->type == COMPONENT_OVERLAY) {
+        node->width = node->height = 0; // Reported again by the draw function
+        if (node->draw_func) node->draw_func(&ab, node->state);
+    } else {
+        drawComponent(&ab, node);
+    }
+
+    free(node->output);
+    node->output = ab.b;
+    node->output_len = ab.len;
+    node->dirty = false;
+    node->drawn_epoch = epoch;
+    node->drawn_x = node->x;
+    node->drawn_y = node->y;
+    node->drawn_width = node->width;
+    node->drawn_height = node->height;
+}
+
+static bool overlayVisible(void) {
+    for (int i = 0; i < scene.node_count; i++) {
+        if (scene.nodes[i].type == COMPONENT_OVERLAY && scene.nodes[i].visible) return true;
+    }
+    return false;
+}
+
+// At minimal render quality the panel is neither redrawn nor sent again
+// while the terminal still shows it in place: it takes no input, so only
+// the editing area needs to keep up. Not while an overlay may cover it,
+// and not until the frame that last sent it is sure to be written: under
+// load a frame still in the mailbox is replaced by the next one. Until
+// then every frame sends the panel again, so the frame checked is always
+// the newest one that carries it.
+static bool panelHeld(bool overlay_visible) {
+    const SceneNode *panel = scene.panel;
+    return E.render_quality >= RENDER_QUALITY_MINIMAL && panel && panel->visible &&
+           scene.panel_on_screen && !overlay_visible && renderFrameTaken(scene.panel_shown_seq) &&
+           panel->x == scene.panel_shown_x && panel->y == scene.panel_shown_y &&
+           panel->width == scene.panel_shown_width && panel->height == scene.panel_shown_height;
+}
+
+/**
+ * @brief Draws the frame: redraws dirty nodes, then composites all of them.
+ *
+ * Opaque nodes above the text area are brought up to date first so the
+ * text area can skip the cells they hide (see overlayVisibleSpans). The
+ * rest follow in z order. Finally every visible node's output is appended,
+ * lowest z-index first (except a held panel, see panelHeld).
+ */
+void sceneRender(struct abuf *ab) {
+    overlaySyncBuiltins();
+
+    if (scene.theme_generation != E.theme_generation) {
+        scene.theme_generation = E.theme_generation;
+        sceneTouch(SCENE_DEP_STYLE);
+    }
+
+    bool overlay_visible = overlayVisible();
+    bool hold_panel = panelHeld(overlay_visible);
+
+    int text_z = scene.textarea ? scene.textarea->z_index : 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < scene.node_count; i++) {
+            SceneNode *node = &scene.nodes[i];
+            if (!node->visible) continue;
+            bool covers_text = node->opaque && node->z_index > text_z;
+            if (covers_text != (pass == 0)) continue;
+            if (hold_panel && node == scene.panel) continue; // Redrawn once quality is back
+
+            if (nodeNeedsDraw(node)) {
+                drawNode(node);
+                scene.nodes_drawn++;
+            } else {
+                scene.nodes_replayed++;
+            }
+        }
+    }
+
+    for (int i = 0; i < scene.node_count; i++) {
+        SceneNode *node = &scene.nodes[i];
+        if (hold_panel && node == scene.panel) continue;
+        if (node->visible && node->output_len > 0) abAppend(ab, node->output, node->output_len);
+    }
+
+    SceneNode *panel = scene.panel;
+    scene.panel_on_screen = panel && panel->visible && !overlay_visible;
+    if (scene.panel_on_screen && !hold_panel) {
+        scene.panel_shown_x = panel->x;
+        scene.panel_shown_y = panel->y;
+        scene.panel_shown_width = panel->width;
+        scene.panel_shown_height = panel->height;
+        scene.panel_shown_seq = renderNextFrameSeq(); // sceneRender's frame is submitted next
+    }
+}
@@ -1,21 +1,14 @@
 #include "kilo.h"
+#include "hllayer.h"
 
 void editorFindCallback(char *query, int key) {
   static int last_match = -1;
   static int direction = 1;
 
-	static int saved_hl_line;
-	static char *saved_hl = NULL;
-
-	if (saved_hl) {
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
-	}
-
   if (key == '\r' || key == '\x1b') {
     last_match = -1;
     direction = 1;
+    highlightLayerClear(E.current_buffer, HL_LAYER_SEARCH); // Matches are shown while searching only
     return;
   } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
     direction = 1;
@@ -27,6 +20,8 @@ void editorFindCallback(char *query, int key) {
   }
 
   if (last_match == -1) direction = 1;
+  // Every match on screen is drawn over the syntax highlighting
+  highlightLayerSetPattern(E.current_buffer, HL_LAYER_SEARCH, query, HL_MATCH);
   int current = last_match;
   int i;
   for (i = 0; i < E.numrows; i++) {
@@ -40,13 +35,8 @@ void editorFindCallback(char *query, int key) {
     if (match) {
       last_match = current;
       E.cy = current;
-      E.cx = editorRowRxToCx(row, match - row->render);
+      E.cx = editorRowRenderToCx(row, match - row->render);
       // E.rowoff = E.numrows;
-
-			saved_hl_line = current;
-			saved_hl = malloc(row->rsize);
-			memcpy(saved_hl, row->hl, row->rsize);
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
       break;
     }
   }
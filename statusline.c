@@ -0,0 +1,394 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "kilo.h"
+#include "statusline.h"
+#include "luamemo.h"
+#include "unicode.h"
+
+/**
+ * Statusline/tabline templates
+ *
+ * A vim-style template set once from Lua, e.g.
+ *
+ *     kilo.set_statusline_template("%#mode# %mode %>%#file# %file%modified %= %#pos# %line:%col %percent ")
+ *
+ * is compiled into a short list of instructions and evaluated in C on every
+ * frame, without calling into Lua or allocating. Directives:
+ *
+ *   %mode %file %path %modified %ft %line %col %lines %percent   editor state
+ *   %tabs      open buffers (tabline), the active one in the mode colours
+ *   %lua       segments of the Lua callback, for the dynamic parts
+ *   %#role#    colour role: status, mode, file, ft, pos, info, modified
+ *   %> %<      Powerline separators towards the next role
+ *   %=         the rest is right-aligned
+ *   %%         a literal percent sign
+ */
+
+enum {
+    TPL_TEXT,      // Literal text
+    TPL_FIELD,     // Editor state (FIELD_*)
+    TPL_ROLE,      // Switch colour role (ROLE_*)
+    TPL_SEP_RIGHT, // Powerline right arrow from the current role into next_role
+    TPL_SEP_LEFT   // Powerline left arrow from next_role into the current role
+};
+
+enum {
+    FIELD_MODE, FIELD_FILE, FIELD_PATH, FIELD_MODIFIED, FIELD_FT, FIELD_LINE,
+    FIELD_COL, FIELD_LINES, FIELD_PERCENT, FIELD_TABS, FIELD_LUA
+};
+
+enum {
+    ROLE_STATUS, ROLE_MODE, ROLE_FILE, ROLE_FT, ROLE_POS, ROLE_INFO, ROLE_MODIFIED
+};
+
+static const struct { const char *name; unsigned char id; } template_fields[] = {
+    {"mode", FIELD_MODE}, {"file", FIELD_FILE}, {"path", FIELD_PATH},
+    {"modified", FIELD_MODIFIED}, {"ft", FIELD_FT}, {"line", FIELD_LINE},
+    {"col", FIELD_COL}, {"lines", FIELD_LINES}, {"percent", FIELD_PERCENT},
+    {"tabs", FIELD_TABS}, {"lua", FIELD_LUA},
+};
+
+static const struct { const char *name; unsigned char id; } template_roles[] = {
+    {"status", ROLE_STATUS}, {"mode", ROLE_MODE}, {"file", ROLE_FILE}, {"ft", ROLE_FT},
+    {"pos", ROLE_POS}, {"info", ROLE_INFO}, {"modified", ROLE_MODIFIED},
+};
+
+#define SEP_RIGHT "\xEE\x82\xB0" // U+E0B0
+#define SEP_LEFT  "\xEE\x82\xB2" // U+E0B2
+
+StatusTemplate statusline_template = {NULL, NULL, 0, 0, false};
+StatusTemplate tabline_template = {NULL, NULL, 0, 0, false};
+
+// --- Compilation ---
+
+static int lookupName(const char *name, size_t len, bool roles) {
+    size_t count = roles ? sizeof(template_roles) / sizeof(template_roles[0])
+                         : sizeof(template_fields) / sizeof(template_fields[0]);
+    for (size_t i = 0; i < count; i++) {
+        const char *candidate = roles ? template_roles[i].name : template_fields[i].name;
+        if (strlen(candidate) == len && strncmp(candidate, name, len) == 0) {
+            return roles ? template_roles[i].id : template_fields[i].id;
+        }
+    }
+    return -1;
+}
+
+static TemplateOp *addOp(StatusTemplate *tpl, unsigned char code, unsigned char arg) {
+    TemplateOp *op = &tpl->ops[tpl->op_count++];
+    memset(op, 0, sizeof(*op));
+    op->code = code;
+    op->arg = arg;
+    return op;
+}
+
+static void addText(StatusTemplate *tpl, int offset, int len) {
+    TemplateOp *op = addOp(tpl, TPL_TEXT, 0);
+    op->offset = offset;
+    op->len = len;
+
+    // Measure the literal in place
+    char saved = tpl->source[offset + len];
+    tpl->source[offset + len] = '\0';
+    op->width = calculate_visible_length_ansi(tpl->source + offset);
+    tpl->source[offset + len] = saved;
+}
+
+/**
+ * @brief Compiles a template source string into tpl, replacing its
+ * previous contents. On error tpl is left unchanged and a message is
+ * written to err.
+ * @return 0 on success, -1 on error.
+ */
+int compileStatusTemplate(StatusTemplate *tpl, const char *source, char *err, size_t errlen) {
+    StatusTemplate out = {NULL, NULL, 0, -1, false};
+    int n = (int)strlen(source);
+
+    // Every directive and literal run yields at most one op
+    out.source = strdup(source);
+    out.ops = malloc(sizeof(TemplateOp) * (n + 1));
+    if (!out.source || !out.ops) {
+        snprintf(err, errlen, "out of memory");
+        freeStatusTemplate(&out);
+        return -1;
+    }
+
+    int i = 0;
+    while (i < n) {
+        if (source[i] != '%') {
+            int start = i;
+            while (i < n && source[i] != '%') i++;
+            addText(&out, start, i - start);
+            continue;
+        }
+
+        char c = source[i + 1];
+        if (c == '%') {
+            addText(&out, i + 1, 1);
+            i += 2;
+        } else if (c == '=') {
+            if (out.right_start >= 0) {
+                snprintf(err, errlen, "only one %%= is allowed (column %d)", i + 1);
+                freeStatusTemplate(&out);
+                return -1;
+            }
+            out.right_start = out.op_count;
+            i += 2;
+        } else if (c == '>' || c == '<') {
+            TemplateOp *op = addOp(&out, c == '>' ? TPL_SEP_RIGHT : TPL_SEP_LEFT, 0);
+            op->width = calculate_visible_length_ansi(c == '>' ? SEP_RIGHT : SEP_LEFT);
+            i += 2;
+        } else if (c == '#') {
+            const char *name = source + i + 2;
+            const char *end = strchr(name, '#');
+            int role = end ? lookupName(name, end - name, true) : -1;
+            if (role < 0) {
+                snprintf(err, errlen, "unknown colour role at column %d", i + 1);
+                freeStatusTemplate(&out);
+                return -1;
+            }
+            addOp(&out, TPL_ROLE, (unsigned char)role);
+            i = (int)(end - source) + 1;
+        } else if (islower((unsigned char)c)) {
+            int start = i + 1, end = start;
+            while (end < n && islower((unsigned char)source[end])) end++;
+            int field = lookupName(source + start, end - start, false);
+            if (field < 0) {
+                snprintf(err, errlen, "unknown field %%%.*s", end - start, source + start);
+                freeStatusTemplate(&out);
+                return -1;
+            }
+            addOp(&out, TPL_FIELD, (unsigned char)field);
+            if (field == FIELD_LUA) out.uses_lua = true;
+            i = end;
+        } else {
+            snprintf(err, errlen, "unexpected character after %% at column %d", i + 1);
+            freeStatusTemplate(&out);
+            return -1;
+        }
+    }
+    if (out.right_start < 0) out.right_start = out.op_count;
+
+    // Separators blend into the next role set after them
+    unsigned char next = ROLE_STATUS;
+    for (int k = out.op_count - 1; k >= 0; k--) {
+        if (out.ops[k].code == TPL_ROLE) next = out.ops[k].arg;
+        else if (out.ops[k].code == TPL_SEP_RIGHT || out.ops[k].code == TPL_SEP_LEFT) out.ops[k].next_role = next;
+    }
+
+    freeStatusTemplate(tpl);
+    *tpl = out;
+    return 0;
+}
+
+void freeStatusTemplate(StatusTemplate *tpl) {
+    free(tpl->source);
+    free(tpl->ops);
+    tpl->source = NULL;
+    tpl->ops = NULL;
+    tpl->op_count = 0;
+    tpl->right_start = 0;
+    tpl->uses_lua = false;
+}
+
+// --- Evaluation ---
+
+// Where evaluated output goes: an append buffer, or nowhere when only
+// measuring the right-aligned part
+typedef struct TemplateSink {
+    struct abuf *ab;  // NULL: measure only
+    int col;          // Columns used so far
+    int limit;        // Columns available
+    bool full;        // Something didn't fit; the rest is dropped
+    unsigned char role;
+} TemplateSink;
+
+#define THEME_OR(field, fallback) (E.theme.field ? E.theme.field : (fallback))
+
+static void roleColors(unsigned char role, const char **fg, const char **bg) {
+    const char *file_fg = THEME_OR(ui_status_file_fg, "#ffffff");
+    const char *file_bg = THEME_OR(ui_status_file_bg, "#504945");
+    switch (role) {
+        case ROLE_MODE:
+            *fg = THEME_OR(ui_status_mode_fg, "#000000"); *bg = THEME_OR(ui_status_mode_bg, "#98971a"); break;
+        case ROLE_FILE:
+            *fg = file_fg; *bg = file_bg; break;
+        case ROLE_FT:
+            *fg = THEME_OR(ui_status_ft_fg, file_fg); *bg = THEME_OR(ui_status_ft_bg, file_bg); break;
+        case ROLE_POS:
+            *fg = THEME_OR(ui_status_pos_fg, file_fg); *bg = THEME_OR(ui_status_pos_bg, "#665c54"); break;
+        case ROLE_INFO:
+            *fg = THEME_OR(ui_status_info_fg, file_fg); *bg = THEME_OR(ui_status_info_bg, file_bg); break;
+        case ROLE_MODIFIED:
+            *fg = THEME_OR(hl_keyword1_fg, "#fb4934"); *bg = THEME_OR(ui_status_bg, "#282828"); break;
+        default:
+            *fg = THEME_OR(ui_status_fg, "#ebdbb2"); *bg = THEME_OR(ui_status_bg, "#282828"); break;
+    }
+}
+
+static void applyRole(TemplateSink *s) {
+    if (!s->ab) return;
+    const char *fg, *bg;
+    roleColors(s->role, &fg, &bg);
+    applyTrueColor(s->ab, fg, bg);
+}
+
+// Appends text of the given visible width, clipping at the sink's limit
+static void emit(TemplateSink *s, const char *text, int len, int width) {
+    if (s->full) return;
+    if (s->col + width > s->limit) {
+        int fitted = 0;
+        int bytes = calculate_visible_prefix_ansi(text, s->limit - s->col, &fitted);
+        if (bytes > len) bytes = len;
+        if (s->ab) abAppend(s->ab, text, bytes);
+        s->col += fitted;
+        s->full = true;
+        return;
+    }
+    if (s->ab) abAppend(s->ab, text, len);
+    s->col += width;
+}
+
+static void emitString(TemplateSink *s, const char *text) {
+    emit(s, text, (int)strlen(text), calculate_visible_length_ansi(text));
+}
+
+static void emitTabs(TemplateSink *s) {
+    unsigned char role = s->role;
+    for (editorBuffer *b = E.buffer_list_head; b && !s->full; b = b->next) {
+        bool active = (b == E.current_buffer);
+        int dirty = active ? E.dirty : b->dirty;
+        const char *name = b->filename ? findBasename(b->filename) : NULL;
+
+        s->role = active ? ROLE_MODE : ROLE_FILE;
+        applyRole(s);
+        char label[128];
+        snprintf(label, sizeof(label), " %s%s ", name ? name : "[No Name]", dirty ? "[+]" : "");
+        emitString(s, label);
+    }
+    s->role = role;
+    applyRole(s);
+}
+
+static void emitLuaSegments(TemplateSink *s, const LuaMemo *dynamic) {
+    if (!dynamic) return;
+    const char *role_fg, *role_bg;
+    roleColors(s->role, &role_fg, &role_bg);
+    for (int i = 0; i < dynamic->segment_count && !s->full; i++) {
+        const LuaMemoSegment *seg = &dynamic->segments[i];
+        if (seg->line != 0) continue;
+        if (s->ab) {
+            applyTrueColor(s->ab, luaMemoColor(seg->fg, seg->fg_hex, role_fg),
+                           luaMemoColor(seg->bg, seg->bg_hex, role_bg));
+        }
+        emit(s, seg->text, seg->len, seg->width);
+    }
+    applyRole(s);
+}
+
+static void emitField(TemplateSink *s, unsigned char field, const LuaMemo *dynamic) {
+    char buf[64];
+    const char *text = buf;
+    switch (field) {
+        case FIELD_MODE:
+            text = E.mode == MODE_INSERT ? "INSERT" : E.mode == MODE_NORMAL ? "NORMAL" : "???";
+            break;
+        case FIELD_FILE:
+            text = E.filename ? findBasename(E.filename) : "[No Name]";
+            break;
+        case FIELD_PATH:
+            text = E.filename ? E.filename : "[No Name]";
+            break;
+        case FIELD_MODIFIED:
+            text = E.dirty ? "[+]" : "";
+            break;
+        case FIELD_FT:
+            text = E.syntax && E.syntax->filetype ? E.syntax->filetype : "[no ft]";
+            break;
+        case FIELD_LINE:
+            snprintf(buf, sizeof(buf), "%d", E.cy + 1);
+            break;
+        case FIELD_COL:
+            snprintf(buf, sizeof(buf), "%d", E.rx + 1);
+            break;
+        case FIELD_LINES:
+            snprintf(buf, sizeof(buf), "%d", E.numrows);
+            break;
+        case FIELD_PERCENT:
+            snprintf(buf, sizeof(buf), "%d%%", E.numrows > 0 ? (E.cy + 1) * 100 / E.numrows : 100);
+            break;
+        case FIELD_TABS:
+            emitTabs(s);
+            return;
+        case FIELD_LUA:
+            emitLuaSegments(s, dynamic);
+            return;
+        default:
+            return;
+    }
+    if (text) emitString(s, text);
+}
+
+static void runOps(TemplateSink *s, const StatusTemplate *tpl, int from, int to, const LuaMemo *dynamic) {
+    for (int i = from; i < to; i++) {
+        const TemplateOp *op = &tpl->ops[i];
+        switch (op->code) {
+            case TPL_TEXT:
+                emit(s, tpl->source + op->offset, op->len, op->width);
+                break;
+            case TPL_FIELD:
+                emitField(s, op->arg, dynamic);
+                break;
+            case TPL_ROLE:
+                s->role = op->arg;
+                applyRole(s);
+                break;
+            case TPL_SEP_RIGHT:
+            case TPL_SEP_LEFT: {
+                const char *cur_fg, *cur_bg, *next_fg, *next_bg;
+                roleColors(s->role, &cur_fg, &cur_bg);
+                roleColors(op->next_role, &next_fg, &next_bg);
+                if (s->ab) {
+                    if (op->code == TPL_SEP_RIGHT) applyTrueColor(s->ab, cur_bg, next_bg);
+                    else applyTrueColor(s->ab, next_bg, cur_bg);
+                }
+                emit(s, op->code == TPL_SEP_RIGHT ? SEP_RIGHT : SEP_LEFT, 3, op->width);
+                applyRole(s);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Draws one line of `width` columns from a compiled template at the
+ * cursor position. The right-aligned part (after %=) is measured first and
+ * the gap is filled with the colours in effect at %=.
+ * @param dynamic Parsed segments of the Lua callback for %lua, or NULL.
+ */
+void drawStatusTemplate(struct abuf *ab, const StatusTemplate *tpl, int width, const LuaMemo *dynamic) {
+    TemplateSink line = {ab, 0, width, false, ROLE_STATUS};
+    applyRole(&line);
+    runOps(&line, tpl, 0, tpl->right_start, dynamic);
+
+    if (tpl->right_start < tpl->op_count) {
+        TemplateSink measure = {NULL, 0, width, false, line.role};
+        runOps(&measure, tpl, tpl->right_start, tpl->op_count, dynamic);
+
+        int right_col = width - measure.col;
+        if (right_col >= line.col && !line.full) {
+            applyRole(&line);
+            abAppendSpaces(ab, right_col - line.col);
+            line.col = right_col;
+            runOps(&line, tpl, tpl->right_start, tpl->op_count, dynamic);
+        }
+    }
+
+    if (line.col < width) {
+        applyRole(&line);
+        abAppendSpaces(ab, width - line.col);
+    }
+    applyThemeDefaultColor(ab);
+}
@@ -1,4 +1,8 @@
+#include <poll.h>
+#include <signal.h>
+
 #include "kilo.h"
+#include "render.h"
 
 
 /*
@@ -6,12 +10,18 @@
  * and terminates the program.
  */
 void die(const char* s) {
+  int saved_errno = errno;
+  // Let the render thread finish its frame first, so nothing paints over
+  // the message (it can't wait for itself if it is the one dying)
+  if (!renderOnRenderThread()) renderShutdown();
+
   // Clear the screen (\x1b[2J) and reposition cursor to top-left (\x1b[H)
   // using ANSI escape sequences.
   write(STDOUT_FILENO, "\x1b[2J", 4);
   write(STDOUT_FILENO, "\x1b[H", 3);
 
   // Print the error message associated with the last system call error (errno)
+  errno = saved_errno;
   perror(s);
   
   exit(1);
@@ -84,6 +94,9 @@ int editorReadKey() {
     while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
         // EAGAIN typically means the read timed out (VMIN=0, VTIME>0), which is expected.
         if (nread == -1 && errno != EAGAIN) die("read");
+        renderIdleTick(); // Restores render quality once input goes idle
+        editorHighlightIdle(); // Catches up on off-screen highlighting
+        if (editorResizePending()) editorRefreshScreen(); // Lay out for the new size
     }
 
     // Check if the character is an escape character (start of escape sequence)
@@ -135,6 +148,24 @@ int editorReadKey() {
     }
 }
 
+/*
+ * Returns true if at least one byte of input is waiting to be read,
+ * without blocking.
+ */
+bool editorInputPending(void) {
+    return editorWaitForInput(0);
+}
+
+// Waits up to timeout_ms for input on stdin. Returns true if some arrived.
+bool editorWaitForInput(int timeout_ms) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    int rc;
+    do {
+        rc = poll(&pfd, 1, timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+    return rc > 0 && (pfd.revents & POLLIN);
+}
+
 /*
  * Tries to get the current cursor position using ANSI escape sequences.
  * Sends "\x1b[6n" (Device Status Report - Cursor Position) and parses the response "\x1b[<row>;<col>R".
@@ -163,10 +194,49 @@ int getCursorPosition(int *rows, int *cols) {
     return 0; // Success
 }
 
+// Set by the SIGWINCH handler, cleared once the layout has picked it up
+static volatile sig_atomic_t resize_pending = 0;
+
+static void handleSigwinch(int sig) {
+    (void)sig;
+    resize_pending = 1;
+}
+
+/*
+ * Installs the SIGWINCH handler. The window size is only re-queried after a
+ * resize (see calculateLayout) instead of with an ioctl on every frame.
+ * SA_RESTART keeps the blocking read in editorReadKey from failing with
+ * EINTR; its read timeout brings the resize to the main loop.
+ */
+void editorInstallResizeHandler(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigwinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) {
+        debug_printf("sigaction(SIGWINCH) failed: %s\n", strerror(errno));
+    }
+}
+
+// True if the window was resized since the last editorConsumeResize()
+bool editorResizePending(void) {
+    return resize_pending != 0;
+}
+
+// Returns whether the window was resized and clears the flag
+bool editorConsumeResize(void) {
+    if (!resize_pending) return false;
+    resize_pending = 0;
+    return true;
+}
+
 /*
  * Tries to get the terminal window size.
  * First attempts using ioctl(TIOCGWINSZ). If that fails, falls back
- * to moving the cursor far down-right and querying its position.
+ * to moving the cursor far down-right and querying its position, but only
+ * before the render thread starts: after that the query would interleave
+ * with the frame being written and its reply read could swallow typed keys.
  * Returns 0 on success, -1 on failure.
  */
 int getWindowSize(int *rows, int *cols) {
@@ -177,6 +247,7 @@ int getWindowSize(int *rows, int *cols) {
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
         // Fallback: Move cursor far right (\x1b[999C) and far down (\x1b[999B),
         // then query its position. Terminals usually cap the position at the edge.
+        if (renderThreadRunning()) return -1; // Callers keep the size they had
         if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12) return -1;
         return getCursorPosition(rows, cols); // Use the fallback position query
     } else {
@@ -185,4 +256,73 @@ int getWindowSize(int *rows, int *cols) {
         *rows = ws.ws_row;
         return 0;
     }
-}
\ No newline at end of file
+}
+/*
+ * Asks the terminal whether it supports synchronized output (DEC private
+ * mode 2026). DECRQM "CSI ? 2026 $ p" is answered with "CSI ? 2026 ; Ps $ y",
+ * where Ps 1 or 2 means the mode is known. Terminals that don't know DECRQM
+ * stay silent, so the query is followed by DA1 ("CSI c"), which every
+ * terminal answers: once that reply is in, no 2026 answer is coming.
+ * Requires raw mode.
+ */
+static bool querySyncOutputSupport(void) {
+    const char *query = "\x1b[?2026$p\x1b[c";
+    char buf[128];
+    int len = 0;
+    bool supported = false;
+
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) return false;
+    if (write(STDOUT_FILENO, query, strlen(query)) != (ssize_t)strlen(query)) return false;
+
+    double deadline = getMonotonicMs() + 200;
+    while (len < (int)sizeof(buf) - 1) {
+        int remaining = (int)(deadline - getMonotonicMs());
+        if (remaining <= 0 || !editorWaitForInput(remaining)) break;
+        if (read(STDIN_FILENO, &buf[len], 1) != 1) continue;
+        len++;
+        buf[len] = '\0';
+
+        char *mode = strstr(buf, "\x1b[?2026;");
+        if (mode && strchr(mode, 'y')) {
+            char ps = mode[strlen("\x1b[?2026;")];
+            supported = (ps == '1' || ps == '2');
+        }
+        // DA1 reply "CSI ? ... c" ends the exchange
+        char *da = strrchr(buf, '\x1b');
+        if (da && buf[len - 1] == 'c' && da[1] == '[' && da[2] == '?') break;
+    }
+    return supported;
+}
+
+/*
+ * Works out which optional control sequences the terminal supports from $TERM.
+ * ECH (erase characters) arrived with the VT220, so only the oldest and
+ * "dumb" terminals lack it. REP (repeat previous character) is newer and is
+ * only enabled for emulators known to implement it. Synchronized output is
+ * queried from the terminal itself.
+ * The result is stored in E.term_caps and used by fillRect/abAppendSpaces
+ * and editorRefreshScreen.
+ */
+void detectTerminalCapabilities(void) {
+    const char *term = getenv("TERM");
+    E.term_caps = 0;
+
+    if (!term || term[0] == '\0') return;
+
+    if (strcmp(term, "dumb") != 0 && querySyncOutputSupport()) {
+        E.term_caps |= TERM_CAP_SYNC;
+    }
+
+    if (strcmp(term, "dumb") != 0 && strncmp(term, "vt52", 4) != 0 &&
+        strncmp(term, "vt100", 5) != 0 && strcmp(term, "ansi") != 0) {
+        E.term_caps |= TERM_CAP_ECH;
+    }
+
+    static const char *rep_terms[] = { "xterm-kitty", "foot", "wezterm", "contour", NULL };
+    for (int i = 0; rep_terms[i]; i++) {
+        if (strncmp(term, rep_terms[i], strlen(rep_terms[i])) == 0) {
+            E.term_caps |= TERM_CAP_REP;
+            break;
+        }
+    }
+}
@@ -9,6 +9,7 @@
 
 // --- Helper Functions ---
 extern char *trimWhitespace(char *str);
+static void precomputeThemeColors(void);
 
 
 // --- Core Theme Parsing and Loading ---
@@ -143,6 +144,10 @@ void loadTheme(const char *theme_name) {
         // freeThemeColors(); // Clear potentially partially loaded theme
         // parseThemeFile("themes/kilo_dark.theme");
     }
+
+    // Resolve and quantise all theme colours for the current output mode
+    precomputeThemeColors();
+    E.theme_generation++; // Invalidates encoded rows (render cache)
      // After loading, maybe trigger a screen refresh?
      // editorRefreshScreen(); // Needs careful thought about where this is called from
 }
@@ -237,26 +242,276 @@ static int parse_rgb(const char *color_str, int *r, int *g, int *b) {
     }
 }
 
-// Appends ANSI truecolor escape codes to the buffer
-void applyTrueColor(struct abuf *ab, const char *fg_rgb_str, const char *bg_rgb_str) {
-    char buf[64];
+// --- Colour Output Modes and Quantisation ---
+
+// Default xterm values of the 16 ANSI colours. Users can re-theme these in
+// their terminal, so this is only a best guess, but it is the palette
+// 16-colour mode has to aim for.
+static const unsigned char ansi16_palette[16][3] = {
+    {0, 0, 0},       {205, 0, 0},     {0, 205, 0},     {205, 205, 0},
+    {0, 0, 238},     {205, 0, 205},   {0, 205, 205},   {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0},     {0, 255, 0},     {255, 255, 0},
+    {92, 92, 255},   {255, 0, 255},   {0, 255, 255},   {255, 255, 255},
+};
+
+// RGB values of the xterm-256 colour cube (16-231) and grey ramp (232-255).
+// Entries 0-15 are left zero; they are the user-themed ANSI colours and are
+// never chosen by the 256-colour mode.
+static unsigned char xterm256_palette[256][3];
+static int xterm256_palette_ready = 0;
+
+// One resolved theme colour. The escape sequences for the current output
+// mode are built once, so applyTrueColor only has to look the string up and
+// copy bytes instead of re-parsing it with sscanf on every colour change.
+typedef struct ThemeColorCacheEntry {
+    char *key;              // Colour string exactly as passed in ("r,g,b", "#rrggbb", ...)
+    int valid;              // 0 for "default" and unparsable strings
+    unsigned char index256; // Nearest xterm-256 palette entry
+    unsigned char index16;  // Nearest ANSI 16-colour entry
+    char fg_seq[24];        // Foreground escape for outputColorMode()
+    char bg_seq[24];        // Background escape for outputColorMode()
+    unsigned char fg_len, bg_len;
+} ThemeColorCacheEntry;
+
+#define THEME_COLOR_CACHE_SIZE 256 // Must be a power of two
+static ThemeColorCacheEntry theme_color_cache[THEME_COLOR_CACHE_SIZE];
+static int theme_color_cache_count = 0;
+
+static void buildXterm256Palette(void) {
+    static const unsigned char cube_levels[6] = {0, 95, 135, 175, 215, 255};
+    for (int i = 16; i < 232; i++) {
+        int n = i - 16;
+        xterm256_palette[i][0] = cube_levels[(n / 36) % 6];
+        xterm256_palette[i][1] = cube_levels[(n / 6) % 6];
+        xterm256_palette[i][2] = cube_levels[n % 6];
+    }
+    for (int i = 232; i < 256; i++) {
+        unsigned char level = (unsigned char)(8 + (i - 232) * 10);
+        xterm256_palette[i][0] = xterm256_palette[i][1] = xterm256_palette[i][2] = level;
+    }
+    xterm256_palette_ready = 1;
+}
+
+// "Redmean" weighted RGB distance: a cheap approximation of perceived colour
+// difference that weighs red and blue by how bright the pair is. Plain
+// Euclidean RGB distance tends to pick greys for muted theme colours.
+static long perceptualDistance(int r1, int g1, int b1, int r2, int g2, int b2) {
+    long rmean = (r1 + r2) / 2;
+    long dr = r1 - r2, dg = g1 - g2, db = b1 - b2;
+    return (((512 + rmean) * dr * dr) >> 8) + 4 * dg * dg + (((767 - rmean) * db * db) >> 8);
+}
+
+static int nearestPaletteIndex(const unsigned char (*palette)[3], int first, int last, int r, int g, int b) {
+    int best = first;
+    long best_dist = -1;
+    for (int i = first; i <= last; i++) {
+        long d = perceptualDistance(r, g, b, palette[i][0], palette[i][1], palette[i][2]);
+        if (best_dist < 0 || d < best_dist) {
+            best_dist = d;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Mode actually emitted: reduced render quality caps truecolor at 256 colours
+static enum editorColorMode outputColorMode(void) {
+    if (E.render_quality >= RENDER_QUALITY_REDUCED && E.color_mode == COLOR_MODE_TRUECOLOR)
+        return COLOR_MODE_256;
+    return E.color_mode;
+}
+
+// Builds the foreground/background escape sequences for the output mode
+static void buildColorSequences(ThemeColorCacheEntry *entry, int r, int g, int b) {
+    int fg_len, bg_len;
+    switch (outputColorMode()) {
+        case COLOR_MODE_256:
+            fg_len = snprintf(entry->fg_seq, sizeof(entry->fg_seq), "\x1b[38;5;%dm", entry->index256);
+            bg_len = snprintf(entry->bg_seq, sizeof(entry->bg_seq), "\x1b[48;5;%dm", entry->index256);
+            break;
+        case COLOR_MODE_16: {
+            int idx = entry->index16;
+            fg_len = snprintf(entry->fg_seq, sizeof(entry->fg_seq), "\x1b[%dm", idx < 8 ? 30 + idx : 90 + idx - 8);
+            bg_len = snprintf(entry->bg_seq, sizeof(entry->bg_seq), "\x1b[%dm", idx < 8 ? 40 + idx : 100 + idx - 8);
+            break;
+        }
+        case COLOR_MODE_TRUECOLOR:
+        default:
+            fg_len = snprintf(entry->fg_seq, sizeof(entry->fg_seq), "\x1b[38;2;%d;%d;%dm", r, g, b);
+            bg_len = snprintf(entry->bg_seq, sizeof(entry->bg_seq), "\x1b[48;2;%d;%d;%dm", r, g, b);
+            break;
+    }
+    entry->fg_len = (unsigned char)fg_len;
+    entry->bg_len = (unsigned char)bg_len;
+}
+
+// Parses and quantises a colour string into entry (key is left untouched)
+static void resolveThemeColor(ThemeColorCacheEntry *entry, const char *color_str) {
     int r, g, b;
+    if (!parse_rgb(color_str, &r, &g, &b)) {
+        entry->valid = 0;
+        return;
+    }
+    if (!xterm256_palette_ready) buildXterm256Palette();
+    entry->valid = 1;
+    entry->index256 = (unsigned char)nearestPaletteIndex((const unsigned char (*)[3])xterm256_palette, 16, 255, r, g, b);
+    entry->index16 = (unsigned char)nearestPaletteIndex(ansi16_palette, 0, 15, r, g, b);
+    buildColorSequences(entry, r, g, b);
+}
+
+static unsigned int hashColorString(const char *s) {
+    unsigned int h = 2166136261u; // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Finds (or resolves and caches) the quantised form of a colour string.
+ *
+ * Theme colours are all resolved up front by loadTheme. Colours coming from
+ * Lua ("#rrggbb" segment colours) are added the first time they are seen.
+ * Once the cache is three quarters full, new strings are resolved into the
+ * caller's scratch entry instead of being cached.
+ */
+static const ThemeColorCacheEntry *lookupThemeColor(const char *color_str, ThemeColorCacheEntry *scratch) {
+    unsigned int mask = THEME_COLOR_CACHE_SIZE - 1;
+    unsigned int i = hashColorString(color_str) & mask;
+
+    while (theme_color_cache[i].key) {
+        if (strcmp(theme_color_cache[i].key, color_str) == 0) return &theme_color_cache[i];
+        i = (i + 1) & mask;
+    }
+
+    if (theme_color_cache_count < THEME_COLOR_CACHE_SIZE * 3 / 4) {
+        char *key = strdup(color_str);
+        if (key) {
+            ThemeColorCacheEntry *entry = &theme_color_cache[i];
+            entry->key = key;
+            resolveThemeColor(entry, color_str);
+            theme_color_cache_count++;
+            return entry;
+        }
+    }
+
+    resolveThemeColor(scratch, color_str);
+    return scratch;
+}
+
+static void clearThemeColorCache(void) {
+    for (int i = 0; i < THEME_COLOR_CACHE_SIZE; i++) {
+        free(theme_color_cache[i].key);
+    }
+    memset(theme_color_cache, 0, sizeof(theme_color_cache));
+    theme_color_cache_count = 0;
+}
+
+// Resolves every colour of the current theme so drawing never parses one
+static void precomputeThemeColors(void) {
+    clearThemeColorCache();
+    const char *colors[] = {
+        E.theme.hl_normal_fg, E.theme.hl_normal_bg,
+        E.theme.hl_comment_fg, E.theme.hl_comment_bg,
+        E.theme.hl_mlcomment_fg, E.theme.hl_mlcomment_bg,
+        E.theme.hl_keyword1_fg, E.theme.hl_keyword1_bg,
+        E.theme.hl_keyword2_fg, E.theme.hl_keyword2_bg,
+        E.theme.hl_keyword3_fg, E.theme.hl_keyword3_bg,
+        E.theme.hl_type_fg, E.theme.hl_type_bg,
+        E.theme.hl_builtin_fg, E.theme.hl_builtin_bg,
+        E.theme.hl_string_fg, E.theme.hl_string_bg,
+        E.theme.hl_number_fg, E.theme.hl_number_bg,
+        E.theme.hl_match_fg, E.theme.hl_match_bg,
+        E.theme.ui_background_bg,
+        E.theme.ui_lineno_fg, E.theme.ui_lineno_bg,
+        E.theme.ui_status_fg, E.theme.ui_status_bg,
+        E.theme.ui_message_fg, E.theme.ui_message_bg,
+        E.theme.ui_tilde_fg, E.theme.ui_tilde_bg,
+        E.theme.ui_status_mode_fg, E.theme.ui_status_mode_bg,
+        E.theme.ui_status_file_fg, E.theme.ui_status_file_bg,
+        E.theme.ui_status_info_fg, E.theme.ui_status_info_bg,
+        E.theme.ui_status_ft_fg, E.theme.ui_status_ft_bg,
+        E.theme.ui_status_pos_fg, E.theme.ui_status_pos_bg,
+        E.theme.ui_status_sep_fg, E.theme.ui_status_sep_bg,
+    };
+    ThemeColorCacheEntry scratch;
+    for (size_t i = 0; i < sizeof(colors) / sizeof(colors[0]); i++) {
+        if (colors[i]) lookupThemeColor(colors[i], &scratch);
+    }
+}
+
+/**
+ * @brief Picks the colour output mode from the environment.
+ *
+ * $COLORTERM=truecolor/24bit (or a "-direct" terminfo name) means 24-bit
+ * colour, a $TERM ending in "256color" means the xterm-256 palette. Plain
+ * xterm, screen and tmux also get the 256-colour palette: they support it
+ * in practice, and COLORTERM is often lost over ssh. Anything else (dumb,
+ * the linux console, unknown terminals) falls back to the 16 ANSI colours.
+ */
+enum editorColorMode detectColorMode(void) {
+    const char *colorterm = getenv("COLORTERM");
+    const char *term = getenv("TERM");
+
+    if (colorterm && (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0))
+        return COLOR_MODE_TRUECOLOR;
+    if (term && strstr(term, "direct"))
+        return COLOR_MODE_TRUECOLOR;
+    if (term && strstr(term, "256color"))
+        return COLOR_MODE_256;
+    if (term && (strncmp(term, "xterm", 5) == 0 || strncmp(term, "screen", 6) == 0 ||
+                 strncmp(term, "tmux", 4) == 0))
+        return COLOR_MODE_256;
+    return COLOR_MODE_16;
+}
+
+// Switches the output mode and rebuilds the cached escape sequences
+void setColorMode(enum editorColorMode mode) {
+    if (E.color_mode == mode) return;
+    E.color_mode = mode;
+    rebuildThemeColors();
+}
+
+// Rebuilds the cached escape sequences after the output mode or render
+// quality changed, and invalidates encoded rows
+void rebuildThemeColors(void) {
+    precomputeThemeColors();
+    E.theme_generation++;
+}
+
+const char *colorModeName(enum editorColorMode mode) {
+    switch (mode) {
+        case COLOR_MODE_256: return "256";
+        case COLOR_MODE_16: return "16";
+        case COLOR_MODE_TRUECOLOR:
+        default: return "truecolor";
+    }
+}
+
+// Appends the colour escape codes for the current output mode to the buffer
+void applyTrueColor(struct abuf *ab, const char *fg_rgb_str, const char *bg_rgb_str) {
+    ThemeColorCacheEntry scratch;
 
     // Apply Foreground
-    if (parse_rgb(fg_rgb_str, &r, &g, &b)) {
-        snprintf(buf, sizeof(buf), "\x1b[38;2;%d;%d;%dm", r, g, b);
-        abAppend(ab, buf, strlen(buf));
-    } else if (fg_rgb_str && strcmp(fg_rgb_str, "default") == 0) {
-        abAppend(ab, "\x1b[39m", 5); // Default FG
-    } // Else: If NULL or parse failed, do nothing to FG
+    if (fg_rgb_str) {
+        const ThemeColorCacheEntry *fg = lookupThemeColor(fg_rgb_str, &scratch);
+        if (fg->valid) {
+            abAppend(ab, fg->fg_seq, fg->fg_len);
+        } else if (strcmp(fg_rgb_str, "default") == 0) {
+            abAppend(ab, "\x1b[39m", 5); // Default FG
+        } // Else: parse failed, do nothing to FG
+    }
 
     // Apply Background
-    if (parse_rgb(bg_rgb_str, &r, &g, &b)) {
-        snprintf(buf, sizeof(buf), "\x1b[48;2;%d;%d;%dm", r, g, b);
-        abAppend(ab, buf, strlen(buf));
-    } else if (bg_rgb_str && strcmp(bg_rgb_str, "default") == 0) {
-        abAppend(ab, "\x1b[49m", 5); // Default BG
-    } // Else: If NULL or parse failed, do nothing to BG
+    if (bg_rgb_str) {
+        const ThemeColorCacheEntry *bg = lookupThemeColor(bg_rgb_str, &scratch);
+        if (bg->valid) {
+            abAppend(ab, bg->bg_seq, bg->bg_len);
+        } else if (strcmp(bg_rgb_str, "default") == 0) {
+            abAppend(ab, "\x1b[49m", 5); // Default BG
+        } // Else: parse failed, do nothing to BG
+    }
 }
 
 // Helper to reset colors to theme's normal/default
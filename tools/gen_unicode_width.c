@@ -0,0 +1,86 @@
+/*
+ * Generates include/unicode_width_table.h, the two-level code point width
+ * table used by unicode.c, from the C library's wcwidth() in a UTF-8 locale.
+ *
+ * The header is committed and not rebuilt by the normal build. Regenerate it
+ * by hand after changing this file, in a UTF-8 locale:
+ *   make unicode-table
+ * or equivalently:
+ *   cc -std=c99 -O2 tools/gen_unicode_width.c -o gen_unicode_width
+ *   ./gen_unicode_width > include/unicode_width_table.h
+ *
+ * Widths are packed two bits per code point: 0, 1, 2, or 3 for characters
+ * that must not be drawn (C0/C1 controls, DEL). Code points the C library
+ * does not know are recorded as width 1. The code space is split into
+ * blocks of UNICODE_WIDTH_BLOCK code points; identical blocks are stored
+ * once and the first level maps each block number to its stored copy.
+ */
+#define _XOPEN_SOURCE 700
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define MAX_CODEPOINT 0x110000
+#define BLOCK_SIZE 256
+#define BLOCK_BYTES (BLOCK_SIZE / 4)
+#define NUM_BLOCKS (MAX_CODEPOINT / BLOCK_SIZE)
+
+static int widthClass(unsigned int cp) {
+    if (cp < 0x20 || (cp >= 0x7F && cp < 0xA0)) return 3;
+    if (cp >= 0xD800 && cp <= 0xDFFF) return 3; // Surrogates never decode
+    int w = wcwidth((wchar_t)cp);
+    if (w < 0) return 1;
+    return w > 2 ? 2 : w;
+}
+
+int main(void) {
+    static unsigned char blocks[NUM_BLOCKS][BLOCK_BYTES];
+    static int block_index[NUM_BLOCKS];
+    int unique = 0;
+
+    if (!setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, "en_US.UTF-8")) {
+        fprintf(stderr, "gen_unicode_width: no UTF-8 locale available\n");
+        return 1;
+    }
+
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        unsigned char packed[BLOCK_BYTES] = {0};
+        for (int i = 0; i < BLOCK_SIZE; i++) {
+            int w = widthClass((unsigned int)(b * BLOCK_SIZE + i));
+            packed[i / 4] |= (unsigned char)(w << ((i % 4) * 2));
+        }
+        int found = -1;
+        for (int u = 0; u < unique; u++) {
+            if (memcmp(blocks[u], packed, BLOCK_BYTES) == 0) { found = u; break; }
+        }
+        if (found < 0) {
+            memcpy(blocks[unique], packed, BLOCK_BYTES);
+            found = unique++;
+        }
+        block_index[b] = found;
+    }
+    if (unique > 256) {
+        fprintf(stderr, "gen_unicode_width: %d unique blocks do not fit a byte index\n", unique);
+        return 1;
+    }
+
+    printf("/* Generated by tools/gen_unicode_width.c -- do not edit. */\n");
+    printf("#ifndef UNICODE_WIDTH_TABLE_H\n#define UNICODE_WIDTH_TABLE_H\n\n");
+    printf("#define UNICODE_WIDTH_BLOCK %d\n", BLOCK_SIZE);
+    printf("#define UNICODE_WIDTH_BLOCKS %d\n\n", NUM_BLOCKS);
+    printf("static const unsigned char unicode_width_index[UNICODE_WIDTH_BLOCKS] = {");
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        printf("%s%d,", b % 24 == 0 ? "\n    " : "", block_index[b]);
+    }
+    printf("\n};\n\n");
+    printf("static const unsigned char unicode_width_blocks[%d][UNICODE_WIDTH_BLOCK / 4] = {\n", unique);
+    for (int u = 0; u < unique; u++) {
+        printf("    {");
+        for (int i = 0; i < BLOCK_BYTES; i++) printf("%s0x%02x,", i % 16 == 0 && i ? "\n     " : "", blocks[u][i]);
+        printf("},\n");
+    }
+    printf("};\n\n#endif // UNICODE_WIDTH_TABLE_H\n");
+    return 0;
+}
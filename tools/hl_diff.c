@@ -0,0 +1,554 @@
+/*
+ * Differential check for the syntax highlighter. Each file is highlighted
+ * through every path highlighting.c has, and every row's HL_* bytes and
+ * hl_open_comment are compared with a reference highlighter:
+ *
+ *   sequential  select the syntax, then redo all stale rows in order
+ *   idle        select the syntax, then let the idle pass finish the file
+ *               (parallel chunks with speculative comment state), once
+ *               from the top and once scrolled so a chunk starts inside a
+ *               comment and has to be fixed up
+ *   jump        highlight windows deep in the file from checkpoints first,
+ *               then the rest
+ *   edit        open or close a comment near the top and in the middle,
+ *               where the change reaches past the screen and a checkpoint,
+ *               then undo it; each time the screen, a window jumped to at
+ *               that checkpoint and the whole file are checked
+ *   reselect    select the syntax again over already highlighted rows
+ *
+ * The reference is the per-row character loop highlighting.c used before
+ * syntax definitions were compiled into byte classes, unchanged apart from
+ * taking its state as arguments and running top to bottom instead of
+ * recursing into the next row. Any difference is a bug in the new paths.
+ *
+ * Built and run from the repository root (syntax/ is read from there) by:
+ *   make hl-diff
+ * or by hand:
+ *   hl_diff [-n MIN_ROWS] FILE...
+ * Each file is highlighted with the syntax its name selects. Its rows are
+ * repeated until there are at least MIN_ROWS (default 40000), so the
+ * parallel and checkpoint paths are taken. The build wraps sysconf() so
+ * the parallel path runs with HL_DIFF_THREADS workers on any machine.
+ * Exits non-zero at the first difference.
+ */
+#include "kilo.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define HL_DIFF_THREADS 4       // Processors sysconf() reports to highlighting.c
+#define HL_DIFF_MIN_ROWS 40000  // Above the parallel threshold with room for several chunks
+#define HL_DIFF_CHUNK_ROWS 4096 // HL_PARALLEL_CHUNK_ROWS in highlighting.c
+#define HL_DIFF_CHECKPOINT_ROWS 256 // HL_CHECKPOINT_INTERVAL in highlighting.c
+#define HL_DIFF_SCREEN_ROWS 24
+
+struct editorConfig E;
+
+// --- Stubs for what highlighting.c uses from the rest of the editor ---
+
+void die(const char *s) {
+    perror(s);
+    exit(1);
+}
+
+int debug_printf(const char *format, ...) {
+    (void)format;
+    return 0;
+}
+
+void editorUpdateRow(editorBuffer *buf, erow *row) {
+    editorUpdateSyntax(buf, row); // Rows here already have their render text
+}
+
+int debug_overlay_active = 0;
+
+void editorRefreshScreen(void) {
+}
+
+bool editorInputPending(void) {
+    return false; // Never interrupt the idle pass
+}
+
+double getMonotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+long __real_sysconf(int name);
+
+long __wrap_sysconf(int name) {
+    if (name == _SC_NPROCESSORS_ONLN) return HL_DIFF_THREADS;
+    return __real_sysconf(name);
+}
+
+// --- Reference highlighter ---
+
+static int refIsSeparator(int c) {
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];:$", c) != NULL;
+}
+
+// Keyword lists are searched in file order; the first word that matches
+// and is followed by a separator (or the end of the row) wins
+static int refMatchKeyword(const erow *row, unsigned char *hl, int *i, const struct editorSyntax *syntax) {
+    char **lists[] = {syntax->keywords1, syntax->keywords2, syntax->keywords3, syntax->types, syntax->builtins};
+    unsigned char classes[] = {HL_KEYWORD1, HL_KEYWORD2, HL_KEYWORD3, HL_TYPE, HL_BUILTIN};
+    for (int l = 0; l < 5; l++) {
+        for (int j = 0; lists[l] && lists[l][j]; j++) {
+            int len = strlen(lists[l][j]);
+            int end = *i + len;
+            if (len == 0 || end > row->rsize || strncmp(&row->render[*i], lists[l][j], len) != 0) continue;
+            if (end < row->rsize && !refIsSeparator((unsigned char)row->render[end])) continue;
+            memset(&hl[*i], classes[l], len);
+            *i = end;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Highlights one row into `hl` given whether a multi-line comment is open
+// where it starts; returns whether one is open where it ends
+static int refHighlightRow(const erow *row, const struct editorSyntax *syntax, int in_comment, unsigned char *hl) {
+    memset(hl, HL_NORMAL, row->rsize);
+
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    int prev_sep = 1;
+    int in_string = 0;
+
+    int i = 0;
+    while (i < row->rsize) {
+        char c = row->render[i];
+        unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
+
+        if (scs_len && !in_string && !in_comment) {
+            if (i + scs_len <= row->rsize && !strncmp(&row->render[i], scs, scs_len)) {
+                memset(&hl[i], HL_COMMENT, row->rsize - i);
+                break;
+            }
+        }
+
+        if (mcs_len && mce_len && !in_string) {
+            if (in_comment) {
+                hl[i] = HL_MLCOMMENT;
+                if (i + mce_len <= row->rsize && !strncmp(&row->render[i], mce, mce_len)) {
+                    memset(&hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
+                } else {
+                    i++;
+                    prev_sep = 0;
+                    continue;
+                }
+            } else if (i + mcs_len <= row->rsize && !strncmp(&row->render[i], mcs, mcs_len)) {
+                memset(&hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_STRINGS) {
+            if (in_string) {
+                hl[i] = HL_STRING;
+                if (c == '\\' && i + 1 < row->rsize) {
+                    hl[i + 1] = HL_STRING;
+                    i += 2;
+                    prev_sep = 0;
+                    continue;
+                }
+                if (c == in_string) {
+                    in_string = 0;
+                    prev_sep = 1;
+                } else {
+                    prev_sep = 0;
+                }
+                i++;
+                continue;
+            } else if (c == '"' || c == '\'') {
+                in_string = c;
+                hl[i] = HL_STRING;
+                i++;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            if ((isdigit((unsigned char)c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER)) {
+                if (!(c == '.' && i > 0 && row->render[i - 1] == '.')) {
+                    hl[i] = HL_NUMBER;
+                    i++;
+                    prev_sep = 0;
+                    continue;
+                }
+            }
+        }
+
+        if (prev_sep && refMatchKeyword(row, hl, &i, syntax)) {
+            prev_sep = 0;
+            continue;
+        }
+
+        prev_sep = refIsSeparator((unsigned char)c);
+        i++;
+    }
+    return in_comment;
+}
+
+// The reference highlighting of a whole buffer: hl bytes of row r start
+// at bytes + offset[r]
+typedef struct Reference {
+    unsigned char *bytes;
+    size_t *offset;
+    unsigned char *open_comment;
+} Reference;
+
+static void referenceBuild(Reference *ref, const editorBuffer *buf) {
+    size_t total = 0;
+    ref->offset = realloc(ref->offset, (buf->numrows + 1) * sizeof(size_t));
+    ref->open_comment = realloc(ref->open_comment, buf->numrows + 1);
+    if (!ref->offset || !ref->open_comment) die("referenceBuild: realloc failed");
+    for (int r = 0; r < buf->numrows; r++) {
+        ref->offset[r] = total;
+        total += buf->row[r].rsize;
+    }
+    ref->offset[buf->numrows] = total;
+    ref->bytes = realloc(ref->bytes, total + 1);
+    if (!ref->bytes) die("referenceBuild: realloc failed");
+
+    int in_comment = 0;
+    for (int r = 0; r < buf->numrows; r++) {
+        in_comment = refHighlightRow(&buf->row[r], buf->syntax, in_comment, ref->bytes + ref->offset[r]);
+        ref->open_comment[r] = in_comment;
+    }
+}
+
+static void referenceFree(Reference *ref) {
+    free(ref->bytes);
+    free(ref->offset);
+    free(ref->open_comment);
+}
+
+// --- Comparison ---
+
+static const char *current_file;
+static const char *current_check;
+
+static void fail(const char *format, ...) {
+    va_list ap;
+    fprintf(stderr, "hl_diff: %s: %s: ", current_file, current_check);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+// Compares rows first..last of `buf` with the reference
+static void compareRows(const editorBuffer *buf, const Reference *ref, int first, int last) {
+    for (int r = first; r <= last && r < buf->numrows; r++) {
+        const erow *row = &buf->row[r];
+        const unsigned char *want = ref->bytes + ref->offset[r];
+        if (row->hl_stale) fail("row %d is still stale", r);
+
+        erowHlRun run = {0};
+        for (int i = 0; i < row->rsize; i = run.end) {
+            editorHighlightRunAt(row, i, &run);
+            for (int j = i; j < run.end; j++) {
+                if (run.hl != want[j]) fail("row %d byte %d is %d, reference has %d", r, j, run.hl, want[j]);
+            }
+        }
+        if (row->hl_open_comment != ref->open_comment[r]) {
+            fail("row %d open comment is %d, reference has %d", r, row->hl_open_comment, ref->open_comment[r]);
+        }
+    }
+}
+
+static void compareAll(const editorBuffer *buf, const Reference *ref) {
+    if (buf->hl_stale_rows != 0) fail("%d rows are still stale", buf->hl_stale_rows);
+    compareRows(buf, ref, 0, buf->numrows - 1);
+}
+
+// --- Buffer Setup ---
+
+static void appendRow(editorBuffer *buf, const char *s, size_t len) {
+    buf->row = realloc(buf->row, sizeof(erow) * (buf->numrows + 1));
+    if (!buf->row) die("appendRow: realloc failed");
+    erow *row = &buf->row[buf->numrows];
+    memset(row, 0, sizeof(*row));
+    row->idx = buf->numrows;
+    row->render = malloc(len + 1);
+    if (!row->render) die("appendRow: malloc failed");
+    memcpy(row->render, s, len);
+    row->render[len] = '\0';
+    row->rsize = len;
+    buf->numrows++;
+}
+
+// Reads `path` into `buf`, repeating its rows until there are min_rows
+static void loadRows(editorBuffer *buf, const char *path, int min_rows) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) die(path);
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) linelen--;
+        appendRow(buf, line, linelen);
+    }
+    free(line);
+    fclose(fp);
+
+    int file_rows = buf->numrows;
+    while (file_rows > 0 && buf->numrows < min_rows) {
+        for (int r = 0; r < file_rows; r++) appendRow(buf, buf->row[r].render, buf->row[r].rsize);
+    }
+}
+
+static void setRowText(editorBuffer *buf, int at, const char *s, size_t len) {
+    erow *row = &buf->row[at];
+    char *render = malloc(len + 1);
+    if (!render) die("setRowText: malloc failed");
+    memcpy(render, s, len);
+    render[len] = '\0';
+    free(row->render);
+    row->render = render;
+    row->rsize = len;
+}
+
+// Forgets all highlighting, as if the rows had just been read from disk
+static void resetHighlight(editorBuffer *buf) {
+    for (int r = 0; r < buf->numrows; r++) {
+        erow *row = &buf->row[r];
+        free(row->hl);
+        free(row->hl_spans);
+        row->hl = NULL;
+        row->hl_spans = NULL;
+        row->hl_span_count = 0;
+        row->hl_open_comment = 0;
+        row->hl_stale = false;
+    }
+    free(buf->hl_checkpoints);
+    buf->hl_checkpoints = NULL;
+    buf->hl_checkpoint_capacity = 0;
+    E.rowoff = 0;
+    buf->rowoff = 0;
+}
+
+// --- Checks ---
+
+// Highlights the screen starting at `first` the way editorDrawRows does
+// after a jump, and checks just those rows
+static void checkWindow(editorBuffer *buf, const Reference *ref, int first) {
+    E.rowoff = first;
+    editorHighlightRange(buf, first, first + E.screenrows - 1);
+    compareRows(buf, ref, first, first + E.screenrows - 1);
+}
+
+// Row `row`'s text with `marker` in front of it
+static char *markedText(const erow *row, const char *marker, size_t *len) {
+    size_t marker_len = strlen(marker);
+    char *text = malloc(marker_len + row->rsize + 1);
+    if (!text) die("markedText: malloc failed");
+    memcpy(text, marker, marker_len);
+    memcpy(text + marker_len, row->render, row->rsize + 1);
+    *len = marker_len + row->rsize;
+    return text;
+}
+
+// Open-comment state at the end of `row` when the reference highlights it
+static int refRowState(const erow *row, const struct editorSyntax *syntax, int in_comment) {
+    unsigned char *hl = malloc(row->rsize + 1);
+    if (!hl) die("refRowState: malloc failed");
+    in_comment = refHighlightRow(row, syntax, in_comment, hl);
+    free(hl);
+    return in_comment;
+}
+
+// Last row whose open-comment state changes when `marker` is put in front
+// of row `at` (at - 1 if none does)
+static int editReach(const editorBuffer *buf, const Reference *ref, int at, const char *marker) {
+    erow edited = {0};
+    size_t len;
+    edited.render = markedText(&buf->row[at], marker, &len);
+    edited.rsize = len;
+    int in_comment = refRowState(&edited, buf->syntax, at > 0 && ref->open_comment[at - 1]);
+    free(edited.render);
+
+    int r = at;
+    while (in_comment != ref->open_comment[r] && ++r < buf->numrows) {
+        in_comment = refRowState(&buf->row[r], buf->syntax, in_comment);
+    }
+    return r - 1;
+}
+
+// The marker that flips the comment state where row `at` starts
+static const char *editMarker(const editorBuffer *buf, const Reference *ref, int at) {
+    if (at > 0 && ref->open_comment[at - 1]) return buf->syntax->multiline_comment_end;
+    return buf->syntax->multiline_comment_start;
+}
+
+// Scroll offset checkEdit uses while editing row `at`
+static int editRowoff(int at) {
+    return at > 5 ? at - 5 : 0;
+}
+
+// First row from `from` on where an edit changes the open-comment state
+// past the bottom of the screen and across a checkpoint, which is stored
+// in *window. Files without one get `from` and a window further down.
+static int findEditRow(const editorBuffer *buf, const Reference *ref, int from, int *window) {
+    for (int at = from; at < buf->numrows; at++) {
+        const char *marker = editMarker(buf, ref, at);
+        if (!marker) break;
+        int last = editReach(buf, ref, at, marker);
+        int bottom = editRowoff(at) + E.screenrows - 1;
+        int checkpoint = (bottom / HL_DIFF_CHECKPOINT_ROWS + 1) * HL_DIFF_CHECKPOINT_ROWS;
+        if (checkpoint - 1 <= last) {
+            *window = checkpoint;
+            return at;
+        }
+    }
+    *window = buf->numrows - buf->numrows / 5 + 11;
+    return from;
+}
+
+// Flips the comment state at the start of a row from `from` on, checks,
+// then undoes the edit
+static void checkEdit(editorBuffer *buf, Reference *ref, int from) {
+    int window;
+    int at = findEditRow(buf, ref, from, &window);
+    const char *marker = editMarker(buf, ref, at);
+    if (!marker) marker = "\""; // No multi-line comments: open a string instead
+    erow *row = &buf->row[at];
+    size_t old_len = row->rsize;
+    char *old = malloc(old_len + 1);
+    if (!old) die("checkEdit: malloc failed");
+    memcpy(old, row->render, old_len + 1);
+    size_t edited_len;
+    char *edited = markedText(row, marker, &edited_len);
+
+    const char *texts[] = {edited, old};
+    size_t lens[] = {edited_len, old_len};
+    for (int pass = 0; pass < 2; pass++) {
+        E.rowoff = editRowoff(at);
+        setRowText(buf, at, texts[pass], lens[pass]);
+        editorUpdateSyntax(buf, &buf->row[at]);
+        referenceBuild(ref, buf);
+        compareRows(buf, ref, E.rowoff, E.rowoff + E.screenrows - 1); // Redone before the next draw
+
+        checkWindow(buf, ref, window);
+        editorHighlightStaleRows(buf, buf->numrows - 1);
+        compareAll(buf, ref);
+    }
+    free(edited);
+    free(old);
+}
+
+// A scroll offset that puts the start of the second parallel chunk inside
+// a multi-line comment, so the idle pass has to fix that chunk up (0 if
+// the file has no such row)
+static int fixupRowoff(const editorBuffer *buf, const Reference *ref) {
+    for (int rowoff = 0; rowoff < HL_DIFF_CHUNK_ROWS; rowoff++) {
+        int start = rowoff + E.screenrows + HL_DIFF_CHUNK_ROWS;
+        if (start >= buf->numrows) break;
+        if (ref->open_comment[start - 1]) return rowoff;
+    }
+    return 0;
+}
+
+static void checkFile(const char *path, int min_rows) {
+    editorBuffer buf = {0};
+    Reference ref = {0};
+    current_file = path;
+    current_check = "load";
+
+    buf.filename = (char *)path;
+    loadRows(&buf, path, min_rows);
+    E.current_buffer = &buf;
+    E.buffer_list_head = &buf;
+
+    editorSelectSyntaxHighlight(&buf);
+    if (!buf.syntax) fail("no syntax matches the file name");
+    referenceBuild(&ref, &buf);
+
+    current_check = "sequential";
+    resetHighlight(&buf);
+    editorSelectSyntaxHighlight(&buf);
+    editorHighlightStaleRows(&buf, buf.numrows - 1);
+    compareAll(&buf, &ref);
+
+    current_check = "idle";
+    int rowoffs[] = {0, fixupRowoff(&buf, &ref)};
+    for (int i = 0; i < 2; i++) {
+        resetHighlight(&buf);
+        E.rowoff = rowoffs[i];
+        editorSelectSyntaxHighlight(&buf);
+        editorHighlightIdle();
+        compareAll(&buf, &ref);
+    }
+
+    current_check = "jump";
+    resetHighlight(&buf);
+    editorSelectSyntaxHighlight(&buf);
+    checkWindow(&buf, &ref, buf.numrows - buf.numrows / 4 + 37);
+    checkWindow(&buf, &ref, buf.numrows / 2 + 5);
+    checkWindow(&buf, &ref, buf.numrows - E.screenrows);
+    editorHighlightStaleRows(&buf, buf.numrows - 1);
+    compareAll(&buf, &ref);
+
+    current_check = "edit";
+    checkEdit(&buf, &ref, 1);
+    checkEdit(&buf, &ref, buf.numrows / 2 + 3);
+
+    current_check = "reselect";
+    E.rowoff = 0;
+    editorSelectSyntaxHighlight(&buf);
+    editorHighlightIdle();
+    compareAll(&buf, &ref);
+
+    printf("hl_diff: %s: %d rows, %s syntax: ok\n", path, buf.numrows, buf.syntax->filetype);
+
+    resetHighlight(&buf);
+    for (int r = 0; r < buf.numrows; r++) free(buf.row[r].render);
+    free(buf.row);
+    referenceFree(&ref);
+    E.current_buffer = NULL;
+    E.buffer_list_head = NULL;
+}
+
+int main(int argc, char **argv) {
+    int min_rows = HL_DIFF_MIN_ROWS;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        min_rows = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [-n MIN_ROWS] FILE...\n", argv[0]);
+        return 2;
+    }
+
+    loadSyntaxFiles();
+    if (E.num_syntax_defs == 0) {
+        fprintf(stderr, "hl_diff: no syntax definitions loaded (run from the repository root)\n");
+        return 1;
+    }
+    E.screenrows = HL_DIFF_SCREEN_ROWS;
+    for (int i = first; i < argc; i++) checkFile(argv[i], min_rows);
+    freeSyntaxDefs();
+    return 0;
+}
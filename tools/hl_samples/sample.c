@@ -0,0 +1,101 @@
+/* Sample input for tools/hl_diff.c. It covers the cases the highlighter
+ * must keep: comments spanning rows, markers inside strings, escapes,
+ * numbers next to separators and keywords that are prefixes of words. */
+#include <stdio.h>
+#include "kilo.h"
+
+static const char *s = "/* not a comment */ // nor this";
+static const char *t = "escaped \" quote and \\ backslash";
+static char q = '\'', r = '"';
+int integer = 12, x1 = 0x1F, y = 3.14, z = 1..2, w = .5;
+unsigned long long big = 18446744073709551615ULL;
+
+int main(void) { /* comment */ return 0; } /* open
+   still open */ int after = 1;
+for(int i=0;i<10;i++){if(i%2)continue;else break;}
+struct point { int x, y; }; typedef struct point point_t;
+char *u = "unterminated string
+int v = 42; // ends with a backslash \
+*/ this closes nothing; /* * / ** /*/ int ok;
+return_value = sizeof(int)+sizeof(char);
+	/*tab*/	while (1) { if (0) switch (2) { case 3: default: goto end; } }
+end: ;
+/* Disabled: the old row loop, kept for reference.
+static void drawRows(struct abuf *ab) {
+    for (int y = 0; y < E.screenrows; y++) {
+        int filerow = y + E.rowoff;
+        if (filerow >= E.numrows) {
+            abAppend(ab, "~", 1);
+        } else {
+            int len = E.row[filerow].rsize - E.coloff;
+            if (len < 0) len = 0;
+            if (len > E.screencols) len = E.screencols;
+            char *c = &E.row[filerow].render[E.coloff];
+            unsigned char *hl = &E.row[filerow].hl[E.coloff];
+            int current_color = -1;
+            for (int j = 0; j < len; j++) {
+                if (hl[j] == HL_NORMAL) {
+                    if (current_color != -1) {
+                        abAppend(ab, "\x1b[39m", 5);
+                        current_color = -1;
+                    }
+                    abAppend(ab, &c[j], 1);
+                } else {
+                    int color = editorSyntaxToColor(hl[j]);
+                    if (color != current_color) {
+                        current_color = color;
+                        char buf[16];
+                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+                        abAppend(ab, buf, clen);
+                    }
+                    abAppend(ab, &c[j], 1);
+                }
+            }
+            abAppend(ab, "\x1b[39m", 5);
+        }
+        abAppend(ab, "\x1b[K", 3);
+        abAppend(ab, "\r\n", 2);
+    }
+}
+*/
+static int editorRowCxToRx(erow *row, int cx) {
+    int rx = 0;
+    for (int j = 0; j < cx; j++) {
+        if (row->chars[j] == '\t') rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+        rx++;
+    }
+    return rx;
+}
+
+static int editorRowRxToCx(erow *row, int rx) {
+    int cur_rx = 0;
+    int cx;
+    for (cx = 0; cx < row->size; cx++) {
+        if (row->chars[cx] == '\t') cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
+        cur_rx++;
+        if (cur_rx > rx) return cx;
+    }
+    return cx;
+}
+
+static void editorInsertChar(int c) {
+    if (E.cy == E.numrows) editorInsertRow(E.numrows, "", 0);
+    editorRowInsertChar(&E.row[E.cy], E.cx, c);
+    E.cx++;
+}
+
+static void editorDelChar(void) {
+    if (E.cy == E.numrows) return;
+    if (E.cx == 0 && E.cy == 0) return;
+    erow *row = &E.row[E.cy];
+    if (E.cx > 0) {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+    } else {
+        E.cx = E.row[E.cy - 1].size;
+        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+/* left open at the end, so every repeated copy flips the comment state
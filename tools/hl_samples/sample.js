@@ -0,0 +1,72 @@
+/* Sample input for tools/hl_diff.c (javascript syntax) */
+const re = "a // b /* c */";
+let tpl = 'it\'s "quoted"'; var n = 10.5e3 + 0xff - 07;
+function f(a, b) { return a ?? b; } // trailing comment
+class A extends B { constructor() { super(); this.x = null; } }
+async function g() { await Promise.all([1, 2, 3]); }
+if (typeof x === 'undefined') { throw new Error("nope\\"); }
+/** doc
+ * @param {number} v
+ */ export default function h(v) { return v*2; }
+const obj = { true: false, null: undefined, "for": 1 };
+for (const k of Object.keys(obj)) console.log(k, obj[k]);
+/*
+function legacyRender(rows, width) {
+  const out = [];
+  for (let i = 0; i < rows.length; i++) {
+    let line = rows[i];
+    if (line.length > width) {
+      line = line.slice(0, width - 1) + '>';
+    }
+    out.push(line.replace(/\t/g, '    '));
+  }
+  return out.join('\n');
+}
+
+function legacyParse(text) {
+  const rows = text.split('\n');
+  const result = { rows: [], longest: 0 };
+  for (const row of rows) {
+    result.rows.push(row);
+    if (row.length > result.longest) {
+      result.longest = row.length;
+    }
+  }
+  return result;
+}
+
+module.exports = { legacyRender, legacyParse };
+*/
+export function render(rows, width) {
+  const out = [];
+  for (let i = 0; i < rows.length; i++) {
+    let line = rows[i];
+    if (line.length > width) {
+      line = line.slice(0, width - 1) + ">";
+    }
+    out.push(line);
+  }
+  return out.join("\n");
+}
+
+export function parse(text) {
+  const rows = text.split("\n");
+  let longest = 0;
+  for (const row of rows) {
+    if (row.length > longest) {
+      longest = row.length;
+    }
+  }
+  return { rows, longest };
+}
+
+export class Cursor {
+  constructor(x = 0, y = 0) {
+    this.x = x;
+    this.y = y;
+  }
+  move(dx, dy) {
+    return new Cursor(this.x + dx, this.y + dy);
+  }
+}
+/* open comment continued into the next copy
@@ -0,0 +1,61 @@
+--[[ Sample input for tools/hl_diff.c (lua syntax)
+it spans rows --]] local x = 1 -- trailing
+local s = "str\"ing" .. 'a\'b' --[[inline --]] return x
+function foo(a, b) if a == nil then return 0x1F + 3.14 end end
+--[==[ not a block comment ]==] for i=1,10 do print(i) end
+local t = { ["--[["] = true, n = #s, f = function() end }
+while not done do done = true end repeat x = x - 1 until x <= 0
+local str = "-- not a comment" local m = 'also --[[ not'
+goto continue ::continue::
+--[[ Disabled: the old keymap, kept for reference
+local keymap = {}
+keymap["ctrl-s"] = function() kilo.save() end
+keymap["ctrl-q"] = function() kilo.quit() end
+keymap["ctrl-f"] = function() kilo.find() end
+keymap["ctrl-o"] = function()
+  local path = kilo.prompt("Open: ")
+  if path then
+    kilo.open(path)
+  end
+end
+keymap["ctrl-g"] = function()
+  local line = tonumber(kilo.prompt("Line: "))
+  if line then
+    kilo.goto_line(line)
+  end
+end
+for key, fn in pairs(keymap) do
+  kilo.bind(key, fn)
+end
+return keymap
+--]]
+local function clamp(v, lo, hi)
+  if v < lo then
+    return lo
+  elseif v > hi then
+    return hi
+  end
+  return v
+end
+
+local function split(s, sep)
+  local out = {}
+  for part in string.gmatch(s, "([^" .. sep .. "]+)") do
+    out[#out + 1] = part
+  end
+  return out
+end
+
+local Buffer = {}
+Buffer.__index = Buffer
+
+function Buffer.new(lines)
+  return setmetatable({ lines = lines or {}, cursor = 1 }, Buffer)
+end
+
+function Buffer:line(n)
+  return self.lines[clamp(n, 1, #self.lines)]
+end
+
+return { clamp = clamp, split = split, Buffer = Buffer }
+--[[ left open so the next copy starts inside a comment
@@ -0,0 +1,16 @@
+# Sample input for tools/hl_diff.c (python syntax)
+def f(a, b=3.5, *args, **kwargs):
+    """docstring # not a comment"""
+    return a if a is not None else b  # trailing
+class Point(object):
+    def __init__(self, x=0, y=0): self.x, self.y = x, y
+s = 'it\'s' + "a \"b\"" + r'\d+'
+n = 0x1f + 1_000 + 1e-3 + 10j
+for i in range(10):
+    if i % 2 == 0: continue
+    elif i > 7: break
+with open("f") as fh: data = fh.read()
+lambda x: x and not x or True
+try: pass
+except Exception as e: raise
+print("unterminated
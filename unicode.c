@@ -0,0 +1,139 @@
+#include <string.h>
+#include <limits.h>
+
+#include "unicode.h"
+#include "unicode_width_table.h" // Generated by tools/gen_unicode_width.c
+
+/**
+ * Unicode Helpers
+ *
+ * Self-contained UTF-8 decoding and display widths, so measuring text never
+ * depends on the C library's locale state (no mbtowc/wcwidth per character).
+ * Widths come from a two-level table generated at build time: the code
+ * point's block number selects one of the distinct 256-entry blocks, which
+ * stores two bits per code point.
+ */
+
+/*
+ * Decodes one UTF-8 sequence from s (at most len bytes).
+ * Returns the sequence length and stores the code point in *cp,
+ * or returns -1 for an invalid, overlong or truncated sequence.
+ */
+int utf8Decode(const char *s, int len, unsigned int *cp) {
+    unsigned char c = (unsigned char)s[0];
+    int n;
+    unsigned int min;
+
+    if (c < 0x80) { *cp = c; return 1; }
+    else if ((c & 0xE0) == 0xC0) { n = 2; *cp = c & 0x1F; min = 0x80; }
+    else if ((c & 0xF0) == 0xE0) { n = 3; *cp = c & 0x0F; min = 0x800; }
+    else if ((c & 0xF8) == 0xF0) { n = 4; *cp = c & 0x07; min = 0x10000; }
+    else return -1;
+
+    if (n > len) return -1;
+    for (int i = 1; i < n; i++) {
+        if (!IS_UTF8_CONT(s[i])) return -1;
+        *cp = (*cp << 6) | ((unsigned char)s[i] & 0x3F);
+    }
+    if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF)) return -1;
+    return n;
+}
+
+// Screen cells taken by a code point: 0, 1 or 2, or -1 for control
+// characters that must not be drawn as-is
+int unicodeWidth(unsigned int cp) {
+    if (cp >= UNICODE_WIDTH_BLOCKS * UNICODE_WIDTH_BLOCK) return -1;
+    unsigned int block = unicode_width_index[cp / UNICODE_WIDTH_BLOCK];
+    unsigned int offset = cp % UNICODE_WIDTH_BLOCK;
+    int w = (unicode_width_blocks[block][offset / 4] >> ((offset % 4) * 2)) & 3;
+    return w == 3 ? -1 : w;
+}
+
+// Returns the index just past an ANSI escape sequence starting at s[i]
+static int skipAnsiEscape(const char *s, int i, int n) {
+    i++; // Skip '\x1b'
+    if (i < n && s[i] == '[') { // CSI (Control Sequence Introducer)
+        i++; // Skip '['
+        // Skip parameters (digits and ';')
+        while (i < n && ((s[i] >= '0' && s[i] <= '9') || s[i] == ';')) i++;
+        if (i < n) i++; // Final command character, usually 'm'
+    } else if (i < n && s[i] == ']') { // OSC (Operating System Command)
+        i++; // Skip ']'
+        // Skip until BEL ('\a') or ST ('\x1b\\')
+        while (i < n && s[i] != '\a') {
+            if (s[i] == '\x1b' && i + 1 < n && s[i + 1] == '\\') return i + 2;
+            i++;
+        }
+        if (i < n) i++; // Skip BEL
+    } else if (i < n) {
+        i++; // Two-character escape
+    }
+    return i;
+}
+
+/**
+ * @brief Measures the longest prefix of s that fits in max_width cells.
+ *
+ * ANSI escape sequences take no space; control characters take none either,
+ * invalid UTF-8 bytes count as one cell each ('?'). Runs of printable ASCII
+ * are counted in bulk without decoding. A character that would overflow
+ * max_width is not included, so a wide character is never split.
+ *
+ * @param s The null-terminated UTF-8 string to measure.
+ * @param max_width Width limit in cells (INT_MAX for no limit).
+ * @param width_out If not NULL, receives the width of the prefix.
+ * @return Byte length of the prefix, suitable for truncating s.
+ */
+int calculate_visible_prefix_ansi(const char *s, int max_width, int *width_out) {
+    int width = 0;
+    int i = 0;
+    int n = s ? (int)strlen(s) : 0;
+
+    while (i < n) {
+        unsigned char c = (unsigned char)s[i];
+
+        if (c >= 0x20 && c < 0x7F) {
+            // Printable ASCII run: one cell per byte, no decoding
+            int run = i;
+            while (run < n && (unsigned char)s[run] >= 0x20 && (unsigned char)s[run] < 0x7F) run++;
+            if (width + (run - i) > max_width) {
+                i += max_width - width;
+                width = max_width;
+                break;
+            }
+            width += run - i;
+            i = run;
+        } else if (c == '\x1b') {
+            i = skipAnsiEscape(s, i, n);
+        } else {
+            unsigned int cp;
+            int len = utf8Decode(&s[i], n - i, &cp);
+            int w;
+            if (len < 0) {
+                len = 1; // Invalid byte, drawn as a replacement
+                w = 1;
+            } else {
+                w = unicodeWidth(cp);
+                if (w < 0) w = 0; // Control characters take no space
+            }
+            if (width + w > max_width) break;
+            width += w;
+            i += len;
+        }
+    }
+
+    if (width_out) *width_out = width;
+    return i;
+}
+
+/**
+ * @brief Calculate the visible column width of a UTF-8 string, ignoring ANSI escape codes.
+ *
+ * @param s The null-terminated UTF-8 string to measure.
+ * @return The total visible column width of the string.
+ */
+int calculate_visible_length_ansi(const char *s) {
+    int width;
+    calculate_visible_prefix_ansi(s, INT_MAX, &width);
+    return width;
+}